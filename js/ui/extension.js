@@ -197,6 +197,7 @@ Extension.prototype = {
         this.lowerType = type.name.toLowerCase().replace(/\s/g, "_");
         this.theme = null;
         this.stylesheet = null;
+        this.stylesheetCancellable = null;
         this.iconDirectory = null;
         this.meta = createMetaDummy(uuid, dir.get_path(), State.INITIALIZING);
 
@@ -207,7 +208,9 @@ Extension.prototype = {
             type.legacyMeta[uuid] = {path: this.meta.path};
 
             ensureFileExists(this.dir.get_child(`${this.lowerType}.js`));
-            this.loadStylesheet(this.dir.get_child('stylesheet.css'));
+            // Parsed in a worker thread while the module is being loaded, so that
+            // the stylesheets of all the xlets starting up are parsed in parallel.
+            let stylesheetLoaded = this.loadStylesheetAsync(this.dir.get_child('stylesheet.css'));
 
             if (this.stylesheet) {
                 Main.themeManager.connect('theme-set', () => {
@@ -216,7 +219,7 @@ Extension.prototype = {
             }
             this.loadIconDirectory(this.dir);
             // get [extension/applet/desklet].js
-            return requireModule(
+            let moduleLoaded = requireModule(
                 `${this.meta.path}/${this.lowerType}.js`, // path
                 this.meta.path, // dir,
                 this.meta, // meta
@@ -224,6 +227,7 @@ Extension.prototype = {
                 true, // async
                 true // returnIndex
             );
+            return Promise.all([stylesheetLoaded, moduleLoaded]).then(([, moduleIndex]) => moduleIndex);
         };
 
         return loadMetaData({
@@ -359,7 +363,48 @@ Extension.prototype = {
         }
     },
 
+    // Like loadStylesheet, but parses the stylesheet in a worker thread. The
+    // returned promise always resolves: like a failed synchronous load, a
+    // stylesheet that can't be parsed doesn't keep the xlet from loading.
+    loadStylesheetAsync: function (file) {
+        if (!file.query_exists(null)) {
+            return Promise.resolve();
+        }
+
+        try {
+            let themeContext = St.ThemeContext.get_for_stage(global.stage);
+            this.theme = themeContext.get_theme();
+        } catch (e) {
+            return Promise.reject(logError('Error trying to get theme', this.uuid, e));
+        }
+
+        let path = file.get_path();
+        let cancellable = new Gio.Cancellable();
+        this.stylesheet = path;
+        this.stylesheetCancellable = cancellable;
+
+        return new Promise((resolve) => {
+            this.theme.load_stylesheet_async(path, cancellable, (theme, result) => {
+                if (this.stylesheetCancellable === cancellable) {
+                    this.stylesheetCancellable = null;
+                }
+                try {
+                    theme.load_stylesheet_finish(result);
+                } catch (e) {
+                    if (!(e instanceof GLib.Error && e.matches(Gio.IOErrorEnum, Gio.IOErrorEnum.CANCELLED))) {
+                        global.logWarning(formatError(this.uuid, `Stylesheet parse error: ${e.message}`));
+                    }
+                }
+                resolve();
+            });
+        });
+    },
+
     unloadStylesheet: function () {
+        if (this.stylesheetCancellable != null) {
+            this.stylesheetCancellable.cancel();
+            this.stylesheetCancellable = null;
+        }
         if (this.theme != null && this.stylesheet != null) {
             try {
                 this.theme.unload_stylesheet(this.stylesheet);
@@ -218,6 +218,123 @@ malloc_statistics_callback (CinnamonPerfLog *perf_log,
 #endif
 }
 
+static void
+theme_node_statistics_callback (CinnamonPerfLog *perf_log,
+                                gpointer      data)
+{
+  CinnamonGlobal *global = cinnamon_global_get ();
+  StThemeContext *context;
+  guint n_nodes, n_hits, n_misses, n_evictions;
+  gsize drawing_state_bytes;
+
+  if (global == NULL || cinnamon_global_get_stage (global) == NULL)
+    return;
+
+  context = st_theme_context_get_for_stage (cinnamon_global_get_stage (global));
+  st_theme_context_get_node_statistics (context,
+                                        &n_nodes, &n_hits, &n_misses,
+                                        &n_evictions, &drawing_state_bytes);
+
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.themeNodes.count",
+                                     n_nodes);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.themeNodes.hits",
+                                     n_hits);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.themeNodes.misses",
+                                     n_misses);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.themeNodes.evictions",
+                                     n_evictions);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.themeNodes.drawingStateSize",
+                                     MIN (drawing_state_bytes, G_MAXINT));
+}
+
+static void
+background_cache_statistics_callback (CinnamonPerfLog *perf_log,
+                                      gpointer      data)
+{
+  guint n_entries, n_hits, n_misses, n_evictions;
+  gsize bytes;
+
+  st_theme_node_get_background_cache_statistics (&n_entries, &bytes,
+                                                 &n_hits, &n_misses, &n_evictions);
+
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.backgroundCache.count",
+                                     n_entries);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.backgroundCache.size",
+                                     MIN (bytes, G_MAXINT));
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.backgroundCache.hits",
+                                     n_hits);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.backgroundCache.misses",
+                                     n_misses);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.backgroundCache.evictions",
+                                     n_evictions);
+}
+
+static void
+texture_cache_statistics_callback (CinnamonPerfLog *perf_log,
+                                   gpointer      data)
+{
+  guint n_entries, n_hits, n_misses, n_evictions;
+  gsize bytes;
+
+  st_texture_cache_get_statistics (st_texture_cache_get_default (),
+                                   &n_entries, &bytes,
+                                   &n_hits, &n_misses, &n_evictions);
+
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.textureCache.count",
+                                     n_entries);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.textureCache.size",
+                                     MIN (bytes, G_MAXINT));
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.textureCache.hits",
+                                     n_hits);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.textureCache.misses",
+                                     n_misses);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.textureCache.evictions",
+                                     n_evictions);
+}
+
+static void
+transition_statistics_callback (CinnamonPerfLog *perf_log,
+                                gpointer      data)
+{
+  guint n_active, n_created, n_buffers_in_use, n_buffers_pooled;
+  gsize pooled_bytes;
+
+  st_theme_node_get_transition_statistics (&n_active, &n_created,
+                                           &n_buffers_in_use, &n_buffers_pooled,
+                                           &pooled_bytes);
+
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.transitions.active",
+                                     n_active);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.transitions.created",
+                                     n_created);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.transitions.buffersInUse",
+                                     n_buffers_in_use);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.transitions.buffersPooled",
+                                     n_buffers_pooled);
+  cinnamon_perf_log_update_statistic_i (perf_log,
+                                     "st.transitions.pooledSize",
+                                     MIN (pooled_bytes, G_MAXINT));
+}
+
 static void
 cinnamon_a11y_init (void)
 {
@@ -259,6 +376,106 @@ cinnamon_perf_log_init (void)
   cinnamon_perf_log_add_statistics_callback (perf_log,
                                           malloc_statistics_callback,
                                           NULL, NULL);
+
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.themeNodes.count",
+                                   "Number of theme nodes interned by the stage's theme context",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.themeNodes.hits",
+                                   "Number of theme node lookups that found an interned node",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.themeNodes.misses",
+                                   "Number of theme node lookups that interned a new node",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.themeNodes.evictions",
+                                   "Number of unused theme nodes dropped from the intern table",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.themeNodes.drawingStateSize",
+                                   "Estimated texture memory held by interned theme nodes, in bytes",
+                                   "i");
+
+  cinnamon_perf_log_add_statistics_callback (perf_log,
+                                          theme_node_statistics_callback,
+                                          NULL, NULL);
+
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.backgroundCache.count",
+                                   "Number of prerendered theme node backgrounds shared between nodes",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.backgroundCache.size",
+                                   "Texture memory of the shared prerendered backgrounds, in bytes",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.backgroundCache.hits",
+                                   "Number of prerendered backgrounds found in the cache",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.backgroundCache.misses",
+                                   "Number of prerendered backgrounds rendered with cairo",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.backgroundCache.evictions",
+                                   "Number of prerendered backgrounds dropped to stay within the cache budget",
+                                   "i");
+
+  cinnamon_perf_log_add_statistics_callback (perf_log,
+                                          background_cache_statistics_callback,
+                                          NULL, NULL);
+
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.textureCache.count",
+                                   "Number of textures and surfaces in the texture cache",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.textureCache.size",
+                                   "Memory taken by the texture cache, in bytes",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.textureCache.hits",
+                                   "Number of texture cache lookups that found a cached texture",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.textureCache.misses",
+                                   "Number of texture cache lookups that had to load a texture",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.textureCache.evictions",
+                                   "Number of textures dropped to keep the texture cache within its budget",
+                                   "i");
+
+  cinnamon_perf_log_add_statistics_callback (perf_log,
+                                          texture_cache_statistics_callback,
+                                          NULL, NULL);
+
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.transitions.active",
+                                   "Number of theme node transitions alive",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.transitions.created",
+                                   "Number of theme node transitions started",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.transitions.buffersInUse",
+                                   "Number of offscreen buffers theme node transitions are painted into",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.transitions.buffersPooled",
+                                   "Number of idle offscreen buffers kept for theme node transitions",
+                                   "i");
+  cinnamon_perf_log_define_statistic (perf_log,
+                                   "st.transitions.pooledSize",
+                                   "Texture memory of the idle transition offscreen buffers, in bytes",
+                                   "i");
+
+  cinnamon_perf_log_add_statistics_callback (perf_log,
+                                          transition_statistics_callback,
+                                          NULL, NULL);
 }
 
 static void
@@ -23,6 +23,7 @@
  */
 
 #include "cr-additional-sel.h"
+#include "cr-arena.h"
 #include "string.h"
 
 /**
@@ -47,7 +48,7 @@ cr_additional_sel_new (void)
 {
         CRAdditionalSel *result = NULL;
 
-        result = g_try_malloc (sizeof (CRAdditionalSel));
+        result = cr_arena_alloc_object (sizeof (CRAdditionalSel));
 
         if (result == NULL) {
                 cr_utils_trace_debug ("Out of memory");
@@ -496,5 +497,5 @@ cr_additional_sel_destroy (CRAdditionalSel * a_this)
                 cr_additional_sel_destroy (a_this->next);
         }
 
-        g_free (a_this);
+        cr_arena_free_object (a_this);
 }
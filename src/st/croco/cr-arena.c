@@ -0,0 +1,358 @@
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 8-*- */
+
+/*
+ * This file is part of The Croco Library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ *
+ * See COPYRIGHTS file for copyright information.
+ */
+
+#include <string.h>
+#include "cr-arena.h"
+#include "cr-utils.h"
+
+/**
+ *@CRArena:
+ *
+ *A #CRArena is the memory all the objects of a parsed style sheet
+ *(or of a parsed declaration list) are carved from. While an arena
+ *is the current one of a thread (see cr_arena_set_current()), the
+ *object model constructors allocate from it instead of the heap.
+ *
+ *Destroying an object of an arena releases its resources but not
+ *its memory: that is given back all at once when the last reference
+ *to the arena goes away. The arena's owner (see cr_arena_set_owner())
+ *is the object whose destruction drops the arena, without walking
+ *down the objects it contains.
+ *
+ *Resources an arena object holds outside of the arena, like the
+ *GString of a #CRString, are registered with cr_arena_add_cleanup()
+ *so they are released along with the arena.
+ */
+
+/*
+ *Every object allocated by cr_arena_alloc_object() is preceded
+ *by this header, which tells arena objects from heap ones.
+ */
+typedef union {
+        CRArena *arena;
+        gdouble align_double;
+        gint64 align_int64;
+} CRArenaHeader;
+
+#define CR_ARENA_ALIGN sizeof (CRArenaHeader)
+#define CR_ARENA_CHUNK_SIZE (32 * 1024)
+
+typedef struct _CRArenaChunk CRArenaChunk;
+
+struct _CRArenaChunk {
+        CRArenaChunk *next;
+        gsize size;
+        gsize used;
+        /*keeps data aligned*/
+        CRArenaHeader data[1];
+};
+
+typedef struct _CRArenaCleanup CRArenaCleanup;
+
+struct _CRArenaCleanup {
+        CRArenaCleanup *next;
+        GDestroyNotify func;
+        gpointer data;
+};
+
+struct _CRArena {
+        CRArenaChunk *chunks;
+        CRArenaCleanup *cleanups;
+        gpointer owner;
+        gulong ref_count;
+};
+
+static GPrivate current_arena;
+
+static gpointer
+cr_arena_alloc (CRArena * a_this, gsize a_size)
+{
+        CRArenaChunk *chunk = a_this->chunks;
+        gpointer result = NULL;
+
+        a_size = (a_size + CR_ARENA_ALIGN - 1) & ~(CR_ARENA_ALIGN - 1);
+
+        if (!chunk || chunk->size - chunk->used < a_size) {
+                gsize size = MAX (a_size, CR_ARENA_CHUNK_SIZE);
+
+                chunk = g_malloc (G_STRUCT_OFFSET (CRArenaChunk, data) + size);
+                chunk->size = size;
+                chunk->used = 0;
+
+                /*
+                 *Keep filling the current chunk if this
+                 *one is only here for a big object.
+                 */
+                if (a_this->chunks && size == a_size) {
+                        chunk->next = a_this->chunks->next;
+                        a_this->chunks->next = chunk;
+                } else {
+                        chunk->next = a_this->chunks;
+                        a_this->chunks = chunk;
+                }
+        }
+
+        result = (guchar *) chunk->data + chunk->used;
+        chunk->used += a_size;
+
+        return result;
+}
+
+/**
+ * cr_arena_new:
+ *
+ *Instanciates a new, empty, #CRArena, with a
+ *reference count of one.
+ *
+ *Returns the newly built instance of #CRArena.
+ */
+CRArena *
+cr_arena_new (void)
+{
+        CRArena *result = NULL;
+
+        result = g_new0 (CRArena, 1);
+        result->ref_count = 1;
+
+        return result;
+}
+
+/**
+ * cr_arena_ref:
+ *@a_this: the current instance of #CRArena.
+ *
+ *Increases the reference count of the arena.
+ *
+ *Returns @a_this.
+ */
+CRArena *
+cr_arena_ref (CRArena * a_this)
+{
+        g_return_val_if_fail (a_this, NULL);
+
+        a_this->ref_count++;
+
+        return a_this;
+}
+
+/**
+ * cr_arena_unref:
+ *@a_this: the current instance of #CRArena.
+ *
+ *Decreases the reference count of the arena. When it drops
+ *to zero, runs the cleanups registered with the arena, then
+ *frees the memory of all its objects at once.
+ */
+void
+cr_arena_unref (CRArena * a_this)
+{
+        CRArenaCleanup *cleanup = NULL;
+        CRArenaChunk *chunk = NULL,
+                *next = NULL;
+
+        g_return_if_fail (a_this && a_this->ref_count);
+
+        if (--a_this->ref_count)
+                return;
+
+        for (cleanup = a_this->cleanups; cleanup; cleanup = cleanup->next) {
+                cleanup->func (cleanup->data);
+        }
+
+        for (chunk = a_this->chunks; chunk; chunk = next) {
+                next = chunk->next;
+                g_free (chunk);
+        }
+
+        g_free (a_this);
+}
+
+/**
+ * cr_arena_set_current:
+ *@a_this: the arena to allocate objects from, or NULL to
+ *allocate them from the heap.
+ *
+ *Makes @a_this the arena the object model constructors of the
+ *calling thread allocate from. The caller does not give up its
+ *reference; it must restore the previous arena before dropping it.
+ *
+ *Returns the previous current arena of the calling thread.
+ */
+CRArena *
+cr_arena_set_current (CRArena * a_this)
+{
+        CRArena *previous = g_private_get (&current_arena);
+
+        g_private_set (&current_arena, a_this);
+
+        return previous;
+}
+
+/**
+ * cr_arena_get_current:
+ *
+ *Returns the current arena of the calling thread, if any.
+ */
+CRArena *
+cr_arena_get_current (void)
+{
+        return g_private_get (&current_arena);
+}
+
+/**
+ * cr_arena_set_owner:
+ *@a_this: the current instance of #CRArena.
+ *@a_owner: an object allocated from @a_this.
+ *
+ *Makes @a_owner the object whose destruction releases the
+ *arena: the owner takes a reference, which its destructor drops
+ *through cr_arena_release_owned_object().
+ */
+void
+cr_arena_set_owner (CRArena * a_this, gpointer a_owner)
+{
+        g_return_if_fail (a_this && a_owner && !a_this->owner);
+        g_return_if_fail (cr_arena_object_get_arena (a_owner) == a_this);
+
+        a_this->owner = a_owner;
+        cr_arena_ref (a_this);
+}
+
+/**
+ * cr_arena_add_cleanup:
+ *@a_this: the current instance of #CRArena.
+ *@a_func: the function to call.
+ *@a_data: the data to pass to @a_func.
+ *
+ *Registers @a_func to be called on @a_data when the arena
+ *is freed, before the memory of its objects is. Cleanups run in
+ *the reverse order of their registration.
+ */
+void
+cr_arena_add_cleanup (CRArena * a_this, GDestroyNotify a_func,
+                      gpointer a_data)
+{
+        CRArenaCleanup *cleanup = NULL;
+
+        g_return_if_fail (a_this && a_func);
+
+        cleanup = cr_arena_alloc (a_this, sizeof (CRArenaCleanup));
+        cleanup->func = a_func;
+        cleanup->data = a_data;
+        cleanup->next = a_this->cleanups;
+        a_this->cleanups = cleanup;
+}
+
+/**
+ * cr_arena_alloc_object:
+ *@a_size: the size of the object.
+ *
+ *Allocates a zeroed object from the current arena of the
+ *calling thread, or from the heap if there is none. The object
+ *must be freed with cr_arena_free_object().
+ *
+ *Returns the newly allocated object, or NULL if out of memory.
+ */
+gpointer
+cr_arena_alloc_object (gsize a_size)
+{
+        CRArena *arena = g_private_get (&current_arena);
+        CRArenaHeader *header = NULL;
+
+        if (arena) {
+                header = cr_arena_alloc (arena,
+                                         sizeof (CRArenaHeader) + a_size);
+                memset (header, 0, sizeof (CRArenaHeader) + a_size);
+        } else {
+                header = g_try_malloc0 (sizeof (CRArenaHeader) + a_size);
+                if (!header) {
+                        cr_utils_trace_info ("Out of memory");
+                        return NULL;
+                }
+        }
+        header->arena = arena;
+
+        return header + 1;
+}
+
+/**
+ * cr_arena_free_object:
+ *@a_object: an object allocated with cr_arena_alloc_object(), or NULL.
+ *
+ *Frees a heap object. The memory of an arena object is only given
+ *back with the arena, so this does nothing for those.
+ */
+void
+cr_arena_free_object (gpointer a_object)
+{
+        CRArenaHeader *header = NULL;
+
+        if (!a_object)
+                return;
+
+        header = (CRArenaHeader *) a_object - 1;
+        if (!header->arena)
+                g_free (header);
+}
+
+/**
+ * cr_arena_object_get_arena:
+ *@a_object: an object allocated with cr_arena_alloc_object().
+ *
+ *Returns the arena @a_object was allocated from, or NULL if it
+ *was allocated from the heap.
+ */
+CRArena *
+cr_arena_object_get_arena (gconstpointer a_object)
+{
+        g_return_val_if_fail (a_object, NULL);
+
+        return ((const CRArenaHeader *) a_object - 1)->arena;
+}
+
+/**
+ * cr_arena_release_owned_object:
+ *@a_object: an object allocated with cr_arena_alloc_object().
+ *
+ *If @a_object is the owner of its arena, drops the owner's reference
+ *to it, which frees @a_object and every other object of the arena
+ *unless someone else still holds the arena. Destructors call this
+ *first, and skip walking down the object if it returns TRUE.
+ *
+ *Returns TRUE if @a_object owned its arena, FALSE otherwise.
+ */
+gboolean
+cr_arena_release_owned_object (gpointer a_object)
+{
+        CRArena *arena = NULL;
+
+        g_return_val_if_fail (a_object, FALSE);
+
+        arena = cr_arena_object_get_arena (a_object);
+        if (!arena || arena->owner != a_object)
+                return FALSE;
+
+        arena->owner = NULL;
+        cr_arena_unref (arena);
+
+        return TRUE;
+}
@@ -0,0 +1,62 @@
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 8-*- */
+
+/*
+ * This file is part of The Croco Library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ *
+ * See COPYRIGHTS file for copyright information.
+ */
+
+#ifndef __CR_ARENA_H__
+#define __CR_ARENA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ *@file
+ *The declaration of the #CRArena class.
+ */
+
+typedef struct _CRArena CRArena ;
+
+CRArena * cr_arena_new (void) ;
+
+CRArena * cr_arena_ref (CRArena *a_this) ;
+
+void cr_arena_unref (CRArena *a_this) ;
+
+CRArena * cr_arena_set_current (CRArena *a_this) ;
+
+CRArena * cr_arena_get_current (void) ;
+
+void cr_arena_set_owner (CRArena *a_this, gpointer a_owner) ;
+
+void cr_arena_add_cleanup (CRArena *a_this, GDestroyNotify a_func,
+                           gpointer a_data) ;
+
+gpointer cr_arena_alloc_object (gsize a_size) ;
+
+void cr_arena_free_object (gpointer a_object) ;
+
+CRArena * cr_arena_object_get_arena (gconstpointer a_object) ;
+
+gboolean cr_arena_release_owned_object (gpointer a_object) ;
+
+G_END_DECLS
+
+#endif /*__CR_ARENA_H__*/
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include "cr-attr-sel.h"
+#include "cr-arena.h"
 
 /**
  * CRAttrSel:
@@ -43,7 +44,7 @@ cr_attr_sel_new (void)
 {
         CRAttrSel *result = NULL;
 
-        result = g_malloc0 (sizeof (CRAttrSel));
+        result = cr_arena_alloc_object (sizeof (CRAttrSel));
 
         return result;
 }
@@ -228,7 +229,7 @@ cr_attr_sel_destroy (CRAttrSel * a_this)
         }
 
         if (a_this) {
-                g_free (a_this);
+                cr_arena_free_object (a_this);
                 a_this = NULL;
         }
 }
@@ -24,6 +24,7 @@
 
 #include <string.h>
 #include "cr-declaration.h"
+#include "cr-arena.h"
 #include "cr-statement.h"
 #include "cr-parser.h"
 
@@ -86,7 +87,7 @@ cr_declaration_new (CRStatement * a_statement,
                                           || (a_statement->type
                                               == AT_PAGE_RULE_STMT)), NULL);
 
-        result = g_try_malloc (sizeof (CRDeclaration));
+        result = cr_arena_alloc_object (sizeof (CRDeclaration));
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
                 return NULL;
@@ -191,11 +192,23 @@ cr_declaration_parse_list_from_buf (const guchar * a_str,
         CRParser *parser = NULL;
         CRTknzr *tokenizer = NULL;
         gboolean important = FALSE;
+        CRArena *arena = NULL,
+                *prev_arena = NULL;
 
         g_return_val_if_fail (a_str, NULL);
 
+        /*
+         *The whole list, and whatever the parser leaves
+         *behind, is allocated from an arena the list owns.
+         */
+        arena = cr_arena_new ();
+        prev_arena = cr_arena_set_current (arena);
+
         parser = cr_parser_new_from_buf ((guchar*)a_str, strlen ((const char *) a_str), a_enc, FALSE);
-        g_return_val_if_fail (parser, NULL);
+        if (!parser) {
+                status = CR_ERROR;
+                goto cleanup;
+        }
         status = cr_parser_get_tknzr (parser, &tokenizer);
         if (status != CR_OK || !tokenizer) {
                 if (status == CR_OK)
@@ -278,6 +291,12 @@ cr_declaration_parse_list_from_buf (const guchar * a_str,
                 cr_declaration_destroy (result);
                 result = NULL;
         }
+
+        cr_arena_set_current (prev_arena);
+        if (result)
+                cr_arena_set_owner (arena, result);
+        cr_arena_unref (arena);
+
         return result;
 }
 
@@ -772,6 +791,13 @@ cr_declaration_destroy (CRDeclaration * a_this)
 
         g_return_if_fail (a_this);
 
+        /*
+         * A list parsed by cr_declaration_parse_list_from_buf()
+         * lives in an arena of its own, freed all at once.
+         */
+        if (cr_arena_release_owned_object (a_this))
+                return;
+
         /*
          * Go to the last element of the list.
          */
@@ -783,7 +809,7 @@ cr_declaration_destroy (CRDeclaration * a_this)
          * Meanwhile, free each property/value pair contained in the list.
          */
         for (; cur; cur = cur->prev) {
-                g_free (cur->next);
+                cr_arena_free_object (cur->next);
                 cur->next = NULL;
 
                 if (cur->property) {
@@ -797,5 +823,5 @@ cr_declaration_destroy (CRDeclaration * a_this)
                 }
         }
 
-        g_free (a_this);
+        cr_arena_free_object (a_this);
 }
@@ -74,15 +74,16 @@ struct _CRInputPriv {
          */
         guint ref_count;
         gboolean free_in_buf;
+
+        /*
+         *The mapping in_buf points into when
+         *the input was created from a utf8 file.
+         */
+        GMappedFile *mapped_file;
 };
 
 #define PRIVATE(object) (object)->priv
 
-/***************************
- *private constants
- **************************/
-#define CR_INPUT_MEM_CHUNK_SIZE 1024 * 4
-
 static CRInput *cr_input_new_real (void);
 
 static CRInput *
@@ -196,78 +197,53 @@ CRInput *
 cr_input_new_from_uri (const gchar * a_file_uri, enum CREncoding a_enc)
 {
         CRInput *result = NULL;
-        enum CRStatus status = CR_OK;
-        FILE *file_ptr = NULL;
-        guchar tmp_buf[CR_INPUT_MEM_CHUNK_SIZE] = { 0 };
-        gulong nb_read = 0,
-                len = 0,
-                buf_size = 0;
-        gboolean loop = TRUE;
+        GMappedFile *mapped_file = NULL;
+        GError *error = NULL;
         guchar *buf = NULL;
+        gulong len = 0;
 
         g_return_val_if_fail (a_file_uri, NULL);
 
-        file_ptr = fopen (a_file_uri, "r");
+        mapped_file = g_mapped_file_new (a_file_uri, FALSE, &error);
 
-        if (file_ptr == NULL) {
+        if (mapped_file == NULL) {
 
 #ifdef CR_DEBUG
                 cr_utils_trace_debug ("could not open file");
 #endif
-                g_warning ("Could not open file %s\n", a_file_uri);
+                g_warning ("Could not open file %s: %s\n", a_file_uri,
+                           error->message);
+                g_error_free (error);
 
                 return NULL;
         }
 
-        /*load the file */
-        while (loop) {
-                nb_read = fread (tmp_buf, 1 /*read bytes */ ,
-                                 CR_INPUT_MEM_CHUNK_SIZE /*nb of bytes */ ,
-                                 file_ptr);
-
-                if (nb_read != CR_INPUT_MEM_CHUNK_SIZE) {
-                        /*we read less chars than we wanted */
-                        if (feof (file_ptr)) {
-                                /*we reached eof */
-                                loop = FALSE;
-                        } else {
-                                /*a pb occurred !! */
-                                cr_utils_trace_debug ("an io error occurred");
-                                status = CR_ERROR;
-                                goto cleanup;
-                        }
-                }
-
-                if (status == CR_OK) {
-                        /*read went well */
-                        buf = g_realloc (buf, len + CR_INPUT_MEM_CHUNK_SIZE);
-                        memcpy (buf + len, tmp_buf, nb_read);
-                        len += nb_read;
-                        buf_size += CR_INPUT_MEM_CHUNK_SIZE;
-                }
-        }
-
-        if (status == CR_OK) {
-                result = cr_input_new_from_buf (buf, len, a_enc, TRUE);
-                if (!result) {
-                        goto cleanup;
-                }
-                /*
-                 *we should  free buf here because it's own by CRInput.
-                 *(see the last parameter of cr_input_new_from_buf().
-                 */
-                buf = NULL;
+        /*
+         *The contents of an empty file are NULL, but an
+         *input stream wants a buffer, even an empty one.
+         */
+        len = g_mapped_file_get_length (mapped_file);
+        buf = (guchar *) g_mapped_file_get_contents (mapped_file);
+        if (buf == NULL) {
+                buf = (guchar *) "";
+                len = 0;
         }
 
- cleanup:
-        if (file_ptr) {
-                fclose (file_ptr);
-                file_ptr = NULL;
+        /*
+         *The mapping is read only and is never copied: in_buf
+         *points right into it unless the file has to be converted
+         *to utf8 first, in which case the converted copy is all
+         *we need to keep.
+         */
+        result = cr_input_new_from_buf (buf, len, a_enc, FALSE);
+        if (result && PRIVATE (result)->in_buf == buf) {
+                PRIVATE (result)->mapped_file = mapped_file;
+                mapped_file = NULL;
         }
 
-        if (buf) {
-                g_free (buf);
-                buf = NULL;
+        if (mapped_file) {
+                g_mapped_file_unref (mapped_file);
+                mapped_file = NULL;
         }
 
         return result;
@@ -291,6 +267,11 @@ cr_input_destroy (CRInput * a_this)
                         PRIVATE (a_this)->in_buf = NULL;
                 }
 
+                if (PRIVATE (a_this)->mapped_file) {
+                        g_mapped_file_unref (PRIVATE (a_this)->mapped_file);
+                        PRIVATE (a_this)->mapped_file = NULL;
+                }
+
                 g_free (PRIVATE (a_this));
                 PRIVATE (a_this) = NULL;
         }
@@ -463,11 +444,22 @@ cr_input_read_char (CRInput * a_this, guint32 * a_char)
                 return CR_END_OF_INPUT_ERROR;
         }
 
-        status = cr_utils_read_char_from_utf8_buf
-                (PRIVATE (a_this)->in_buf
-                 +
-                 PRIVATE (a_this)->next_byte_index,
-                 nb_bytes_left, a_char, &consumed);
+        /*
+         *Style sheets are almost all ascii: don't go
+         *through the utf8 decoder for those.
+         */
+        if (PRIVATE (a_this)->in_buf[PRIVATE (a_this)->next_byte_index]
+            < 0x80) {
+                *a_char = PRIVATE (a_this)->in_buf
+                        [PRIVATE (a_this)->next_byte_index];
+                consumed = 1;
+        } else {
+                status = cr_utils_read_char_from_utf8_buf
+                        (PRIVATE (a_this)->in_buf
+                         +
+                         PRIVATE (a_this)->next_byte_index,
+                         nb_bytes_left, a_char, &consumed);
+        }
 
         if (status == CR_OK) {
                 /*update next byte index */
@@ -738,6 +730,80 @@ cr_input_consume_white_spaces (CRInput * a_this, gulong * a_nb_chars)
         return status;
 }
 
+static gboolean
+ascii_class_matches (enum CRAsciiClass a_class, guchar a_byte)
+{
+        switch (a_class) {
+        case CR_ASCII_WHITE_SPACE:
+                return cr_utils_is_white_space (a_byte);
+        case CR_ASCII_NMCHAR:
+                return g_ascii_isalnum (a_byte)
+                        || a_byte == '-' || a_byte == '_';
+        case CR_ASCII_DIGIT:
+                return g_ascii_isdigit (a_byte);
+        case CR_ASCII_COMMENT_TEXT:
+                return a_byte < 0x80 && a_byte != '*';
+        default:
+                return FALSE;
+        }
+}
+
+/**
+ * cr_input_consume_ascii_run:
+ *@a_this: the "this pointer" of the current instance of #CRInput.
+ *@a_class: the class of the bytes to consume.
+ *@a_run: out parameter. If not NULL, is set to the address of
+ *the first byte consumed. The run is not nul terminated and
+ *belongs to the input stream.
+ *
+ *Consumes, in one go, all the ascii bytes of class @a_class
+ *found from the current position on, updating the line and
+ *column numbers the way cr_input_read_char() would. Stops at the
+ *first byte that is not of that class, at the first non ascii
+ *byte or at the end of the input.
+ *
+ *Returns the number of bytes consumed.
+ */
+gulong
+cr_input_consume_ascii_run (CRInput * a_this, enum CRAsciiClass a_class,
+                            guchar ** a_run)
+{
+        CRInputPriv *priv = NULL;
+        gulong cur = 0;
+
+        g_return_val_if_fail (a_this && PRIVATE (a_this), 0);
+
+        priv = PRIVATE (a_this);
+
+        if (a_run)
+                *a_run = priv->in_buf + priv->next_byte_index;
+
+        if (priv->end_of_input == TRUE)
+                return 0;
+
+        for (cur = priv->next_byte_index;
+             cur < priv->nb_bytes
+                     && ascii_class_matches (a_class, priv->in_buf[cur]);
+             cur++) {
+                if (priv->end_of_line == TRUE) {
+                        priv->col = 1;
+                        priv->line++;
+                        priv->end_of_line = FALSE;
+                } else if (priv->in_buf[cur] != '\n') {
+                        priv->col++;
+                }
+
+                if (priv->in_buf[cur] == '\n') {
+                        priv->end_of_line = TRUE;
+                }
+        }
+
+        cur -= priv->next_byte_index;
+        priv->next_byte_index += cur;
+
+        return cur;
+}
+
 /**
  * cr_input_peek_char:
  *@a_this: the current instance of #CRInput.
@@ -772,6 +838,13 @@ cr_input_peek_char (CRInput const * a_this, guint32 * a_char)
                 return CR_END_OF_INPUT_ERROR;
         }
 
+        if (PRIVATE (a_this)->in_buf[PRIVATE (a_this)->next_byte_index]
+            < 0x80) {
+                *a_char = PRIVATE (a_this)->in_buf
+                        [PRIVATE (a_this)->next_byte_index];
+                return CR_OK;
+        }
+
         status = cr_utils_read_char_from_utf8_buf
                 (PRIVATE (a_this)->in_buf +
                  PRIVATE (a_this)->next_byte_index,
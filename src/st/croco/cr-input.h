@@ -60,6 +60,22 @@ struct _CRInputPos
         glong next_byte_index ;
 } ;
 
+/**
+ *The classes of ASCII bytes cr_input_consume_ascii_run()
+ *knows how to skip over in bulk.
+ */
+enum CRAsciiClass
+{
+        /*[ \t\r\n\f]*/
+        CR_ASCII_WHITE_SPACE,
+        /*[a-zA-Z0-9_-], the ascii part of an nmchar*/
+        CR_ASCII_NMCHAR,
+        /*[0-9]*/
+        CR_ASCII_DIGIT,
+        /*any ascii byte but '*', the body of a comment*/
+        CR_ASCII_COMMENT_TEXT
+} ;
+
 CRInput *
 cr_input_new_from_buf (guchar *a_buf, gulong a_len,
                        enum CREncoding a_enc, gboolean a_free_buf) ;
@@ -92,6 +108,10 @@ cr_input_consume_char (CRInput *a_this, guint32 a_char) ;
 enum CRStatus
 cr_input_consume_white_spaces (CRInput *a_this, gulong *a_nb_chars) ;
 
+gulong
+cr_input_consume_ascii_run (CRInput *a_this, enum CRAsciiClass a_class,
+                            guchar **a_run) ;
+
 enum CRStatus
 cr_input_peek_byte (CRInput const *a_this, enum CRSeekPos a_origin,
                     gulong a_offset, guchar *a_byte) ;
@@ -24,6 +24,7 @@
 #include <string.h>
 #include "cr-utils.h"
 #include "cr-om-parser.h"
+#include "cr-arena.h"
 
 /**
  *@CROMParser:
@@ -35,6 +36,12 @@
 
 struct _CROMParserPriv {
         CRParser *parser;
+
+        /*
+         *The arenas of the style sheets parsed so far:
+         *the parser may still hold tokens allocated from them.
+         */
+        GSList *arenas;
 };
 
 #define PRIVATE(a_this) ((a_this)->priv)
@@ -778,6 +785,21 @@ unrecoverable_error (CRDocHandler * a_this)
         }
 }
 
+/*
+ *Everything a parse builds is allocated from an arena of
+ *its own, which the resulting style sheet owns.
+ */
+static CRArena *
+begin_parse_arena (CROMParser * a_this)
+{
+        CRArena *arena = cr_arena_new ();
+
+        PRIVATE (a_this)->arenas =
+                g_slist_prepend (PRIVATE (a_this)->arenas, arena);
+
+        return cr_arena_set_current (arena);
+}
+
 /********************************************
  *Public methods
  ********************************************/
@@ -856,6 +878,7 @@ cr_om_parser_parse_buf (CROMParser * a_this,
 {
 
         enum CRStatus status = CR_OK;
+        CRArena *prev_arena = NULL;
 
         g_return_val_if_fail (a_this && a_result, CR_BAD_PARAM_ERROR);
 
@@ -863,8 +886,10 @@ cr_om_parser_parse_buf (CROMParser * a_this,
                 PRIVATE (a_this)->parser = cr_parser_new (NULL);
         }
 
+        prev_arena = begin_parse_arena (a_this);
         status = cr_parser_parse_buf (PRIVATE (a_this)->parser,
                                       a_buf, a_len, a_enc);
+        cr_arena_set_current (prev_arena);
 
         if (status == CR_OK) {
                 CRStyleSheet *result = NULL;
@@ -879,8 +904,11 @@ cr_om_parser_parse_buf (CROMParser * a_this,
                                                     (gpointer *) resultptr);
                 g_return_val_if_fail (status == CR_OK, status);
 
-                if (result)
+                if (result) {
+                        cr_arena_set_owner (PRIVATE (a_this)->arenas->data,
+                                            result);
                         *a_result = result;
+                }
         }
 
         return status;
@@ -944,6 +972,7 @@ cr_om_parser_parse_file (CROMParser * a_this,
                          enum CREncoding a_enc, CRStyleSheet ** a_result)
 {
         enum CRStatus status = CR_OK;
+        CRArena *prev_arena = NULL;
 
         g_return_val_if_fail (a_this && a_file_uri && a_result,
                               CR_BAD_PARAM_ERROR);
@@ -953,8 +982,10 @@ cr_om_parser_parse_file (CROMParser * a_this,
                         (a_file_uri, a_enc);
         }
 
+        prev_arena = begin_parse_arena (a_this);
         status = cr_parser_parse_file (PRIVATE (a_this)->parser,
                                        a_file_uri, a_enc);
+        cr_arena_set_current (prev_arena);
 
         if (status == CR_OK) {
                 CRStyleSheet *result = NULL;
@@ -968,8 +999,11 @@ cr_om_parser_parse_file (CROMParser * a_this,
                 status = cr_doc_handler_get_result
                         (sac_handler, (gpointer *) resultptr);
                 g_return_val_if_fail (status == CR_OK, status);
-                if (result)
+                if (result) {
+                        cr_arena_set_owner (PRIVATE (a_this)->arenas->data,
+                                            result);
                         *a_result = result;
+                }
         }
 
         return status;
@@ -1130,6 +1164,10 @@ cr_om_parser_destroy (CROMParser * a_this)
                 PRIVATE (a_this)->parser = NULL;
         }
 
+        g_slist_free_full (PRIVATE (a_this)->arenas,
+                           (GDestroyNotify) cr_arena_unref);
+        PRIVATE (a_this)->arenas = NULL;
+
         if (PRIVATE (a_this)) {
                 g_free (PRIVATE (a_this));
                 PRIVATE (a_this) = NULL;
@@ -22,6 +22,7 @@
  */
 
 #include "cr-pseudo.h"
+#include "cr-arena.h"
 
 /**
  *@CRPseudo:
@@ -39,7 +40,7 @@ cr_pseudo_new (void)
 {
         CRPseudo *result = NULL;
 
-        result = g_malloc0 (sizeof (CRPseudo));
+        result = cr_arena_alloc_object (sizeof (CRPseudo));
 
         return result;
 }
@@ -163,5 +164,5 @@ cr_pseudo_destroy (CRPseudo * a_this)
                 a_this->extra = NULL;
         }
 
-        g_free (a_this);
+        cr_arena_free_object (a_this);
 }
@@ -22,6 +22,7 @@
 
 #include <string.h>
 #include "cr-selector.h"
+#include "cr-arena.h"
 #include "cr-parser.h"
 
 /**
@@ -40,7 +41,7 @@ cr_selector_new (CRSimpleSel * a_simple_sel)
 {
         CRSelector *result = NULL;
 
-        result = g_try_malloc (sizeof (CRSelector));
+        result = cr_arena_alloc_object (sizeof (CRSelector));
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
                 return NULL;
@@ -282,14 +283,14 @@ cr_selector_destroy (CRSelector * a_this)
 
         /*in case the list has only one element */
         if (cur && !cur->prev) {
-                g_free (cur);
+                cr_arena_free_object (cur);
                 return;
         }
 
         /*walk backward the list and free each "next element" */
         for (cur = cur->prev; cur && cur->prev; cur = cur->prev) {
                 if (cur->next) {
-                        g_free (cur->next);
+                        cr_arena_free_object (cur->next);
                         cur->next = NULL;
                 }
         }
@@ -298,9 +299,9 @@ cr_selector_destroy (CRSelector * a_this)
                 return;
 
         if (cur->next) {
-                g_free (cur->next);
+                cr_arena_free_object (cur->next);
                 cur->next = NULL;
         }
 
-        g_free (cur);
+        cr_arena_free_object (cur);
 }
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <glib.h>
 #include "cr-simple-sel.h"
+#include "cr-arena.h"
 
 /**
  * cr_simple_sel_new:
@@ -37,7 +38,7 @@ cr_simple_sel_new (void)
 {
         CRSimpleSel *result = NULL;
 
-        result = g_try_malloc (sizeof (CRSimpleSel));
+        result = cr_arena_alloc_object (sizeof (CRSimpleSel));
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
                 return NULL;
@@ -320,6 +321,6 @@ cr_simple_sel_destroy (CRSimpleSel * a_this)
         }
 
         if (a_this) {
-                g_free (a_this);
+                cr_arena_free_object (a_this);
         }
 }
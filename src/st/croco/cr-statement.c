@@ -23,6 +23,7 @@
 
 #include <string.h>
 #include "cr-statement.h"
+#include "cr-arena.h"
 #include "cr-parser.h"
 
 /**
@@ -458,6 +459,21 @@ parse_ruleset_end_selector_cb (CRDocHandler * a_this,
                           && result->type == RULESET_STMT);
 }
 
+/*
+ *The media list of a media rule allocated from an arena is
+ *released with the arena, unless the rule got cleared before.
+ */
+static void
+cr_statement_free_media_list (gpointer a_media_rule)
+{
+        CRAtMediaRule *media_rule = a_media_rule;
+
+        if (media_rule->media_list) {
+                g_list_free (media_rule->media_list);
+                media_rule->media_list = NULL;
+        }
+}
+
 static void
 cr_statement_clear (CRStatement * a_this)
 {
@@ -478,7 +494,7 @@ cr_statement_clear (CRStatement * a_this)
                                 (a_this->kind.ruleset->decl_list);
                         a_this->kind.ruleset->decl_list = NULL;
                 }
-                g_free (a_this->kind.ruleset);
+                cr_arena_free_object (a_this->kind.ruleset);
                 a_this->kind.ruleset = NULL;
                 break;
 
@@ -490,7 +506,7 @@ cr_statement_clear (CRStatement * a_this)
                                 (a_this->kind.import_rule->url) ;
                         a_this->kind.import_rule->url = NULL;
                 }
-                g_free (a_this->kind.import_rule);
+                cr_arena_free_object (a_this->kind.import_rule);
                 a_this->kind.import_rule = NULL;
                 break;
 
@@ -516,7 +532,7 @@ cr_statement_clear (CRStatement * a_this)
                         g_list_free (a_this->kind.media_rule->media_list);
                         a_this->kind.media_rule->media_list = NULL;
                 }
-                g_free (a_this->kind.media_rule);
+                cr_arena_free_object (a_this->kind.media_rule);
                 a_this->kind.media_rule = NULL;
                 break;
 
@@ -539,7 +555,7 @@ cr_statement_clear (CRStatement * a_this)
                                 (a_this->kind.page_rule->pseudo);
                         a_this->kind.page_rule->pseudo = NULL;
                 }
-                g_free (a_this->kind.page_rule);
+                cr_arena_free_object (a_this->kind.page_rule);
                 a_this->kind.page_rule = NULL;
                 break;
 
@@ -552,7 +568,7 @@ cr_statement_clear (CRStatement * a_this)
                                 (a_this->kind.charset_rule->charset);
                         a_this->kind.charset_rule->charset = NULL;
                 }
-                g_free (a_this->kind.charset_rule);
+                cr_arena_free_object (a_this->kind.charset_rule);
                 a_this->kind.charset_rule = NULL;
                 break;
 
@@ -565,7 +581,7 @@ cr_statement_clear (CRStatement * a_this)
                                 (a_this->kind.font_face_rule->decl_list);
                         a_this->kind.font_face_rule->decl_list = NULL;
                 }
-                g_free (a_this->kind.font_face_rule);
+                cr_arena_free_object (a_this->kind.font_face_rule);
                 a_this->kind.font_face_rule = NULL;
                 break;
 
@@ -1135,7 +1151,7 @@ cr_statement_new_ruleset (CRStyleSheet * a_sheet,
                                       NULL);
         }
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1144,12 +1160,12 @@ cr_statement_new_ruleset (CRStyleSheet * a_sheet,
 
         memset (result, 0, sizeof (CRStatement));
         result->type = RULESET_STMT;
-        result->kind.ruleset = g_try_malloc (sizeof (CRRuleSet));
+        result->kind.ruleset = cr_arena_alloc_object (sizeof (CRRuleSet));
 
         if (!result->kind.ruleset) {
                 cr_utils_trace_info ("Out of memory");
                 if (result)
-                        g_free (result);
+                        cr_arena_free_object (result);
                 return NULL;
         }
 
@@ -1270,7 +1286,7 @@ cr_statement_new_at_media_rule (CRStyleSheet * a_sheet,
         if (a_rulesets)
                 g_return_val_if_fail (a_rulesets->type == RULESET_STMT, NULL);
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1280,10 +1296,10 @@ cr_statement_new_at_media_rule (CRStyleSheet * a_sheet,
         memset (result, 0, sizeof (CRStatement));
         result->type = AT_MEDIA_RULE_STMT;
 
-        result->kind.media_rule = g_try_malloc (sizeof (CRAtMediaRule));
+        result->kind.media_rule = cr_arena_alloc_object (sizeof (CRAtMediaRule));
         if (!result->kind.media_rule) {
                 cr_utils_trace_info ("Out of memory");
-                g_free (result);
+                cr_arena_free_object (result);
                 return NULL;
         }
         memset (result->kind.media_rule, 0, sizeof (CRAtMediaRule));
@@ -1293,13 +1309,18 @@ cr_statement_new_at_media_rule (CRStyleSheet * a_sheet,
                         cr_utils_trace_info ("Bad parameter a_rulesets. "
                                              "It should be a list of "
                                              "correct ruleset statement only !");
-                        g_free (result);
+                        cr_arena_free_object (result);
                         goto error;
                 }
                 cur->kind.ruleset->parent_media_rule = result;
         }
 
         result->kind.media_rule->media_list = a_media;
+        if (cr_arena_object_get_arena (result->kind.media_rule))
+                cr_arena_add_cleanup
+                        (cr_arena_object_get_arena (result->kind.media_rule),
+                         cr_statement_free_media_list,
+                         result->kind.media_rule);
         if (a_sheet) {
                 cr_statement_set_parent_sheet (result, a_sheet);
         }
@@ -1330,7 +1351,7 @@ cr_statement_new_at_import_rule (CRStyleSheet * a_container_sheet,
 {
         CRStatement *result = NULL;
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1340,11 +1361,11 @@ cr_statement_new_at_import_rule (CRStyleSheet * a_container_sheet,
         memset (result, 0, sizeof (CRStatement));
         result->type = AT_IMPORT_RULE_STMT;
 
-        result->kind.import_rule = g_try_malloc (sizeof (CRAtImportRule));
+        result->kind.import_rule = cr_arena_alloc_object (sizeof (CRAtImportRule));
 
         if (!result->kind.import_rule) {
                 cr_utils_trace_info ("Out of memory");
-                g_free (result);
+                cr_arena_free_object (result);
                 return NULL;
         }
 
@@ -1453,7 +1474,7 @@ cr_statement_new_at_page_rule (CRStyleSheet * a_sheet,
 {
         CRStatement *result = NULL;
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1463,11 +1484,11 @@ cr_statement_new_at_page_rule (CRStyleSheet * a_sheet,
         memset (result, 0, sizeof (CRStatement));
         result->type = AT_PAGE_RULE_STMT;
 
-        result->kind.page_rule = g_try_malloc (sizeof (CRAtPageRule));
+        result->kind.page_rule = cr_arena_alloc_object (sizeof (CRAtPageRule));
 
         if (!result->kind.page_rule) {
                 cr_utils_trace_info ("Out of memory");
-                g_free (result);
+                cr_arena_free_object (result);
                 return NULL;
         }
 
@@ -1578,7 +1599,7 @@ cr_statement_new_at_charset_rule (CRStyleSheet * a_sheet,
 
         g_return_val_if_fail (a_charset, NULL);
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1588,11 +1609,11 @@ cr_statement_new_at_charset_rule (CRStyleSheet * a_sheet,
         memset (result, 0, sizeof (CRStatement));
         result->type = AT_CHARSET_RULE_STMT;
 
-        result->kind.charset_rule = g_try_malloc (sizeof (CRAtCharsetRule));
+        result->kind.charset_rule = cr_arena_alloc_object (sizeof (CRAtCharsetRule));
 
         if (!result->kind.charset_rule) {
                 cr_utils_trace_info ("Out of memory");
-                g_free (result);
+                cr_arena_free_object (result);
                 return NULL;
         }
         memset (result->kind.charset_rule, 0, sizeof (CRAtCharsetRule));
@@ -1672,7 +1693,7 @@ cr_statement_new_at_font_face_rule (CRStyleSheet * a_sheet,
 {
         CRStatement *result = NULL;
 
-        result = g_try_malloc (sizeof (CRStatement));
+        result = cr_arena_alloc_object (sizeof (CRStatement));
 
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
@@ -1681,12 +1702,12 @@ cr_statement_new_at_font_face_rule (CRStyleSheet * a_sheet,
         memset (result, 0, sizeof (CRStatement));
         result->type = AT_FONT_FACE_RULE_STMT;
 
-        result->kind.font_face_rule = g_try_malloc
+        result->kind.font_face_rule = cr_arena_alloc_object
                 (sizeof (CRAtFontFaceRule));
 
         if (!result->kind.font_face_rule) {
                 cr_utils_trace_info ("Out of memory");
-                g_free (result);
+                cr_arena_free_object (result);
                 return NULL;
         }
         memset (result->kind.font_face_rule, 0, sizeof (CRAtFontFaceRule));
@@ -2771,14 +2792,14 @@ cr_statement_destroy (CRStatement * a_this)
                 cr_statement_clear (cur);
 
         if (cur->prev == NULL) {
-                g_free (a_this);
+                cr_arena_free_object (a_this);
                 return;
         }
 
         /*walk backward and free next element */
         for (cur = cur->prev; cur && cur->prev; cur = cur->prev) {
                 if (cur->next) {
-                        g_free (cur->next);
+                        cr_arena_free_object (cur->next);
                         cur->next = NULL;
                 }
         }
@@ -2788,10 +2809,10 @@ cr_statement_destroy (CRStatement * a_this)
 
         /*free the one remaining list */
         if (cur->next) {
-                g_free (cur->next);
+                cr_arena_free_object (cur->next);
                 cur->next = NULL;
         }
 
-        g_free (cur);
+        cr_arena_free_object (cur);
         cur = NULL;
 }
@@ -23,6 +23,23 @@
 
 #include <string.h>
 #include "cr-string.h"
+#include "cr-arena.h"
+
+/*
+ *The GString of a string allocated from an arena
+ *is released with the arena, unless the string got
+ *destroyed before.
+ */
+static void
+cr_string_free_stryng (gpointer a_this)
+{
+	CRString *str = a_this ;
+
+	if (str->stryng) {
+		g_string_free (str->stryng, TRUE) ;
+		str->stryng = NULL ;
+	}
+}
 
 /**
  *Instanciates a #CRString
@@ -34,13 +51,16 @@ cr_string_new (void)
 {
 	CRString *result = NULL ;
 
-	result = g_try_malloc (sizeof (CRString)) ;
+	result = cr_arena_alloc_object (sizeof (CRString)) ;
 	if (!result) {
 		cr_utils_trace_info ("Out of memory") ;
 		return NULL ;
 	}
 	memset (result, 0, sizeof (CRString)) ;
         result->stryng = g_string_new (NULL) ;
+        if (cr_arena_object_get_arena (result))
+                cr_arena_add_cleanup (cr_arena_object_get_arena (result),
+                                      cr_string_free_stryng, result) ;
 	return result ;
 }
 
@@ -164,5 +184,5 @@ cr_string_destroy (CRString *a_this)
 		g_string_free (a_this->stryng, TRUE) ;
 		a_this->stryng = NULL ;
 	}
-	g_free (a_this) ;
+	cr_arena_free_object (a_this) ;
 }
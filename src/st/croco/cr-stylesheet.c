@@ -22,6 +22,7 @@
 
 #include "string.h"
 #include "cr-stylesheet.h"
+#include "cr-arena.h"
 
 /**
  *@file
@@ -38,7 +39,7 @@ cr_stylesheet_new (CRStatement * a_stmts)
 {
         CRStyleSheet *result;
 
-        result = g_try_malloc (sizeof (CRStyleSheet));
+        result = cr_arena_alloc_object (sizeof (CRStyleSheet));
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
                 return NULL;
@@ -170,9 +171,16 @@ cr_stylesheet_destroy (CRStyleSheet * a_this)
 {
         g_return_if_fail (a_this);
 
+        /*
+         *A parsed style sheet owns the arena it and all
+         *its statements live in: free them all at once.
+         */
+        if (cr_arena_release_owned_object (a_this))
+                return;
+
         if (a_this->statements) {
                 cr_statement_destroy (a_this->statements);
                 a_this->statements = NULL;
         }
-        g_free (a_this);
+        cr_arena_free_object (a_this);
 }
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "cr-term.h"
+#include "cr-arena.h"
 #include "cr-num.h"
 #include "cr-parser.h"
 
@@ -86,7 +87,7 @@ cr_term_new (void)
 {
         CRTerm *result = NULL;
 
-        result = g_try_malloc (sizeof (CRTerm));
+        result = cr_arena_alloc_object (sizeof (CRTerm));
         if (!result) {
                 cr_utils_trace_info ("Out of memory");
                 return NULL;
@@ -784,7 +785,7 @@ cr_term_destroy (CRTerm * a_this)
         }
 
         if (a_this) {
-                g_free (a_this);
+                cr_arena_free_object (a_this);
         }
 
 }
@@ -245,6 +245,57 @@ static enum CRStatus cr_tknzr_parse_num (CRTknzr * a_this,
  *PRIVATE methods
  **********************************/
 
+/**
+ *Consumes a run of ascii bytes of class a_class in one go.
+ *This is the fast path of the hot productions (white spaces,
+ *comments, names and numbers): their ascii part is scanned
+ *without decoding it char by char. The slow path picks
+ *up whatever stopped the run (escapes, non ascii chars...).
+ *@param a_this the current instance of #CRTknzr.
+ *@param a_class the class of the bytes to consume.
+ *@param a_run out parameter. If not NULL, the start of
+ *the run in the input buffer.
+ *@return the number of bytes consumed.
+ */
+static gulong
+cr_tknzr_consume_ascii_run (CRTknzr * a_this,
+                            enum CRAsciiClass a_class,
+                            guchar ** a_run)
+{
+        g_return_val_if_fail (a_this && PRIVATE (a_this)
+                              && PRIVATE (a_this)->input, 0);
+
+        if (PRIVATE (a_this)->token_cache) {
+                cr_input_set_cur_pos (PRIVATE (a_this)->input,
+                                      &PRIVATE (a_this)->prev_pos);
+                cr_token_destroy (PRIVATE (a_this)->token_cache);
+                PRIVATE (a_this)->token_cache = NULL;
+        }
+
+        return cr_input_consume_ascii_run (PRIVATE (a_this)->input,
+                                           a_class, a_run);
+}
+
+/**
+ *Appends to a_string the run of ascii bytes of class a_class
+ *found at the current position, consuming it.
+ *@return the number of bytes appended.
+ */
+static gulong
+cr_tknzr_append_ascii_run (CRTknzr * a_this,
+                           enum CRAsciiClass a_class,
+                           GString * a_string)
+{
+        guchar *run = NULL;
+        gulong len = 0;
+
+        len = cr_tknzr_consume_ascii_run (a_this, a_class, &run);
+        if (len)
+                g_string_append_len (a_string, (const gchar *) run, len);
+
+        return len;
+}
+
 /**
  *Parses a "w" as defined by the css spec at [4.1.1]:
  * w ::= [ \t\r\n\f]*
@@ -290,26 +341,10 @@ cr_tknzr_parse_w (CRTknzr * a_this,
         RECORD_CUR_BYTE_ADDR (a_this, a_start);
         *a_end = *a_start;
 
-        for (;;) {
-                gboolean is_eof = FALSE;
-
-                cr_input_get_end_of_file (PRIVATE (a_this)->input, &is_eof);
-                if (is_eof)
-                        break;
-
-                status = cr_tknzr_peek_char (a_this, &cur_char);
-                if (status == CR_END_OF_INPUT_ERROR) {
-                        break;
-                } else if (status != CR_OK) {
-                        goto error;
-                }
-
-                if (cr_utils_is_white_space (cur_char) == TRUE) {
-                        READ_NEXT_CHAR (a_this, &cur_char);
-                        RECORD_CUR_BYTE_ADDR (a_this, a_end);
-                } else {
-                        break;
-                }
+        /*white spaces are all ascii*/
+        if (cr_tknzr_consume_ascii_run (a_this, CR_ASCII_WHITE_SPACE,
+                                        NULL) > 0) {
+                RECORD_CUR_BYTE_ADDR (a_this, a_end);
         }
 
         return CR_OK;
@@ -407,10 +442,9 @@ cr_tknzr_try_to_skip_spaces (CRTknzr * a_this)
         }
 
         if (cr_utils_is_white_space (cur_char) == TRUE) {
-                gulong nb_chars = -1; /*consume all spaces */
-
-                status = cr_input_consume_white_spaces
-                        (PRIVATE (a_this)->input, &nb_chars);
+                /*consume all spaces */
+                cr_tknzr_consume_ascii_run (a_this, CR_ASCII_WHITE_SPACE,
+                                            NULL);
         }
 
         return status;
@@ -448,6 +482,8 @@ cr_tknzr_parse_comment (CRTknzr * a_this,
         ENSURE_PARSING_COND (cur_char == '*');
         comment = cr_string_new ();
         for (;;) { /* [^*]* */
+                cr_tknzr_append_ascii_run (a_this, CR_ASCII_COMMENT_TEXT,
+                                           comment->stryng);
                 PEEK_NEXT_CHAR (a_this, &next_char);
                 if (next_char == '*')
                         break;
@@ -470,6 +506,9 @@ cr_tknzr_parse_comment (CRTknzr * a_this,
                 READ_NEXT_CHAR(a_this, &cur_char);
                 g_string_append_unichar (comment->stryng, cur_char);
                 for (;;) { /* [^*]* */
+                        cr_tknzr_append_ascii_run
+                                (a_this, CR_ASCII_COMMENT_TEXT,
+                                 comment->stryng);
                         PEEK_NEXT_CHAR (a_this, &next_char);
                         if (next_char == '*')
                                 break;
@@ -964,6 +1003,8 @@ cr_tknzr_parse_ident (CRTknzr * a_this, CRString ** a_str)
         }
         g_string_append_unichar (stringue->stryng, tmp_char);
         for (;;) {
+                cr_tknzr_append_ascii_run (a_this, CR_ASCII_NMCHAR,
+                                           stringue->stryng);
                 status = cr_tknzr_parse_nmchar (a_this, 
                                                 &tmp_char, 
                                                 NULL);
@@ -1042,6 +1083,8 @@ cr_tknzr_parse_name (CRTknzr * a_this,
                                  &loc) ;
                         is_first_nmchar = FALSE ;
                 } else {
+                        cr_tknzr_append_ascii_run
+                                (a_this, CR_ASCII_NMCHAR, (*a_str)->stryng);
                         status = cr_tknzr_parse_nmchar 
                                 (a_this, &tmp_char, NULL) ;
                 }
@@ -1543,12 +1586,20 @@ cr_tknzr_parse_num (CRTknzr * a_this,
                         parsed = FALSE;  /* In CSS, there must be at least
                                             one digit after `.'. */
                 } else if (IS_NUM (next_char)) {
-                        READ_NEXT_CHAR (a_this, &cur_char);
+                        guchar *digits = NULL;
+                        gulong nb_digits = 0,
+                                i = 0;
+
+                        nb_digits = cr_tknzr_consume_ascii_run
+                                (a_this, CR_ASCII_DIGIT, &digits);
                         parsed = TRUE;
 
-                        numerator = numerator * 10 + (cur_char - '0');
-                        if (parsing_dec) {
-                                denominator *= 10;
+                        for (i = 0; i < nb_digits; i++) {
+                                numerator = numerator * 10
+                                        + (digits[i] - '0');
+                                if (parsing_dec) {
+                                        denominator *= 10;
+                                }
                         }
                 } else {
                         break;
@@ -83,6 +83,60 @@ st_cogl_texture_new_from_data_wrapper                (int  width,
     return texture;
 }
 
+/**
+ * st_cogl_atlas_texture_new_from_data_wrapper: (skip)
+ *
+ * Creates a texture for a small image, like an icon, in one of the
+ * atlas textures Cogl shares between them, so that a menu full of
+ * icons is drawn from a few GL textures and the draws can be batched.
+ * Cogl gives the space back when the texture is freed and repacks the
+ * atlas when it needs to grow. Images bigger than ST_COGL_ATLAS_MAX_SIZE,
+ * or that don't fit, get a texture of their own.
+ */
+
+CoglTexture *
+st_cogl_atlas_texture_new_from_data_wrapper          (int  width,
+                                                      int  height,
+                                          CoglPixelFormat  format,
+                                                      int  rowstride,
+                                            const uint8_t *data)
+{
+    CoglTexture *texture = NULL;
+
+    /* Without NPOT support cogl_texture_new_from_data() already
+     * uses the atlas when it can */
+    if (width <= ST_COGL_ATLAS_MAX_SIZE && height <= ST_COGL_ATLAS_MAX_SIZE &&
+        hardware_supports_npot_sizes ())
+      {
+        CoglError *error = NULL;
+
+        texture = COGL_TEXTURE (cogl_atlas_texture_new_from_data (cogl_context, width, height,
+                                                                  format,
+#if COGL_VERSION < COGL_VERSION_ENCODE (1, 18, 0)
+                                                                  COGL_PIXEL_FORMAT_ANY,
+#endif
+                                                                  rowstride,
+                                                                  data,
+                                                                  &error));
+
+        if (error)
+          {
+            g_debug ("(st) cogl_atlas_texture_new_from_data failed: %s\n", error->message);
+            cogl_error_free (error);
+          }
+      }
+
+    if (texture == NULL)
+      texture = st_cogl_texture_new_from_data_wrapper (width, height,
+                                                       COGL_TEXTURE_NONE,
+                                                       format,
+                                                       COGL_PIXEL_FORMAT_ANY,
+                                                       rowstride,
+                                                       data);
+
+    return texture;
+}
+
 /**
  * st_cogl_texture_new_from_file_wrapper: (skip)
  *
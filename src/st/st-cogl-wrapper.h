@@ -22,6 +22,15 @@ CoglTexture * st_cogl_texture_new_from_data_wrapper                (int  width,
                                                                     int  rowstride,
                                                           const uint8_t *data);
 
+/* Textures up to this size on both sides are put into an atlas */
+#define ST_COGL_ATLAS_MAX_SIZE 128
+
+CoglTexture * st_cogl_atlas_texture_new_from_data_wrapper          (int  width,
+                                                                    int  height,
+                                                        CoglPixelFormat  format,
+                                                                    int  rowstride,
+                                                          const uint8_t *data);
+
 CoglTexture * st_cogl_texture_new_from_file_wrapper         (const char *filename,
                                                        CoglTextureFlags  flags,
                                                         CoglPixelFormat  internal_format);
@@ -265,19 +265,131 @@ _st_create_texture_pipeline (CoglTexture *src_texture)
  * Shadows
  *****/
 
-static gdouble *
+/* From this standard deviation (a 16px blur radius) up, the Gaussian is
+ * approximated by three successive box blurs, whose cost doesn't depend
+ * on the radius. Below it the approximation is visibly off.
+ */
+#define BOX_BLUR_MIN_SIGMA 8.0
+
+/* Number of pixels the row helpers below process at once */
+#define BLUR_LANES 8
+
+/* The row helpers are written with GCC vector extensions, which the
+ * compiler turns into SSE2 or NEON code, and on x86 are also built
+ * for AVX2, picked at load time when the CPU supports it.
+ */
+#if (defined (__GNUC__) && __GNUC__ >= 9) || defined (__clang__)
+#define BLUR_USE_VECTORS
+typedef guint8  BlurBytes __attribute__ ((vector_size (BLUR_LANES)));
+typedef guint32 BlurWords __attribute__ ((vector_size (BLUR_LANES * 4)));
+#endif
+
+#if defined (BLUR_USE_VECTORS) && defined (__x86_64__) && defined (__GLIBC__) && \
+    defined (__has_attribute)
+#if __has_attribute (target_clones)
+#define BLUR_TARGETS __attribute__ ((target_clones ("avx2", "default")))
+#endif
+#endif
+
+#ifndef BLUR_TARGETS
+#define BLUR_TARGETS
+#endif
+
+/* acc[x] += src[x] * weight */
+static BLUR_TARGETS void
+blur_row_add (guint32      *acc,
+              const guchar *src,
+              guint32       weight,
+              gint          n)
+{
+  gint x = 0;
+
+#ifdef BLUR_USE_VECTORS
+  for (; x + BLUR_LANES <= n; x += BLUR_LANES)
+    {
+      BlurBytes bytes;
+      BlurWords words;
+
+      memcpy (&bytes, src + x, sizeof (bytes));
+      memcpy (&words, acc + x, sizeof (words));
+      words += __builtin_convertvector (bytes, BlurWords) * weight;
+      memcpy (acc + x, &words, sizeof (words));
+    }
+#endif
+
+  for (; x < n; x++)
+    acc[x] += src[x] * weight;
+}
+
+/* acc[x] -= src[x] */
+static BLUR_TARGETS void
+blur_row_subtract (guint32      *acc,
+                   const guchar *src,
+                   gint          n)
+{
+  gint x = 0;
+
+#ifdef BLUR_USE_VECTORS
+  for (; x + BLUR_LANES <= n; x += BLUR_LANES)
+    {
+      BlurBytes bytes;
+      BlurWords words;
+
+      memcpy (&bytes, src + x, sizeof (bytes));
+      memcpy (&words, acc + x, sizeof (words));
+      words -= __builtin_convertvector (bytes, BlurWords);
+      memcpy (acc + x, &words, sizeof (words));
+    }
+#endif
+
+  for (; x < n; x++)
+    acc[x] -= src[x];
+}
+
+/* dst[x] = acc[x] * scale, where scale is a 16.16 fixed point factor
+ * small enough for the result to fit in a byte */
+static BLUR_TARGETS void
+blur_row_store (guchar        *dst,
+                const guint32 *acc,
+                guint32        scale,
+                gint           n)
+{
+  gint x = 0;
+
+#ifdef BLUR_USE_VECTORS
+  for (; x + BLUR_LANES <= n; x += BLUR_LANES)
+    {
+      BlurBytes bytes;
+      BlurWords words;
+
+      memcpy (&words, acc + x, sizeof (words));
+      words = (words * scale + 0x8000) >> 16;
+      bytes = __builtin_convertvector (words, BlurBytes);
+      memcpy (dst + x, &bytes, sizeof (bytes));
+    }
+#endif
+
+  for (; x < n; x++)
+    dst[x] = (acc[x] * scale + 0x8000) >> 16;
+}
+
+/* Returns the 16.16 fixed point weights of n_values of the Gaussian,
+ * adding up to exactly 1.0 */
+static guint32 *
 calculate_gaussian_kernel (float   sigma,
                            gint     n_values)
 {
-  gdouble *ret, sum;
+  gdouble *values, sum;
   gdouble exp_divisor;
+  guint32 *ret, total;
   gint half, i;
 
   g_return_val_if_fail (sigma > 0, NULL);
 
   half = n_values / 2;
 
-  ret = g_malloc (n_values * sizeof (gdouble));
+  values = g_malloc (n_values * sizeof (gdouble));
+  ret = g_malloc (n_values * sizeof (guint32));
   sum = 0.0;
 
   exp_divisor = 2 * sigma * sigma;
@@ -285,17 +397,249 @@ calculate_gaussian_kernel (float   sigma,
   /* n_values of 1D Gauss function */
   for (i = 0; i < n_values; i++)
     {
-      ret[i] = exp (-(i - half) * (i - half) / exp_divisor);
-      sum += ret[i];
+      values[i] = exp (-(i - half) * (i - half) / exp_divisor);
+      sum += values[i];
     }
 
-  /* normalize */
+  /* normalize, leaving the rounding error to the center */
+  total = 0;
   for (i = 0; i < n_values; i++)
-    ret[i] /= sum;
+    {
+      ret[i] = (guint32) (values[i] / sum * 65536. + 0.5);
+      total += ret[i];
+    }
+  ret[half] += 65536 - total;
+
+  g_free (values);
 
   return ret;
 }
 
+/* Blurs the width x height pixels of src, with zeroes beyond its edges,
+ * into dst. The vertical pass works a row at a time, adding each input
+ * row, weighted, into a row of accumulators, so that the whole image is
+ * read in memory order.
+ */
+static void
+gaussian_blur (guchar       *dst,
+               gint          dst_rowstride,
+               const guchar *src,
+               gint          src_rowstride,
+               gint          width_in,
+               gint          height_in,
+               gint          width_out,
+               gint          height_out,
+               float         sigma)
+{
+  guint32 *kernel, *acc;
+  guchar  *line;
+  gint     n_values, half;
+  gint     y_out, i;
+
+  n_values = (gint) 5 * sigma;
+  half = n_values / 2;
+
+  kernel = calculate_gaussian_kernel (sigma, n_values);
+  acc    = g_malloc (width_out * sizeof (guint32));
+  line   = g_malloc0 (width_out + n_values);
+
+  /* vertical blur, into columns [half, half + width_in) of dst */
+  for (y_out = 0; y_out < height_out; y_out++)
+    {
+      gint i0, i1;
+
+      /* We read from the source at 'y = y_out - 2 * half + i'; clamp
+       * the full i range [0, n_values) so that y is in [0, height_in).
+       */
+      i0 = MAX (2 * half - y_out, 0);
+      i1 = MIN (height_in + 2 * half - y_out, n_values);
+
+      memset (acc, 0, width_in * sizeof (guint32));
+      for (i = i0; i < i1; i++)
+        blur_row_add (acc, src + (y_out - 2 * half + i) * src_rowstride,
+                      kernel[i], width_in);
+
+      blur_row_store (dst + y_out * dst_rowstride + half, acc, 1, width_in);
+    }
+
+  /* horizontal blur; line holds the row at an offset of half, so that
+   * reading from 'x = x_out + i - half' never leaves it */
+  for (y_out = 0; y_out < height_out; y_out++)
+    {
+      guchar *row = dst + y_out * dst_rowstride;
+
+      memcpy (line + half, row, width_out);
+
+      memset (acc, 0, width_out * sizeof (guint32));
+      for (i = 0; i < n_values; i++)
+        blur_row_add (acc, line + i, kernel[i], width_out);
+
+      blur_row_store (row, acc, 1, width_out);
+    }
+
+  g_free (kernel);
+  g_free (acc);
+  g_free (line);
+}
+
+/* Box sizes and offsets for approximating a Gaussian, as in the
+ * feGaussianBlur section of the SVG specification: three centered
+ * boxes of an odd size d, or for an even d two boxes of size d shifted
+ * half a pixel in opposite directions and a centered one of size d + 1.
+ */
+static void
+get_box_blur_boxes (float  sigma,
+                    gint   sizes[3],
+                    gint   lefts[3])
+{
+  gint d = (gint) floor (sigma * 3 * sqrt (2 * G_PI) / 4 + 0.5);
+
+  if (d % 2 == 1)
+    {
+      sizes[0] = sizes[1] = sizes[2] = d;
+      lefts[0] = lefts[1] = lefts[2] = d / 2;
+    }
+  else
+    {
+      sizes[0] = sizes[1] = d;
+      lefts[0] = d / 2;
+      lefts[1] = d / 2 - 1;
+      sizes[2] = d + 1;
+      lefts[2] = d / 2;
+    }
+}
+
+/* One box blur of a row of n pixels, in place: each pixel becomes the
+ * average of the size pixels starting left pixels before it */
+static void
+box_blur_row (guchar  *row,
+              guchar  *line,
+              gint     n,
+              gint     size,
+              gint     left)
+{
+  guint32 scale = 65536 / size;
+  guint32 sum = 0;
+  gint x;
+
+  memcpy (line, row, n);
+
+  for (x = 0; x < size - left && x < n; x++)
+    sum += line[x];
+
+  for (x = 0; x < n; x++)
+    {
+      gint leaving = x - left;
+      gint entering = x - left + size;
+
+      row[x] = (sum * scale + 0x8000) >> 16;
+
+      if (leaving >= 0)
+        sum -= line[leaving];
+      if (entering < n)
+        sum += line[entering];
+    }
+}
+
+/* One box blur of the columns of src into dst, kept in memory order
+ * by keeping the running sums of a whole row of columns */
+static void
+box_blur_columns (guchar       *dst,
+                  const guchar *src,
+                  guint32      *acc,
+                  gint          width,
+                  gint          height,
+                  gint          rowstride,
+                  gint          size,
+                  gint          left)
+{
+  guint32 scale = 65536 / size;
+  gint y;
+
+  memset (acc, 0, width * sizeof (guint32));
+
+  for (y = 0; y < size - left && y < height; y++)
+    blur_row_add (acc, src + y * rowstride, 1, width);
+
+  for (y = 0; y < height; y++)
+    {
+      gint leaving = y - left;
+      gint entering = y - left + size;
+
+      blur_row_store (dst + y * rowstride, acc, scale, width);
+
+      if (leaving >= 0)
+        blur_row_subtract (acc, src + leaving * rowstride, width);
+      if (entering < height)
+        blur_row_add (acc, src + entering * rowstride, 1, width);
+    }
+}
+
+/* Blurs pixels, which has room around the image for the blur to spread
+ * into, in place with three box blurs in each direction. */
+static void
+box_blur (guchar  *pixels,
+          gint     width,
+          gint     height,
+          gint     rowstride,
+          float    sigma)
+{
+  guchar  *tmp, *line;
+  guint32 *acc;
+  gint     sizes[3], lefts[3];
+  gint     y, i;
+
+  get_box_blur_boxes (sigma, sizes, lefts);
+
+  line = g_malloc (width);
+  for (y = 0; y < height; y++)
+    for (i = 0; i < 3; i++)
+      box_blur_row (pixels + y * rowstride, line, width, sizes[i], lefts[i]);
+  g_free (line);
+
+  tmp = g_malloc (rowstride * height);
+  acc = g_malloc (width * sizeof (guint32));
+
+  box_blur_columns (tmp, pixels, acc, width, height, rowstride, sizes[0], lefts[0]);
+  box_blur_columns (pixels, tmp, acc, width, height, rowstride, sizes[1], lefts[1]);
+  box_blur_columns (tmp, pixels, acc, width, height, rowstride, sizes[2], lefts[2]);
+  memcpy (pixels, tmp, rowstride * height);
+
+  g_free (tmp);
+  g_free (acc);
+}
+
+/* How far a blurred image extends past each side of the original */
+static gint
+blur_margin (gdouble blur)
+{
+  /* See blur_pixels() for the relationship between blur and sigma */
+  float sigma = blur / 2.;
+
+  if ((guint) blur == 0)
+    return 0;
+
+  /* The three boxes reach about 2.8 sigma, further than the 2.5 sigma
+   * the Gaussian kernel is cut off at */
+  if (sigma >= BOX_BLUR_MIN_SIGMA)
+    {
+      gint sizes[3], lefts[3];
+      gint left = 0, right = 0;
+      gint i;
+
+      get_box_blur_boxes (sigma, sizes, lefts);
+      for (i = 0; i < 3; i++)
+        {
+          left += lefts[i];
+          right += sizes[i] - 1 - lefts[i];
+        }
+
+      return MAX (left, right);
+    }
+
+  return ((gint) (5 * sigma)) / 2;
+}
+
 static guchar *
 blur_pixels (guchar  *pixels_in,
              gint     width_in,
@@ -325,77 +669,32 @@ blur_pixels (guchar  *pixels_in,
     }
   else
     {
-      gdouble *kernel;
-      guchar  *line;
-      gint     n_values, half;
-      gint     x_in, y_in, x_out, y_out, i;
+      gint half;
+      gint y;
 
-      n_values = (gint) 5 * sigma;
-      half = n_values / 2;
+      half = blur_margin (blur);
 
       *width_out  = width_in  + 2 * half;
       *height_out = height_in + 2 * half;
       *rowstride_out = (*width_out + 3) & ~3;
 
       pixels_out = g_malloc0 (*rowstride_out * *height_out);
-      line       = g_malloc0 (*rowstride_out);
-
-      kernel = calculate_gaussian_kernel (sigma, n_values);
-
-      /* vertical blur */
-      for (x_in = 0; x_in < width_in; x_in++)
-        for (y_out = 0; y_out < *height_out; y_out++)
-          {
-            guchar *pixel_in, *pixel_out;
-            gint i0, i1;
-
-            y_in = y_out - half;
 
-            /* We read from the source at 'y = y_in + i - half'; clamp the
-             * full i range [0, n_values) so that y is in [0, height_in).
-             */
-            i0 = MAX (half - y_in, 0);
-            i1 = MIN (height_in + half - y_in, n_values);
-
-            pixel_in  =  pixels_in + (y_in + i0 - half) * rowstride_in + x_in;
-            pixel_out =  pixels_out + y_out * *rowstride_out + (x_in + half);
-
-            for (i = i0; i < i1; i++)
-              {
-                *pixel_out += *pixel_in * kernel[i];
-                pixel_in += rowstride_in;
-              }
-          }
+      if (sigma >= BOX_BLUR_MIN_SIGMA)
+        {
+          for (y = 0; y < height_in; y++)
+            memcpy (pixels_out + (y + half) * *rowstride_out + half,
+                    pixels_in + y * rowstride_in, width_in);
 
-      /* horizontal blur */
-      for (y_out = 0; y_out < *height_out; y_out++)
+          box_blur (pixels_out, *width_out, *height_out, *rowstride_out, sigma);
+        }
+      else
         {
-          memcpy (line, pixels_out + y_out * *rowstride_out, *rowstride_out);
-
-          for (x_out = 0; x_out < *width_out; x_out++)
-            {
-              gint i0, i1;
-              guchar *pixel_out, *pixel_in;
-
-              /* We read from the source at 'x = x_out + i - half'; clamp the
-               * full i range [0, n_values) so that x is in [0, width_out).
-               */
-              i0 = MAX (half - x_out, 0);
-              i1 = MIN (*width_out + half - x_out, n_values);
-
-              pixel_in  = line + x_out + i0 - half;
-              pixel_out = pixels_out + *rowstride_out * y_out + x_out;
-
-              *pixel_out = 0;
-              for (i = i0; i < i1; i++)
-                {
-                  *pixel_out += *pixel_in * kernel[i];
-                  pixel_in++;
-                }
-            }
+          gaussian_blur (pixels_out, *rowstride_out,
+                         pixels_in, rowstride_in,
+                         width_in, height_in,
+                         *width_out, *height_out, sigma);
         }
-      g_free (kernel);
-      g_free (line);
     }
 
   return pixels_out;
@@ -685,6 +984,23 @@ _st_create_shadow_cairo_pattern (StShadow        *shadow_spec,
   return dst_pattern;
 }
 
+static void
+set_shadow_pipeline_color (StShadow     *shadow_spec,
+                           CoglPipeline *shadow_pipeline,
+                           guint8        paint_opacity)
+{
+  CoglColor color;
+  guint8 adjusted;
+
+  adjusted = paint_opacity / 255;
+  cogl_color_init_from_4ub (&color,
+                            shadow_spec->color.red   * adjusted,
+                            shadow_spec->color.green * adjusted,
+                            shadow_spec->color.blue  * adjusted,
+                            shadow_spec->color.alpha * adjusted);
+  cogl_pipeline_set_layer_combine_constant (shadow_pipeline, 0, &color);
+}
+
 void
 _st_paint_shadow_with_opacity (StShadow        *shadow_spec,
                                CoglPipeline    *shadow_pipeline,
@@ -693,22 +1009,113 @@ _st_paint_shadow_with_opacity (StShadow        *shadow_spec,
                                guint8           paint_opacity)
 {
   ClutterActorBox shadow_box;
-  CoglColor color;
-  guint8 adjusted;
 
   g_return_if_fail (shadow_spec != NULL);
   g_return_if_fail (shadow_pipeline != NULL);
 
   st_shadow_get_box (shadow_spec, box, &shadow_box);
 
-  adjusted = paint_opacity / 255;
-  cogl_color_init_from_4ub (&color,
-                            shadow_spec->color.red   * adjusted,
-                            shadow_spec->color.green * adjusted,
-                            shadow_spec->color.blue  * adjusted,
-                            shadow_spec->color.alpha * adjusted);
-  cogl_pipeline_set_layer_combine_constant (shadow_pipeline, 0, &color);
+  set_shadow_pipeline_color (shadow_spec, shadow_pipeline, paint_opacity);
   cogl_framebuffer_draw_rectangle (fb, shadow_pipeline,
                                    shadow_box.x1, shadow_box.y1,
                                    shadow_box.x2, shadow_box.y2);
 }
+
+/**
+ * _st_shadow_get_blur_margin:
+ * @shadow_spec: a #StShadow
+ *
+ * Returns: how many pixels the texture of a shadow pipeline created by
+ *   _st_create_shadow_pipeline() extends past each side of its source
+ */
+int
+_st_shadow_get_blur_margin (StShadow *shadow_spec)
+{
+  return blur_margin (shadow_spec->blur);
+}
+
+/**
+ * _st_paint_sliced_shadow_with_opacity:
+ * @shadow_spec: a #StShadow
+ * @shadow_pipeline: a shadow pipeline created from a source smaller
+ *   than @box
+ * @slices: the number of texels on each side (indexed by #StSide) of
+ *   the shadow texture that are drawn as they are; the texel between
+ *   them is stretched to fill the rest
+ * @fb: a #CoglFramebuffer
+ * @box: the box the shadow is for
+ * @paint_opacity: the opacity to paint with
+ *
+ * Like _st_paint_shadow_with_opacity(), but draws the shadow texture
+ * as nine slices, so that a texture blurred from a source of the
+ * minimal size draws like the one that would be blurred from a
+ * source the size of @box.
+ */
+void
+_st_paint_sliced_shadow_with_opacity (StShadow        *shadow_spec,
+                                      CoglPipeline    *shadow_pipeline,
+                                      const float      slices[4],
+                                      CoglFramebuffer *fb,
+                                      ClutterActorBox *box,
+                                      guint8           paint_opacity)
+{
+  ClutterActorBox shadow_box;
+  CoglTexture *texture;
+  float texture_width, texture_height;
+  float scale_x, scale_y, margin;
+  float x[4], y[4], tx[4], ty[4];
+  float rectangles[9 * 8];
+  int i, j, n;
+
+  g_return_if_fail (shadow_spec != NULL);
+  g_return_if_fail (shadow_pipeline != NULL);
+
+  texture = cogl_pipeline_get_layer_texture (shadow_pipeline, 0);
+  texture_width = cogl_texture_get_width (texture);
+  texture_height = cogl_texture_get_height (texture);
+
+  st_shadow_get_box (shadow_spec, box, &shadow_box);
+
+  /* The slices are scaled like the texture blurred for the whole of
+   * the box would be when drawn into the shadow box */
+  margin = _st_shadow_get_blur_margin (shadow_spec);
+  scale_x = (shadow_box.x2 - shadow_box.x1) / (box->x2 - box->x1 + 2 * margin);
+  scale_y = (shadow_box.y2 - shadow_box.y1) / (box->y2 - box->y1 + 2 * margin);
+
+  x[0] = shadow_box.x1;
+  x[1] = shadow_box.x1 + slices[ST_SIDE_LEFT] * scale_x;
+  x[2] = shadow_box.x2 - slices[ST_SIDE_RIGHT] * scale_x;
+  x[3] = shadow_box.x2;
+
+  y[0] = shadow_box.y1;
+  y[1] = shadow_box.y1 + slices[ST_SIDE_TOP] * scale_y;
+  y[2] = shadow_box.y2 - slices[ST_SIDE_BOTTOM] * scale_y;
+  y[3] = shadow_box.y2;
+
+  tx[0] = 0.0;
+  tx[1] = slices[ST_SIDE_LEFT] / texture_width;
+  tx[2] = 1.0 - slices[ST_SIDE_RIGHT] / texture_width;
+  tx[3] = 1.0;
+
+  ty[0] = 0.0;
+  ty[1] = slices[ST_SIDE_TOP] / texture_height;
+  ty[2] = 1.0 - slices[ST_SIDE_BOTTOM] / texture_height;
+  ty[3] = 1.0;
+
+  n = 0;
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+        rectangles[n++] = x[j];
+        rectangles[n++] = y[i];
+        rectangles[n++] = x[j + 1];
+        rectangles[n++] = y[i + 1];
+        rectangles[n++] = tx[j];
+        rectangles[n++] = ty[i];
+        rectangles[n++] = tx[j + 1];
+        rectangles[n++] = ty[i + 1];
+      }
+
+  set_shadow_pipeline_color (shadow_spec, shadow_pipeline, paint_opacity);
+  cogl_framebuffer_draw_textured_rectangles (fb, shadow_pipeline, rectangles, 9);
+}
@@ -80,4 +80,12 @@ void _st_paint_shadow_with_opacity (StShadow        *shadow_spec,
                                     ClutterActorBox *box,
                                     guint8           paint_opacity);
 
+int  _st_shadow_get_blur_margin           (StShadow        *shadow_spec);
+void _st_paint_sliced_shadow_with_opacity (StShadow        *shadow_spec,
+                                           CoglPipeline    *shadow_pipeline,
+                                           const float      slices[4],
+                                           CoglFramebuffer *fb,
+                                           ClutterActorBox *box,
+                                           guint8           paint_opacity);
+
 #endif /* __ST_PRIVATE_H__ */
@@ -0,0 +1,547 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-raster-cache.c: on-disk cache of rasterized images
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Rendering SVG icons and theme assets is the most expensive part of
+ * loading them, and every session renders the same ones again at the same
+ * sizes. To avoid it, StTextureCache writes each rasterized SVG to a file
+ * in the user's cache directory, as premultiplied RGBA pixels ready to be
+ * uploaded to Cogl. The file is named after the cache key of the texture,
+ * which includes the size, scale and colors it was rendered for, and
+ * records the path, modification time (down to the nanosecond) and size
+ * of the source file. While these still match, the pixels are uploaded
+ * straight from the mapped file, with no decoding and no GdkPixbuf in
+ * between.
+ *
+ * As with stylesheets, a file rewritten within the same tick of a coarse
+ * filesystem clock as it was rendered would keep its modification time,
+ * so files modified in the last couple of seconds are not cached.
+ *
+ * Icon theme changes need no special handling: the source of an icon is
+ * the file GtkIconTheme resolved it to, so an icon that resolves to
+ * another file, or to a file that was updated, misses the cache and is
+ * rendered and written again.
+ *
+ * Nothing else removes cache files, so the first store of a session also
+ * prunes the directory from a worker thread: files unused for a month
+ * go, then the least recently used ones until the rest fits in
+ * MAX_CACHE_BYTES. A file counts as used when it was last read or
+ * written; reads are told by the access time, which relatime still
+ * updates once a day.
+ *
+ * Only SVGs are worth it; other formats decode about as fast as the cache
+ * file could be read. Cache files are only read back on the machine that
+ * wrote them, so values are stored in native byte order. CACHE_VERSION
+ * must be bumped whenever the format changes.
+ */
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "st-raster-cache.h"
+#include "st-cogl-wrapper.h"
+
+#define CACHE_MAGIC   "StRaster"
+#define CACHE_VERSION 2
+
+/* Files modified more recently than this, in seconds, aren't cached */
+#define MIN_SOURCE_AGE 2
+
+/* Pixel data starts at a multiple of this in the file */
+#define PIXEL_ALIGNMENT 16
+#define PIXEL_OFFSET(pos) (((pos) + PIXEL_ALIGNMENT - 1) & ~(gsize) (PIXEL_ALIGNMENT - 1))
+
+/* Bigger rasters, like backgrounds, aren't worth the disk space */
+#define MAX_RASTER_BYTES (4 * 1024 * 1024)
+
+/* Limits kept by pruning the cache directory */
+#define MAX_CACHE_AGE   (30 * 24 * 60 * 60)
+#define MAX_CACHE_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+  const guint8 *data;
+  gsize         len;
+  gsize         pos;
+} CacheReader;
+
+typedef struct {
+  char   *path;
+  gint64  last_used;
+  gint64  size;
+} CacheFile;
+
+typedef struct {
+  char      *path;
+  char      *key;
+  char      *source;
+  GStatBuf   stat_buf;
+  GdkPixbuf *pixbuf;
+} CacheWriteData;
+
+static char *
+get_cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "cinnamon", "rasters", NULL);
+}
+
+static char *
+get_cache_path (const char *key)
+{
+  char *checksum;
+  char *dirname;
+  char *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  dirname = get_cache_dir ();
+  path = g_build_filename (dirname, checksum, NULL);
+  g_free (dirname);
+  g_free (checksum);
+
+  return path;
+}
+
+/* Writing */
+
+static void
+write_uint (GByteArray *out,
+            guint32     value)
+{
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_int64 (GByteArray *out,
+             gint64      value)
+{
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_chars (GByteArray *out,
+             const char *str)
+{
+  gsize len = strlen (str);
+
+  write_uint (out, len);
+  g_byte_array_append (out, (const guint8 *) str, len);
+}
+
+static void
+write_pixels (GByteArray *out,
+              GdkPixbuf  *pixbuf)
+{
+  const guint8 *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  int n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gboolean has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  guint pos;
+  guint8 *dest;
+  int x, y;
+
+  pos = out->len;
+  g_byte_array_set_size (out, pos + width * height * 4);
+  dest = out->data + pos;
+
+  for (y = 0; y < height; y++)
+    {
+      const guint8 *src = pixels + y * rowstride;
+
+      for (x = 0; x < width; x++)
+        {
+          guint alpha = has_alpha ? src[3] : 0xff;
+
+          dest[0] = (src[0] * alpha + 127) / 255;
+          dest[1] = (src[1] * alpha + 127) / 255;
+          dest[2] = (src[2] * alpha + 127) / 255;
+          dest[3] = alpha;
+
+          src += n_channels;
+          dest += 4;
+        }
+    }
+}
+
+static GBytes *
+write_cache_contents (CacheWriteData *write_data)
+{
+  GdkPixbuf *pixbuf = write_data->pixbuf;
+  GByteArray *out;
+  int width, height;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  out = g_byte_array_new ();
+  g_byte_array_append (out, (const guint8 *) CACHE_MAGIC, sizeof (CACHE_MAGIC) - 1);
+  write_uint (out, CACHE_VERSION);
+  write_int64 (out, write_data->stat_buf.st_mtime);
+  write_int64 (out, write_data->stat_buf.st_mtim.tv_nsec);
+  write_int64 (out, write_data->stat_buf.st_size);
+  write_chars (out, write_data->key);
+  write_chars (out, write_data->source);
+  write_uint (out, width);
+  write_uint (out, height);
+
+  g_byte_array_set_size (out, PIXEL_OFFSET (out->len));
+  write_pixels (out, pixbuf);
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+/* Reading */
+
+static gboolean
+read_raw (CacheReader *reader,
+          gpointer     dest,
+          gsize        size)
+{
+  if (reader->len - reader->pos < size)
+    return FALSE;
+
+  memcpy (dest, reader->data + reader->pos, size);
+  reader->pos += size;
+
+  return TRUE;
+}
+
+static gboolean
+read_uint (CacheReader *reader,
+           guint32     *value)
+{
+  return read_raw (reader, value, sizeof (*value));
+}
+
+static gboolean
+read_int64 (CacheReader *reader,
+            gint64      *value)
+{
+  return read_raw (reader, value, sizeof (*value));
+}
+
+/* Checks that the next string in the file is @str */
+static gboolean
+read_matching_chars (CacheReader *reader,
+                     const char  *str)
+{
+  guint32 len;
+
+  if (!read_uint (reader, &len) ||
+      len != strlen (str) ||
+      reader->len - reader->pos < len ||
+      memcmp (reader->data + reader->pos, str, len) != 0)
+    return FALSE;
+
+  reader->pos += len;
+
+  return TRUE;
+}
+
+static gboolean
+read_header (CacheReader    *reader,
+             const char     *key,
+             const char     *source,
+             const GStatBuf *stat_buf)
+{
+  char magic[sizeof (CACHE_MAGIC) - 1];
+  guint32 version;
+  gint64 mtime, mtime_nsec, size;
+
+  if (!read_raw (reader, magic, sizeof (magic)) ||
+      memcmp (magic, CACHE_MAGIC, sizeof (magic)) != 0)
+    return FALSE;
+
+  if (!read_uint (reader, &version) || version != CACHE_VERSION)
+    return FALSE;
+
+  if (!read_int64 (reader, &mtime) || mtime != (gint64) stat_buf->st_mtime ||
+      !read_int64 (reader, &mtime_nsec) || mtime_nsec != (gint64) stat_buf->st_mtim.tv_nsec ||
+      !read_int64 (reader, &size) || size != (gint64) stat_buf->st_size)
+    return FALSE;
+
+  /* The key guards against checksum collisions; the source against
+   * the key resolving to another file than when it was written */
+  return read_matching_chars (reader, key) &&
+         read_matching_chars (reader, source);
+}
+
+/**
+ * _st_raster_cache_stat:
+ * @source: the path of an image file
+ * @stat_buf: (out): the result of stat()ing @source
+ *
+ * Checks whether rasters of @source are worth caching, and if so gets
+ * what their cache files are validated against. This should be called
+ * before @source is rendered, so that a change to the file while it is
+ * being rendered doesn't go unnoticed.
+ *
+ * Return value: %TRUE if @source can be looked up in and stored to the
+ *   cache with @stat_buf
+ */
+gboolean
+_st_raster_cache_stat (const char *source,
+                       GStatBuf   *stat_buf)
+{
+  if (!g_str_has_suffix (source, ".svg") &&
+      !g_str_has_suffix (source, ".svgz"))
+    return FALSE;
+
+  return g_stat (source, stat_buf) == 0;
+}
+
+/**
+ * _st_raster_cache_load:
+ * @key: the texture cache key of the raster
+ * @source: the path of the file the raster is rendered from
+ * @stat_buf: the result of _st_raster_cache_stat() on @source
+ *
+ * Uploads the raster of @key from the cache, if the cache file was
+ * written for the same modification time and size of @source.
+ *
+ * Return value: (transfer full): the cached raster, or %NULL if the
+ *   cache is missing, stale or unreadable
+ */
+CoglTexture *
+_st_raster_cache_load (const char     *key,
+                       const char     *source,
+                       const GStatBuf *stat_buf)
+{
+  CoglTexture *texture = NULL;
+  GMappedFile *mapped;
+  CacheReader reader;
+  guint32 width, height;
+  char *path;
+
+  path = get_cache_path (key);
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (mapped == NULL)
+    return NULL;
+
+  reader.data = (const guint8 *) g_mapped_file_get_contents (mapped);
+  reader.len = g_mapped_file_get_length (mapped);
+  reader.pos = 0;
+
+  if (read_header (&reader, key, source, stat_buf) &&
+      read_uint (&reader, &width) && width > 0 &&
+      read_uint (&reader, &height) && height > 0)
+    {
+      reader.pos = PIXEL_OFFSET (reader.pos);
+
+      if (reader.pos <= reader.len &&
+          reader.len - reader.pos == (gsize) width * height * 4)
+        texture = st_cogl_atlas_texture_new_from_data_wrapper (width, height,
+                                                               COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                                               width * 4,
+                                                               reader.data + reader.pos);
+    }
+
+  g_mapped_file_unref (mapped);
+
+  return texture;
+}
+
+static void
+cache_write_data_free (gpointer data)
+{
+  CacheWriteData *write_data = data;
+
+  g_free (write_data->path);
+  g_free (write_data->key);
+  g_free (write_data->source);
+  g_object_unref (write_data->pixbuf);
+  g_slice_free (CacheWriteData, write_data);
+}
+
+static void
+write_cache_file_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  CacheWriteData *write_data = task_data;
+  GBytes *contents;
+  char *dirname;
+
+  contents = write_cache_contents (write_data);
+  dirname = g_path_get_dirname (write_data->path);
+
+  /* The cache is only an optimization, so errors are ignored */
+  if (g_mkdir_with_parents (dirname, 0700) == 0)
+    g_file_set_contents (write_data->path,
+                         g_bytes_get_data (contents, NULL),
+                         g_bytes_get_size (contents),
+                         NULL);
+
+  g_free (dirname);
+  g_bytes_unref (contents);
+}
+
+/* Pruning */
+
+static void
+cache_file_free (gpointer data)
+{
+  CacheFile *file = data;
+
+  g_free (file->path);
+  g_slice_free (CacheFile, file);
+}
+
+static gint
+compare_cache_files (gconstpointer a,
+                     gconstpointer b)
+{
+  const CacheFile *file_a = *(const CacheFile **) a;
+  const CacheFile *file_b = *(const CacheFile **) b;
+
+  if (file_a->last_used != file_b->last_used)
+    return file_a->last_used < file_b->last_used ? -1 : 1;
+
+  return 0;
+}
+
+static void
+prune_cache_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  const char *dirname = task_data;
+  GPtrArray *files;
+  const char *name;
+  gint64 oldest, total = 0;
+  GDir *dir;
+  guint i;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  files = g_ptr_array_new_with_free_func (cache_file_free);
+  oldest = g_get_real_time () / G_USEC_PER_SEC - MAX_CACHE_AGE;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      CacheFile *file;
+      GStatBuf stat_buf;
+      char *path;
+
+      path = g_build_filename (dirname, name, NULL);
+      if (g_stat (path, &stat_buf) != 0 || !S_ISREG (stat_buf.st_mode))
+        {
+          g_free (path);
+          continue;
+        }
+
+      file = g_slice_new (CacheFile);
+      file->path = path;
+      file->last_used = MAX (stat_buf.st_atime, stat_buf.st_mtime);
+      file->size = stat_buf.st_size;
+
+      if (file->last_used < oldest)
+        {
+          g_unlink (file->path);
+          cache_file_free (file);
+          continue;
+        }
+
+      total += file->size;
+      g_ptr_array_add (files, file);
+    }
+
+  g_dir_close (dir);
+
+  g_ptr_array_sort (files, compare_cache_files);
+  for (i = 0; i < files->len && total > MAX_CACHE_BYTES; i++)
+    {
+      CacheFile *file = files->pdata[i];
+
+      if (g_unlink (file->path) == 0)
+        total -= file->size;
+    }
+
+  g_ptr_array_unref (files);
+}
+
+/* Prunes the cache directory from a worker thread, once per session */
+static void
+prune_cache (void)
+{
+  static gboolean pruned = FALSE;
+  GTask *task;
+
+  if (pruned)
+    return;
+
+  pruned = TRUE;
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, get_cache_dir (), g_free);
+  g_task_run_in_thread (task, prune_cache_thread);
+  g_object_unref (task);
+}
+
+/**
+ * _st_raster_cache_store:
+ * @key: the texture cache key of the raster
+ * @source: the path of the file @pixbuf was rendered from
+ * @stat_buf: the result of _st_raster_cache_stat() on @source before
+ *   it was rendered
+ * @pixbuf: the raster rendered from @source
+ *
+ * Premultiplies @pixbuf and writes it to the cache from a worker thread,
+ * so that the next _st_raster_cache_load() of @key for an unchanged
+ * @source can skip rendering. Sources modified in the last couple of
+ * seconds are left out. The first call also prunes old cache files.
+ */
+void
+_st_raster_cache_store (const char     *key,
+                        const char     *source,
+                        const GStatBuf *stat_buf,
+                        GdkPixbuf      *pixbuf)
+{
+  CacheWriteData *write_data;
+  GTask *task;
+
+  if (gdk_pixbuf_get_bits_per_sample (pixbuf) != 8 ||
+      gdk_pixbuf_get_n_channels (pixbuf) < 3 ||
+      (gsize) gdk_pixbuf_get_width (pixbuf) * gdk_pixbuf_get_height (pixbuf) * 4 > MAX_RASTER_BYTES)
+    return;
+
+  if ((gint64) stat_buf->st_mtime > g_get_real_time () / G_USEC_PER_SEC - MIN_SOURCE_AGE)
+    return;
+
+  prune_cache ();
+
+  /* Loaded pixbufs are never modified, so the worker can read
+   * the pixels while the caller keeps using it */
+  write_data = g_slice_new (CacheWriteData);
+  write_data->path = get_cache_path (key);
+  write_data->key = g_strdup (key);
+  write_data->source = g_strdup (source);
+  write_data->stat_buf = *stat_buf;
+  write_data->pixbuf = g_object_ref (pixbuf);
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, write_data, cache_write_data_free);
+  g_task_run_in_thread (task, write_cache_file_thread);
+  g_object_unref (task);
+}
@@ -0,0 +1,39 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-raster-cache.h: on-disk cache of rasterized images
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ST_RASTER_CACHE_H__
+#define __ST_RASTER_CACHE_H__
+
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+gboolean     _st_raster_cache_stat  (const char     *source,
+                                     GStatBuf       *stat_buf);
+CoglTexture *_st_raster_cache_load  (const char     *key,
+                                     const char     *source,
+                                     const GStatBuf *stat_buf);
+void         _st_raster_cache_store (const char     *key,
+                                     const char     *source,
+                                     const GStatBuf *stat_buf,
+                                     GdkPixbuf      *pixbuf);
+
+G_END_DECLS
+
+#endif /* __ST_RASTER_CACHE_H__ */
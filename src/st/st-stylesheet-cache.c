@@ -0,0 +1,1180 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-stylesheet-cache.c: on-disk cache of parsed stylesheets
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parsing the theme and the stylesheets of every applet and desklet is a
+ * noticeable part of startup, and is repeated on every theme change. To
+ * avoid it, each parsed stylesheet is written to a binary file in the
+ * user's cache directory, keyed by the path, modification time (down to
+ * the nanosecond) and size of the source file. While these still match,
+ * the stylesheet is rebuilt from the mapped cache file instead of being
+ * tokenized and parsed again; otherwise it is parsed as usual and the
+ * cache file is rewritten from a worker thread.
+ *
+ * On filesystems with coarse timestamps, a file rewritten within the same
+ * tick as it was parsed keeps its modification time, and would be served
+ * stale if it kept its size too. So stylesheets modified in the last
+ * couple of seconds are not cached; they will be on their next load.
+ *
+ * Stylesheets of removed xlets and themes would leave their cache files
+ * behind forever, so the first load or store of a session also prunes
+ * the directory from a worker thread: files unused for a month go, then
+ * the least recently used ones until the rest fits in MAX_CACHE_BYTES.
+ * A file counts as used when it was last read or written; reads are
+ * told by the access time, which relatime still updates once a day.
+ *
+ * Only what StTheme uses is stored: rulesets, @media blocks and @import
+ * rules. Stylesheets containing something we can't represent (attribute
+ * selectors) are not cached at all.
+ *
+ * Cache files are only read back on the machine that wrote them, so
+ * values are stored in native byte order. CACHE_VERSION must be bumped
+ * whenever the format changes.
+ */
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "st-stylesheet-cache.h"
+
+#define CACHE_MAGIC   "StCSSbin"
+#define CACHE_VERSION 2
+
+/* Files modified more recently than this, in seconds, aren't cached */
+#define MIN_SOURCE_AGE 2
+
+/* Limits kept by pruning the cache directory */
+#define MAX_CACHE_AGE   (30 * 24 * 60 * 60)
+#define MAX_CACHE_BYTES (16 * 1024 * 1024)
+
+/* Length marker for a NULL string */
+#define NO_STRING G_MAXUINT32
+
+typedef struct {
+  const guint8 *data;
+  gsize         len;
+  gsize         pos;
+} CacheReader;
+
+typedef struct {
+  char   *path;
+  GBytes *contents;
+} CacheWriteData;
+
+typedef struct {
+  char   *path;
+  gint64  last_used;
+  gint64  size;
+} CacheFile;
+
+static char *
+get_cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "cinnamon", "stylesheets", NULL);
+}
+
+static char *
+get_cache_path (const char *filename)
+{
+  char *checksum;
+  char *dirname;
+  char *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, filename, -1);
+  dirname = get_cache_dir ();
+  path = g_build_filename (dirname, checksum, NULL);
+  g_free (dirname);
+  g_free (checksum);
+
+  return path;
+}
+
+/* Writing */
+
+static void
+write_uint (GByteArray *out,
+            guint32     value)
+{
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_int64 (GByteArray *out,
+             gint64      value)
+{
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_double (GByteArray *out,
+              gdouble     value)
+{
+  g_byte_array_append (out, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_chars (GByteArray *out,
+             const char *str,
+             gsize       len)
+{
+  write_uint (out, len);
+  g_byte_array_append (out, (const guint8 *) str, len);
+}
+
+static void
+write_string (GByteArray     *out,
+              const CRString *str)
+{
+  if (str == NULL || str->stryng == NULL)
+    write_uint (out, NO_STRING);
+  else
+    write_chars (out, str->stryng->str, str->stryng->len);
+}
+
+static void
+write_media_list (GByteArray *out,
+                  GList      *media_list)
+{
+  GList *l;
+
+  write_uint (out, g_list_length (media_list));
+  for (l = media_list; l; l = l->next)
+    write_string (out, l->data);
+}
+
+static gboolean
+write_terms (GByteArray *out,
+             CRTerm     *terms)
+{
+  CRTerm *term;
+  guint n_terms = 0;
+
+  for (term = terms; term; term = term->next)
+    n_terms++;
+
+  write_uint (out, n_terms);
+
+  for (term = terms; term; term = term->next)
+    {
+      write_uint (out, term->type);
+      write_uint (out, term->unary_op);
+      write_uint (out, term->the_operator);
+
+      switch (term->type)
+        {
+        case TERM_NUMBER:
+          if (term->content.num == NULL)
+            return FALSE;
+          write_uint (out, term->content.num->type);
+          write_double (out, term->content.num->val);
+          break;
+
+        case TERM_FUNCTION:
+          write_string (out, term->content.str);
+          if (!write_terms (out, term->ext_content.func_param))
+            return FALSE;
+          break;
+
+        case TERM_STRING:
+        case TERM_IDENT:
+        case TERM_URI:
+        case TERM_HASH:
+          write_string (out, term->content.str);
+          break;
+
+        case TERM_RGB:
+          if (term->content.rgb == NULL)
+            return FALSE;
+          write_uint (out, term->content.rgb->red);
+          write_uint (out, term->content.rgb->green);
+          write_uint (out, term->content.rgb->blue);
+          write_uint (out, term->content.rgb->is_percentage);
+          break;
+
+        case TERM_UNICODERANGE:
+        case TERM_NO_TYPE:
+        default:
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_declarations (GByteArray    *out,
+                    CRDeclaration *decls)
+{
+  CRDeclaration *decl;
+  guint n_decls = 0;
+
+  for (decl = decls; decl; decl = decl->next)
+    n_decls++;
+
+  write_uint (out, n_decls);
+
+  for (decl = decls; decl; decl = decl->next)
+    {
+      if (decl->property == NULL)
+        return FALSE;
+
+      write_string (out, decl->property);
+      write_uint (out, decl->important);
+      if (!write_terms (out, decl->value))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_simple_sel (GByteArray  *out,
+                  CRSimpleSel *simple_sel)
+{
+  CRAdditionalSel *add_sel;
+  guint n_add_sels = 0;
+
+  write_uint (out, simple_sel->type_mask);
+  write_uint (out, simple_sel->is_case_sentive);
+  write_string (out, simple_sel->name);
+  write_uint (out, simple_sel->combinator);
+
+  for (add_sel = simple_sel->add_sel; add_sel; add_sel = add_sel->next)
+    n_add_sels++;
+
+  write_uint (out, n_add_sels);
+
+  for (add_sel = simple_sel->add_sel; add_sel; add_sel = add_sel->next)
+    {
+      write_uint (out, add_sel->type);
+
+      switch (add_sel->type)
+        {
+        case CLASS_ADD_SELECTOR:
+          write_string (out, add_sel->content.class_name);
+          break;
+
+        case ID_ADD_SELECTOR:
+          write_string (out, add_sel->content.id_name);
+          break;
+
+        case PSEUDO_CLASS_ADD_SELECTOR:
+          if (add_sel->content.pseudo == NULL)
+            return FALSE;
+          write_uint (out, add_sel->content.pseudo->type);
+          write_string (out, add_sel->content.pseudo->name);
+          write_string (out, add_sel->content.pseudo->extra);
+          break;
+
+        case NO_ADD_SELECTOR:
+          break;
+
+        case ATTRIBUTE_ADD_SELECTOR:
+        default:
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_selectors (GByteArray *out,
+                 CRSelector *selectors)
+{
+  CRSelector *selector;
+  guint n_selectors = 0;
+
+  for (selector = selectors; selector; selector = selector->next)
+    n_selectors++;
+
+  write_uint (out, n_selectors);
+
+  for (selector = selectors; selector; selector = selector->next)
+    {
+      CRSimpleSel *simple_sel;
+      guint n_simple_sels = 0;
+
+      for (simple_sel = selector->simple_sel; simple_sel; simple_sel = simple_sel->next)
+        n_simple_sels++;
+
+      write_uint (out, n_simple_sels);
+
+      for (simple_sel = selector->simple_sel; simple_sel; simple_sel = simple_sel->next)
+        {
+          if (!write_simple_sel (out, simple_sel))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+write_ruleset (GByteArray  *out,
+               CRStatement *stmt)
+{
+  if (stmt->kind.ruleset == NULL || stmt->kind.ruleset->sel_list == NULL)
+    return FALSE;
+
+  return write_selectors (out, stmt->kind.ruleset->sel_list) &&
+         write_declarations (out, stmt->kind.ruleset->decl_list);
+}
+
+static gboolean
+write_stylesheet (GByteArray   *out,
+                  CRStyleSheet *stylesheet)
+{
+  CRStatement *stmt;
+  guint n_statements = 0;
+
+  for (stmt = stylesheet->statements; stmt; stmt = stmt->next)
+    {
+      if (stmt->type == RULESET_STMT ||
+          stmt->type == AT_MEDIA_RULE_STMT ||
+          stmt->type == AT_IMPORT_RULE_STMT)
+        n_statements++;
+    }
+
+  write_uint (out, n_statements);
+
+  for (stmt = stylesheet->statements; stmt; stmt = stmt->next)
+    {
+      switch (stmt->type)
+        {
+        case RULESET_STMT:
+          write_uint (out, stmt->type);
+          if (!write_ruleset (out, stmt))
+            return FALSE;
+          break;
+
+        case AT_MEDIA_RULE_STMT:
+          {
+            CRStatement *ruleset;
+            guint n_rulesets = 0;
+
+            if (stmt->kind.media_rule == NULL)
+              return FALSE;
+
+            write_uint (out, stmt->type);
+            write_media_list (out, stmt->kind.media_rule->media_list);
+
+            for (ruleset = stmt->kind.media_rule->rulesets; ruleset; ruleset = ruleset->next)
+              n_rulesets++;
+
+            write_uint (out, n_rulesets);
+
+            for (ruleset = stmt->kind.media_rule->rulesets; ruleset; ruleset = ruleset->next)
+              {
+                if (ruleset->type != RULESET_STMT || !write_ruleset (out, ruleset))
+                  return FALSE;
+              }
+          }
+          break;
+
+        case AT_IMPORT_RULE_STMT:
+          if (stmt->kind.import_rule == NULL)
+            return FALSE;
+
+          write_uint (out, stmt->type);
+          write_string (out, stmt->kind.import_rule->url);
+          write_media_list (out, stmt->kind.import_rule->media_list);
+          break;
+
+        case AT_RULE_STMT:
+        case AT_PAGE_RULE_STMT:
+        case AT_CHARSET_RULE_STMT:
+        case AT_FONT_FACE_RULE_STMT:
+        default:
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+write_header (GByteArray     *out,
+              const char     *filename,
+              const GStatBuf *stat_buf)
+{
+  g_byte_array_append (out, (const guint8 *) CACHE_MAGIC, strlen (CACHE_MAGIC));
+  write_uint (out, CACHE_VERSION);
+  write_int64 (out, stat_buf->st_mtime);
+  write_int64 (out, stat_buf->st_mtim.tv_nsec);
+  write_int64 (out, stat_buf->st_size);
+  write_chars (out, filename, strlen (filename));
+}
+
+/* Reading */
+
+static gboolean
+read_raw (CacheReader *reader,
+          gpointer     dest,
+          gsize        size)
+{
+  if (reader->len - reader->pos < size)
+    return FALSE;
+
+  memcpy (dest, reader->data + reader->pos, size);
+  reader->pos += size;
+
+  return TRUE;
+}
+
+static gboolean
+read_uint (CacheReader *reader,
+           guint32     *value)
+{
+  return read_raw (reader, value, sizeof (*value));
+}
+
+static gboolean
+read_int64 (CacheReader *reader,
+            gint64      *value)
+{
+  return read_raw (reader, value, sizeof (*value));
+}
+
+static gboolean
+read_double (CacheReader *reader,
+             gdouble     *value)
+{
+  return read_raw (reader, value, sizeof (*value));
+}
+
+/* Sets @str to %NULL if a NULL string was stored */
+static gboolean
+read_string (CacheReader  *reader,
+             CRString    **str)
+{
+  guint32 len;
+
+  *str = NULL;
+
+  if (!read_uint (reader, &len))
+    return FALSE;
+
+  if (len == NO_STRING)
+    return TRUE;
+
+  if (reader->len - reader->pos < len)
+    return FALSE;
+
+  *str = cr_string_new ();
+  g_string_append_len ((*str)->stryng, (const char *) reader->data + reader->pos, len);
+  reader->pos += len;
+
+  return TRUE;
+}
+
+static void
+free_media_list (GList *media_list)
+{
+  g_list_free_full (media_list, (GDestroyNotify) cr_string_destroy);
+}
+
+static gboolean
+read_media_list (CacheReader  *reader,
+                 GList       **media_list)
+{
+  guint32 n_media, i;
+
+  *media_list = NULL;
+
+  if (!read_uint (reader, &n_media))
+    return FALSE;
+
+  for (i = 0; i < n_media; i++)
+    {
+      CRString *medium;
+
+      if (!read_string (reader, &medium) || medium == NULL)
+        {
+          free_media_list (*media_list);
+          *media_list = NULL;
+          return FALSE;
+        }
+
+      *media_list = g_list_append (*media_list, medium);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_terms (CacheReader  *reader,
+            CRTerm      **terms)
+{
+  guint32 n_terms, i;
+
+  *terms = NULL;
+
+  if (!read_uint (reader, &n_terms))
+    return FALSE;
+
+  for (i = 0; i < n_terms; i++)
+    {
+      CRTerm *term;
+      guint32 type, unary_op, the_operator;
+
+      /* Link the term in first, so that it gets freed along on errors */
+      term = cr_term_new ();
+      *terms = cr_term_append_term (*terms, term);
+
+      if (!read_uint (reader, &type) ||
+          !read_uint (reader, &unary_op) ||
+          !read_uint (reader, &the_operator))
+        goto error;
+
+      switch (type)
+        {
+        case TERM_NUMBER:
+          {
+            guint32 num_type;
+            gdouble val;
+
+            if (!read_uint (reader, &num_type) ||
+                !read_double (reader, &val) ||
+                num_type >= NB_NUM_TYPE)
+              goto error;
+
+            cr_term_set_number (term, cr_num_new_with_val (val, num_type));
+          }
+          break;
+
+        case TERM_FUNCTION:
+          {
+            CRString *name;
+            CRTerm *params;
+
+            if (!read_string (reader, &name))
+              goto error;
+
+            if (!read_terms (reader, &params))
+              {
+                if (name)
+                  cr_string_destroy (name);
+                goto error;
+              }
+
+            cr_term_set_function (term, name, params);
+          }
+          break;
+
+        case TERM_STRING:
+        case TERM_IDENT:
+        case TERM_URI:
+        case TERM_HASH:
+          {
+            CRString *str;
+
+            if (!read_string (reader, &str))
+              goto error;
+
+            if (type == TERM_STRING)
+              cr_term_set_string (term, str);
+            else if (type == TERM_IDENT)
+              cr_term_set_ident (term, str);
+            else if (type == TERM_URI)
+              cr_term_set_uri (term, str);
+            else
+              cr_term_set_hash (term, str);
+          }
+          break;
+
+        case TERM_RGB:
+          {
+            guint32 red, green, blue, is_percentage;
+            CRRgb *rgb;
+
+            if (!read_uint (reader, &red) ||
+                !read_uint (reader, &green) ||
+                !read_uint (reader, &blue) ||
+                !read_uint (reader, &is_percentage))
+              goto error;
+
+            rgb = cr_rgb_new ();
+            rgb->red = (gint32) red;
+            rgb->green = (gint32) green;
+            rgb->blue = (gint32) blue;
+            rgb->is_percentage = is_percentage;
+            cr_term_set_rgb (term, rgb);
+          }
+          break;
+
+        case TERM_UNICODERANGE:
+          term->type = TERM_UNICODERANGE;
+          break;
+
+        case TERM_NO_TYPE:
+          break;
+
+        default:
+          goto error;
+        }
+
+      term->unary_op = unary_op;
+      term->the_operator = the_operator;
+    }
+
+  return TRUE;
+
+ error:
+  cr_term_destroy (*terms);
+  *terms = NULL;
+  return FALSE;
+}
+
+static gboolean
+read_declarations (CacheReader *reader,
+                   CRStatement *stmt)
+{
+  guint32 n_decls, i;
+
+  if (!read_uint (reader, &n_decls))
+    return FALSE;
+
+  for (i = 0; i < n_decls; i++)
+    {
+      CRDeclaration *decl;
+      CRString *property;
+      guint32 important;
+      CRTerm *value;
+
+      if (!read_string (reader, &property) || property == NULL)
+        return FALSE;
+
+      if (!read_uint (reader, &important) ||
+          !read_terms (reader, &value))
+        {
+          cr_string_destroy (property);
+          return FALSE;
+        }
+
+      decl = cr_declaration_new (stmt, property, value);
+      decl->important = important;
+      stmt->kind.ruleset->decl_list = cr_declaration_append (stmt->kind.ruleset->decl_list, decl);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_simple_sel (CacheReader  *reader,
+                 CRSimpleSel **simple_sel_out)
+{
+  CRSimpleSel *simple_sel;
+  guint32 type_mask, is_case_sensitive, combinator, n_add_sels, i;
+
+  simple_sel = cr_simple_sel_new ();
+  *simple_sel_out = simple_sel;
+
+  if (!read_uint (reader, &type_mask) ||
+      !read_uint (reader, &is_case_sensitive) ||
+      !read_string (reader, &simple_sel->name) ||
+      !read_uint (reader, &combinator) ||
+      !read_uint (reader, &n_add_sels))
+    return FALSE;
+
+  simple_sel->type_mask = type_mask;
+  simple_sel->is_case_sentive = is_case_sensitive;
+  simple_sel->combinator = combinator;
+
+  for (i = 0; i < n_add_sels; i++)
+    {
+      CRAdditionalSel *add_sel;
+      guint32 type;
+      CRString *str;
+
+      if (!read_uint (reader, &type))
+        return FALSE;
+
+      add_sel = cr_additional_sel_new_with_type (type);
+      simple_sel->add_sel = cr_additional_sel_append (simple_sel->add_sel, add_sel);
+
+      switch (type)
+        {
+        case CLASS_ADD_SELECTOR:
+          if (!read_string (reader, &str))
+            return FALSE;
+          cr_additional_sel_set_class_name (add_sel, str);
+          break;
+
+        case ID_ADD_SELECTOR:
+          if (!read_string (reader, &str))
+            return FALSE;
+          cr_additional_sel_set_id_name (add_sel, str);
+          break;
+
+        case PSEUDO_CLASS_ADD_SELECTOR:
+          {
+            CRPseudo *pseudo;
+            guint32 pseudo_type;
+
+            if (!read_uint (reader, &pseudo_type))
+              return FALSE;
+
+            pseudo = cr_pseudo_new ();
+            pseudo->type = pseudo_type;
+            cr_additional_sel_set_pseudo (add_sel, pseudo);
+
+            if (!read_string (reader, &pseudo->name) ||
+                !read_string (reader, &pseudo->extra))
+              return FALSE;
+          }
+          break;
+
+        case NO_ADD_SELECTOR:
+          break;
+
+        default:
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_selectors (CacheReader  *reader,
+                CRSelector  **selectors)
+{
+  guint32 n_selectors, i;
+
+  *selectors = NULL;
+
+  if (!read_uint (reader, &n_selectors))
+    return FALSE;
+
+  for (i = 0; i < n_selectors; i++)
+    {
+      CRSelector *selector;
+      guint32 n_simple_sels, j;
+
+      selector = cr_selector_new (NULL);
+      *selectors = cr_selector_append (*selectors, selector);
+
+      if (!read_uint (reader, &n_simple_sels))
+        goto error;
+
+      for (j = 0; j < n_simple_sels; j++)
+        {
+          CRSimpleSel *simple_sel;
+          gboolean ok;
+
+          ok = read_simple_sel (reader, &simple_sel);
+          selector->simple_sel = cr_simple_sel_append_simple_sel (selector->simple_sel,
+                                                                  simple_sel);
+          if (!ok)
+            goto error;
+        }
+    }
+
+  return TRUE;
+
+ error:
+  if (*selectors)
+    cr_selector_destroy (*selectors);
+  *selectors = NULL;
+  return FALSE;
+}
+
+/* Adds the ruleset to @stylesheet, or to @media_stmt if set */
+static gboolean
+read_ruleset (CacheReader  *reader,
+              CRStyleSheet *stylesheet,
+              CRStatement  *media_stmt)
+{
+  CRSelector *selectors;
+  CRStatement *stmt;
+
+  if (!read_selectors (reader, &selectors))
+    return FALSE;
+
+  if (selectors == NULL)
+    return FALSE;
+
+  stmt = cr_statement_new_ruleset (stylesheet, selectors, NULL, media_stmt);
+  if (stmt == NULL)
+    {
+      cr_selector_destroy (selectors);
+      return FALSE;
+    }
+
+  if (media_stmt == NULL)
+    stylesheet->statements = cr_statement_append (stylesheet->statements, stmt);
+
+  return read_declarations (reader, stmt);
+}
+
+static CRStyleSheet *
+read_stylesheet (CacheReader *reader)
+{
+  CRStyleSheet *stylesheet;
+  guint32 n_statements, i;
+
+  stylesheet = cr_stylesheet_new (NULL);
+
+  if (!read_uint (reader, &n_statements))
+    goto error;
+
+  for (i = 0; i < n_statements; i++)
+    {
+      guint32 type;
+
+      if (!read_uint (reader, &type))
+        goto error;
+
+      switch (type)
+        {
+        case RULESET_STMT:
+          if (!read_ruleset (reader, stylesheet, NULL))
+            goto error;
+          break;
+
+        case AT_MEDIA_RULE_STMT:
+          {
+            CRStatement *stmt;
+            GList *media_list;
+            guint32 n_rulesets, j;
+
+            if (!read_media_list (reader, &media_list))
+              goto error;
+
+            stmt = cr_statement_new_at_media_rule (stylesheet, NULL, media_list);
+            stylesheet->statements = cr_statement_append (stylesheet->statements, stmt);
+
+            if (!read_uint (reader, &n_rulesets))
+              goto error;
+
+            for (j = 0; j < n_rulesets; j++)
+              {
+                if (!read_ruleset (reader, stylesheet, stmt))
+                  goto error;
+              }
+          }
+          break;
+
+        case AT_IMPORT_RULE_STMT:
+          {
+            CRStatement *stmt;
+            GList *media_list;
+            CRString *url;
+
+            if (!read_string (reader, &url) || url == NULL)
+              goto error;
+
+            if (!read_media_list (reader, &media_list))
+              {
+                cr_string_destroy (url);
+                goto error;
+              }
+
+            stmt = cr_statement_new_at_import_rule (stylesheet, url, media_list, NULL);
+            stylesheet->statements = cr_statement_append (stylesheet->statements, stmt);
+          }
+          break;
+
+        default:
+          goto error;
+        }
+    }
+
+  return stylesheet;
+
+ error:
+  cr_stylesheet_destroy (stylesheet);
+  return NULL;
+}
+
+static gboolean
+read_header (CacheReader    *reader,
+             const char     *filename,
+             const GStatBuf *stat_buf)
+{
+  char magic[sizeof (CACHE_MAGIC) - 1];
+  guint32 version, filename_len;
+  gint64 mtime, mtime_nsec, size;
+
+  if (!read_raw (reader, magic, sizeof (magic)) ||
+      memcmp (magic, CACHE_MAGIC, sizeof (magic)) != 0)
+    return FALSE;
+
+  if (!read_uint (reader, &version) || version != CACHE_VERSION)
+    return FALSE;
+
+  if (!read_int64 (reader, &mtime) || mtime != (gint64) stat_buf->st_mtime ||
+      !read_int64 (reader, &mtime_nsec) || mtime_nsec != (gint64) stat_buf->st_mtim.tv_nsec ||
+      !read_int64 (reader, &size) || size != (gint64) stat_buf->st_size)
+    return FALSE;
+
+  /* Guard against checksum collisions */
+  if (!read_uint (reader, &filename_len) ||
+      filename_len != strlen (filename) ||
+      reader->len - reader->pos < filename_len ||
+      memcmp (reader->data + reader->pos, filename, filename_len) != 0)
+    return FALSE;
+
+  reader->pos += filename_len;
+
+  return TRUE;
+}
+
+/* Pruning */
+
+static void
+cache_file_free (gpointer data)
+{
+  CacheFile *file = data;
+
+  g_free (file->path);
+  g_slice_free (CacheFile, file);
+}
+
+static gint
+compare_cache_files (gconstpointer a,
+                     gconstpointer b)
+{
+  const CacheFile *file_a = *(const CacheFile **) a;
+  const CacheFile *file_b = *(const CacheFile **) b;
+
+  if (file_a->last_used != file_b->last_used)
+    return file_a->last_used < file_b->last_used ? -1 : 1;
+
+  return 0;
+}
+
+static void
+prune_cache_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  const char *dirname = task_data;
+  GPtrArray *files;
+  const char *name;
+  gint64 oldest, total = 0;
+  GDir *dir;
+  guint i;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  files = g_ptr_array_new_with_free_func (cache_file_free);
+  oldest = g_get_real_time () / G_USEC_PER_SEC - MAX_CACHE_AGE;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      CacheFile *file;
+      GStatBuf stat_buf;
+      char *path;
+
+      path = g_build_filename (dirname, name, NULL);
+      if (g_stat (path, &stat_buf) != 0 || !S_ISREG (stat_buf.st_mode))
+        {
+          g_free (path);
+          continue;
+        }
+
+      file = g_slice_new (CacheFile);
+      file->path = path;
+      file->last_used = MAX (stat_buf.st_atime, stat_buf.st_mtime);
+      file->size = stat_buf.st_size;
+
+      if (file->last_used < oldest)
+        {
+          g_unlink (file->path);
+          cache_file_free (file);
+          continue;
+        }
+
+      total += file->size;
+      g_ptr_array_add (files, file);
+    }
+
+  g_dir_close (dir);
+
+  g_ptr_array_sort (files, compare_cache_files);
+  for (i = 0; i < files->len && total > MAX_CACHE_BYTES; i++)
+    {
+      CacheFile *file = files->pdata[i];
+
+      if (g_unlink (file->path) == 0)
+        total -= file->size;
+    }
+
+  g_ptr_array_unref (files);
+}
+
+/* Prunes the cache directory from a worker thread, once per session.
+ * Stylesheets are loaded from worker threads too, hence the GOnce. */
+static void
+prune_cache (void)
+{
+  static gsize pruned = 0;
+
+  if (g_once_init_enter (&pruned))
+    {
+      GTask *task;
+
+      task = g_task_new (NULL, NULL, NULL, NULL);
+      g_task_set_task_data (task, get_cache_dir (), g_free);
+      g_task_run_in_thread (task, prune_cache_thread);
+      g_object_unref (task);
+
+      g_once_init_leave (&pruned, 1);
+    }
+}
+
+/**
+ * _st_stylesheet_cache_load:
+ * @filename: the path of the stylesheet
+ * @stat_buf: the result of stat()ing @filename
+ *
+ * Rebuilds the stylesheet from the cache, if the cache file was written
+ * for the same modification time and size of @filename.
+ *
+ * Return value: (transfer full): the cached stylesheet, or %NULL if the
+ *   cache is missing, stale or unreadable
+ */
+CRStyleSheet *
+_st_stylesheet_cache_load (const char     *filename,
+                           const GStatBuf *stat_buf)
+{
+  CRStyleSheet *stylesheet = NULL;
+  GMappedFile *mapped;
+  CacheReader reader;
+  CRArena *arena, *prev_arena;
+  char *path;
+
+  prune_cache ();
+
+  path = get_cache_path (filename);
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (mapped == NULL)
+    return NULL;
+
+  reader.data = (const guint8 *) g_mapped_file_get_contents (mapped);
+  reader.len = g_mapped_file_get_length (mapped);
+  reader.pos = 0;
+
+  /* Like a parsed one, the stylesheet lives in an arena it owns */
+  arena = cr_arena_new ();
+  prev_arena = cr_arena_set_current (arena);
+
+  if (read_header (&reader, filename, stat_buf))
+    {
+      stylesheet = read_stylesheet (&reader);
+
+      if (stylesheet != NULL && reader.pos != reader.len)
+        {
+          cr_stylesheet_destroy (stylesheet);
+          stylesheet = NULL;
+        }
+    }
+
+  cr_arena_set_current (prev_arena);
+  if (stylesheet != NULL)
+    cr_arena_set_owner (arena, stylesheet);
+  cr_arena_unref (arena);
+
+  g_mapped_file_unref (mapped);
+
+  return stylesheet;
+}
+
+static void
+cache_write_data_free (gpointer data)
+{
+  CacheWriteData *write_data = data;
+
+  g_free (write_data->path);
+  g_bytes_unref (write_data->contents);
+  g_slice_free (CacheWriteData, write_data);
+}
+
+static void
+write_cache_file_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  CacheWriteData *write_data = task_data;
+  char *dirname;
+
+  dirname = g_path_get_dirname (write_data->path);
+
+  /* The cache is only an optimization, so errors are ignored */
+  if (g_mkdir_with_parents (dirname, 0700) == 0)
+    g_file_set_contents (write_data->path,
+                         g_bytes_get_data (write_data->contents, NULL),
+                         g_bytes_get_size (write_data->contents),
+                         NULL);
+
+  g_free (dirname);
+}
+
+/**
+ * _st_stylesheet_cache_store:
+ * @filename: the path of the stylesheet
+ * @stat_buf: the result of stat()ing @filename before it was parsed
+ * @stylesheet: the stylesheet parsed from @filename
+ *
+ * Serializes @stylesheet and writes it to the cache from a worker thread,
+ * so that the next _st_stylesheet_cache_load() for an unchanged
+ * @filename can skip parsing. Like the first load, the first store of a
+ * session also prunes old cache files.
+ */
+void
+_st_stylesheet_cache_store (const char     *filename,
+                            const GStatBuf *stat_buf,
+                            CRStyleSheet   *stylesheet)
+{
+  CacheWriteData *write_data;
+  GByteArray *out;
+  GTask *task;
+
+  if ((gint64) stat_buf->st_mtime > g_get_real_time () / G_USEC_PER_SEC - MIN_SOURCE_AGE)
+    return;
+
+  prune_cache ();
+
+  /* The stylesheet belongs to the calling thread, so serialize it
+   * here; only the file I/O happens in the worker. */
+  out = g_byte_array_new ();
+  write_header (out, filename, stat_buf);
+
+  if (!write_stylesheet (out, stylesheet))
+    {
+      g_byte_array_unref (out);
+      return;
+    }
+
+  write_data = g_slice_new (CacheWriteData);
+  write_data->path = get_cache_path (filename);
+  write_data->contents = g_byte_array_free_to_bytes (out);
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, write_data, cache_write_data_free);
+  g_task_run_in_thread (task, write_cache_file_thread);
+  g_object_unref (task);
+}
@@ -0,0 +1,35 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-stylesheet-cache.h: on-disk cache of parsed stylesheets
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ST_STYLESHEET_CACHE_H__
+#define __ST_STYLESHEET_CACHE_H__
+
+#include <glib/gstdio.h>
+
+#include "croco/libcroco.h"
+
+G_BEGIN_DECLS
+
+CRStyleSheet *_st_stylesheet_cache_load  (const char     *filename,
+                                          const GStatBuf *stat_buf);
+void          _st_stylesheet_cache_store (const char     *filename,
+                                          const GStatBuf *stat_buf,
+                                          CRStyleSheet   *stylesheet);
+
+G_END_DECLS
+
+#endif /* __ST_STYLESHEET_CACHE_H__ */
@@ -24,6 +24,7 @@
 #include "st-texture-cache.h"
 #include "st-private.h"
 #include "st-cogl-wrapper.h"
+#include "st-raster-cache.h"
 #include <gtk/gtk.h>
 #include <string.h>
 #include <glib.h>
@@ -34,25 +35,47 @@
 #define CACHE_PREFIX_RAW_CHECKSUM "raw-checksum:"
 #define CACHE_PREFIX_COMPRESSED_CHECKSUM "compressed-checksum:"
 
+#define N_PRIORITIES (ST_TEXTURE_CACHE_PRIORITY_BACKGROUND + 1)
+
 struct _StTextureCachePrivate
 {
   GtkIconTheme *icon_theme;
 
   /* Things that were loaded with a cache policy != NONE */
-  GHashTable *keyed_cache; /* char * -> CoglTexture* */
-  GHashTable *keyed_surface_cache; /* char * -> cairo_surface_t* */
+  GHashTable *keyed_cache; /* char * -> CacheEntry * with a CoglTexture */
+  GHashTable *keyed_surface_cache; /* char * -> CacheEntry * with a cairo_surface_t */
+
+  /* The entries of both, most recently used first */
+  GQueue lru;
+  gsize cache_size;
+  gsize memory_budget;
+  guint n_hits;
+  guint n_misses;
+  guint n_evictions;
 
   /* Presently this is used to de-duplicate requests for GIcons and async URIs. */
   GHashTable *outstanding_requests; /* char * -> AsyncTextureLoadData * */
 
+  /* Requests waiting for one of the max_running_loads decode slots,
+   * by priority. URIs are decoded in decode_pool, icons by GTK. */
+  GQueue pending_loads[N_PRIORITIES];
+  guint n_running_loads;
+  guint max_running_loads;
+  GThreadPool *decode_pool;
+
   /* File monitors to evict cache data on changes */
   GHashTable *file_monitors; /* char * -> GFileMonitor * */
 
   double scale;
 };
 
+#define DEFAULT_MEMORY_BUDGET (64 * 1024 * 1024)
+
+#define MAX_RUNNING_LOADS 4
+
 static void st_texture_cache_dispose (GObject *object);
 static void st_texture_cache_finalize (GObject *object);
+static void decode_thread (gpointer task_data, gpointer user_data);
 static void ensure_monitor_for_uri (StTextureCache *cache, const gchar    *uri);
 
 enum
@@ -78,6 +101,177 @@ create_default_texture (void)
   return texture;
 }
 
+/* An entry of keyed_cache or keyed_surface_cache. When the cached data
+ * outgrows the memory budget, the least recently used entries nothing
+ * else uses are evicted: textures no ClutterTexture made by the cache
+ * shows any more, and surfaces only the cache references. Textures
+ * handed out as they are, to theme nodes and the like, can't be told
+ * apart from ones nobody uses any more, so they are never evicted.
+ */
+typedef struct {
+  guint            ref_count;
+  StTextureCache  *cache;      /* NULL once removed from the cache */
+  char            *key;        /* owned by the hash table */
+  CoglTexture     *texture;
+  cairo_surface_t *surface;
+  gsize            size;
+  guint            n_actors;
+  gboolean         pinned;     /* texture was handed out as it is */
+  GList            lru_link;
+} CacheEntry;
+
+static void
+cache_entry_unref (CacheEntry *entry)
+{
+  if (--entry->ref_count > 0)
+    return;
+
+  g_slice_free (CacheEntry, entry);
+}
+
+/* Destroy notify of the keyed caches */
+static void
+cache_entry_remove (gpointer data)
+{
+  CacheEntry *entry = data;
+  StTextureCachePrivate *priv = entry->cache->priv;
+
+  g_queue_unlink (&priv->lru, &entry->lru_link);
+  priv->cache_size -= entry->size;
+  entry->cache = NULL;
+
+  g_clear_pointer (&entry->texture, cogl_object_unref);
+  g_clear_pointer (&entry->surface, cairo_surface_destroy);
+
+  cache_entry_unref (entry);
+}
+
+static gboolean
+cache_entry_in_use (CacheEntry *entry)
+{
+  if (entry->texture)
+    return entry->pinned || entry->n_actors > 0;
+  else
+    return cairo_surface_get_reference_count (entry->surface) > 1;
+}
+
+static void
+on_cached_texture_actor_finalized (gpointer  data,
+                                   GObject  *where_the_object_was)
+{
+  CacheEntry *entry = data;
+
+  entry->n_actors--;
+  cache_entry_unref (entry);
+}
+
+/* Keeps @entry from being evicted while @actor shows its texture */
+static void
+cache_entry_add_actor (CacheEntry   *entry,
+                       ClutterActor *actor)
+{
+  entry->ref_count++;
+  entry->n_actors++;
+  g_object_weak_ref (G_OBJECT (actor), on_cached_texture_actor_finalized, entry);
+}
+
+/* Returns a new reference to the texture of @entry, for a caller the
+ * cache can't tell when it stops using it */
+static CoglTexture *
+cache_entry_hand_out_texture (CacheEntry *entry)
+{
+  entry->pinned = TRUE;
+
+  return cogl_object_ref (entry->texture);
+}
+
+static void
+st_texture_cache_enforce_budget (StTextureCache *cache)
+{
+  StTextureCachePrivate *priv = cache->priv;
+  GList *l, *prev;
+
+  if (priv->memory_budget == 0)
+    return;
+
+  /* The most recent entry was just added or used, keep it */
+  for (l = priv->lru.tail;
+       l != NULL && l != priv->lru.head && priv->cache_size > priv->memory_budget;
+       l = prev)
+    {
+      CacheEntry *entry = l->data;
+
+      prev = l->prev;
+
+      if (cache_entry_in_use (entry))
+        continue;
+
+      priv->n_evictions++;
+      g_hash_table_remove (entry->texture ? priv->keyed_cache : priv->keyed_surface_cache,
+                           entry->key);
+    }
+}
+
+static CacheEntry *
+cache_lookup (StTextureCache *cache,
+              GHashTable     *table,
+              const char     *key)
+{
+  StTextureCachePrivate *priv = cache->priv;
+  CacheEntry *entry;
+
+  entry = g_hash_table_lookup (table, key);
+  if (entry == NULL)
+    {
+      priv->n_misses++;
+      return NULL;
+    }
+
+  priv->n_hits++;
+
+  g_queue_unlink (&priv->lru, &entry->lru_link);
+  g_queue_push_head_link (&priv->lru, &entry->lru_link);
+
+  return entry;
+}
+
+/* Caches a new reference to @texture or @surface under @key */
+static CacheEntry *
+cache_insert (StTextureCache  *cache,
+              const char      *key,
+              CoglTexture     *texture,
+              cairo_surface_t *surface)
+{
+  StTextureCachePrivate *priv = cache->priv;
+  CacheEntry *entry;
+
+  entry = g_slice_new0 (CacheEntry);
+  entry->ref_count = 1;
+  entry->cache = cache;
+  entry->key = g_strdup (key);
+  entry->lru_link.data = entry;
+
+  if (texture)
+    {
+      entry->texture = cogl_object_ref (texture);
+      entry->size = (gsize) cogl_texture_get_width (texture) * cogl_texture_get_height (texture) * 4;
+      g_hash_table_replace (priv->keyed_cache, entry->key, entry);
+    }
+  else
+    {
+      entry->surface = cairo_surface_reference (surface);
+      entry->size = (gsize) cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+      g_hash_table_replace (priv->keyed_surface_cache, entry->key, entry);
+    }
+
+  g_queue_push_head_link (&priv->lru, &entry->lru_link);
+  priv->cache_size += entry->size;
+
+  st_texture_cache_enforce_budget (cache);
+
+  return entry;
+}
+
 /* Reverse the opacity we added while loading */
 static void
 set_texture_cogl_texture (ClutterTexture *clutter_texture, CoglTexture *cogl_texture)
@@ -174,6 +368,8 @@ update_scale_factor (gpointer data)
 static void
 st_texture_cache_init (StTextureCache *self)
 {
+  int i;
+
   self->priv = g_new0 (StTextureCachePrivate, 1);
 
   self->priv->icon_theme = gtk_icon_theme_get_default ();
@@ -181,15 +377,23 @@ st_texture_cache_init (StTextureCache *self)
                     G_CALLBACK (on_icon_theme_changed), self);
 
   self->priv->keyed_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                   g_free, cogl_object_unref);
+                                                   g_free, cache_entry_remove);
 
   self->priv->keyed_surface_cache = g_hash_table_new_full (g_str_hash,
                                                            g_str_equal,
                                                            g_free,
-                                                           (GDestroyNotify) cairo_surface_destroy);
+                                                           cache_entry_remove);
+  g_queue_init (&self->priv->lru);
+  self->priv->memory_budget = DEFAULT_MEMORY_BUDGET;
 
   self->priv->outstanding_requests = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                             g_free, NULL);
+  for (i = 0; i < N_PRIORITIES; i++)
+    g_queue_init (&self->priv->pending_loads[i]);
+  self->priv->max_running_loads = CLAMP (g_get_num_processors (), 2, MAX_RUNNING_LOADS);
+  self->priv->decode_pool = g_thread_pool_new (decode_thread, NULL,
+                                               self->priv->max_running_loads,
+                                               FALSE, NULL);
   self->priv->file_monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                      g_object_unref, g_object_unref);
 
@@ -227,6 +431,11 @@ st_texture_cache_dispose (GObject *object)
 static void
 st_texture_cache_finalize (GObject *object)
 {
+  StTextureCache *self = (StTextureCache*)object;
+
+  /* Each decode holds a reference on the cache, so none is left */
+  g_thread_pool_free (self->priv->decode_pool, TRUE, FALSE);
+
   G_OBJECT_CLASS (st_texture_cache_parent_class)->finalize (object);
 }
 
@@ -310,16 +519,29 @@ typedef struct {
   guint height;
   GSList *textures;
 
+  StTextureCachePriority priority;
+  GList *pending_link; /* in pending_loads until the load is started */
+  GCancellable *cancellable;
+
   GtkIconInfo *icon_info;
   StIconColors *colors;
   char *uri;
   gint scale;
+
+  /* Set if the result goes to the on-disk raster cache */
+  char *raster_key;
+  char *raster_source;
+  GStatBuf raster_stat;
 } AsyncTextureLoadData;
 
+static void on_request_texture_destroyed (ClutterActor *texture,
+                                          gpointer      user_data);
+
 static void
 texture_load_data_free (gpointer p)
 {
   AsyncTextureLoadData *data = p;
+  GSList *iter;
 
   if (data->icon_info)
     {
@@ -333,8 +555,17 @@ texture_load_data_free (gpointer p)
   if (data->key)
     g_free (data->key);
 
-  if (data->textures)
-    g_slist_free_full (data->textures, (GDestroyNotify) g_object_unref);
+  g_free (data->raster_key);
+  g_free (data->raster_source);
+
+  for (iter = data->textures; iter; iter = iter->next)
+    {
+      g_signal_handlers_disconnect_by_func (iter->data, on_request_texture_destroyed, data);
+      g_object_unref (iter->data);
+    }
+  g_slist_free (data->textures);
+
+  g_clear_object (&data->cancellable);
 
   g_free (data);
 }
@@ -494,14 +725,33 @@ load_pixbuf_thread (GTask        *result,
   g_assert (data != NULL);
   g_assert (data->uri != NULL);
 
+  /* Whoever asked for it is gone while it waited for a thread */
+  if (g_task_return_error_if_cancelled (result))
+    return;
+
   pixbuf = impl_load_pixbuf_file (data->uri, data->width, data->height, data->scale, &error);
 
   if (error != NULL)
     g_task_return_error (result, error);
-  else if (pixbuf)
-    g_task_return_pointer (result, g_object_ref (pixbuf), g_object_unref);
+  else if (pixbuf == NULL)
+    g_task_return_new_error (result, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Could not load %s", data->uri);
+  else
+    g_task_return_pointer (result, pixbuf, g_object_unref);
+}
 
-  g_clear_object (&pixbuf);
+/* Runs in decode_pool, which owns a reference on @task_data */
+static void
+decode_thread (gpointer task_data,
+               gpointer user_data)
+{
+  GTask *task = task_data;
+
+  load_pixbuf_thread (task,
+                      g_task_get_source_object (task),
+                      g_task_get_task_data (task),
+                      g_task_get_cancellable (task));
+  g_object_unref (task);
 }
 
 static GdkPixbuf *
@@ -517,11 +767,9 @@ data_to_cogl_texture (const guchar *data,
                       int           height,
                       int           rowstride)
 {
-    return st_cogl_texture_new_from_data_wrapper (width, height,
-                                                  COGL_TEXTURE_NONE,
-                                                  has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888,
-                                                  COGL_PIXEL_FORMAT_ANY,
-                                                  rowstride, data);
+    return st_cogl_atlas_texture_new_from_data_wrapper (width, height,
+                                                        has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888,
+                                                        rowstride, data);
 }
 
 static CoglTexture *
@@ -555,35 +803,80 @@ pixbuf_to_cairo_surface (GdkPixbuf *pixbuf)
   return surface;
 }
 
+/* Makes @data look up and store its texture in the on-disk raster
+ * cache under @raster_key, if @source is worth caching */
 static void
-finish_texture_load (AsyncTextureLoadData *data,
-                     GdkPixbuf            *pixbuf)
+texture_load_data_use_raster_cache (AsyncTextureLoadData *data,
+                                    const char           *raster_key,
+                                    const char           *source)
+{
+  if (source == NULL || !_st_raster_cache_stat (source, &data->raster_stat))
+    return;
+
+  data->raster_key = g_strdup (raster_key);
+  data->raster_source = g_strdup (source);
+}
+
+static CoglTexture *
+texture_load_data_lookup_raster (AsyncTextureLoadData *data)
+{
+  if (data->raster_key == NULL)
+    return NULL;
+
+  return _st_raster_cache_load (data->raster_key, data->raster_source,
+                                &data->raster_stat);
+}
+
+static void
+texture_load_data_store_raster (AsyncTextureLoadData *data,
+                                GdkPixbuf            *pixbuf)
+{
+  if (data->raster_key != NULL)
+    _st_raster_cache_store (data->raster_key, data->raster_source,
+                            &data->raster_stat, pixbuf);
+}
+
+/* The uri keys don't include the size and scale the file is loaded at,
+ * but the raster cache can't do without */
+static char *
+raster_key_for_uri (const char *key,
+                    int         width,
+                    int         height,
+                    int         scale)
+{
+  return g_strdup_printf ("%s,size=%dx%d,scale=%d", key, width, height, scale);
+}
+
+/* Hands @texdata, or %NULL if the load failed, to the textures of
+ * @data and frees it */
+static void
+finish_texture_load_with_texture (AsyncTextureLoadData *data,
+                                  CoglTexture          *texdata)
 {
   GSList *iter;
   StTextureCache *cache;
-  CoglTexture *texdata = NULL;
+  CacheEntry *entry = NULL;
 
   cache = data->cache;
 
-  g_hash_table_remove (cache->priv->outstanding_requests, data->key);
+  /* A cancelled request is already replaced by a new one, if any */
+  if (g_hash_table_lookup (cache->priv->outstanding_requests, data->key) == data)
+    g_hash_table_remove (cache->priv->outstanding_requests, data->key);
 
-  if (pixbuf == NULL)
+  if (texdata == NULL)
     goto out;
 
-  texdata = pixbuf_to_cogl_texture (pixbuf);
-  if (!texdata)
-    goto out;
+  cogl_object_ref (texdata);
 
   if (data->policy != ST_TEXTURE_CACHE_POLICY_NONE)
     {
-      gpointer orig_key, value;
-
-      if (!g_hash_table_lookup_extended (cache->priv->keyed_cache, data->key,
-                                         &orig_key, &value))
+      entry = g_hash_table_lookup (cache->priv->keyed_cache, data->key);
+      if (entry == NULL)
+        entry = cache_insert (cache, data->key, texdata, NULL);
+      else
         {
-          cogl_object_ref (texdata);
-          g_hash_table_insert (cache->priv->keyed_cache, g_strdup (data->key),
-                               texdata);
+          cogl_object_unref (texdata);
+          texdata = cogl_object_ref (entry->texture);
         }
     }
 
@@ -591,15 +884,37 @@ finish_texture_load (AsyncTextureLoadData *data,
     {
       ClutterTexture *texture = iter->data;
       set_texture_cogl_texture (texture, texdata);
+      if (entry)
+        cache_entry_add_actor (entry, CLUTTER_ACTOR (texture));
     }
 
+  cogl_object_unref (texdata);
+
 out:
+  texture_load_data_free (data);
+}
+
+static void
+finish_texture_load (AsyncTextureLoadData *data,
+                     GdkPixbuf            *pixbuf)
+{
+  CoglTexture *texdata = NULL;
+
+  if (pixbuf != NULL)
+    texdata = pixbuf_to_cogl_texture (pixbuf);
+
+  if (texdata != NULL)
+    texture_load_data_store_raster (data, pixbuf);
+
+  finish_texture_load_with_texture (data, texdata);
+
   if (texdata)
     cogl_object_unref (texdata);
-
-  texture_load_data_free (data);
 }
 
+static void finish_running_texture_load (AsyncTextureLoadData *data,
+                                         GdkPixbuf            *pixbuf);
+
 static void
 on_symbolic_icon_loaded (GObject      *source,
                          GAsyncResult *result,
@@ -607,7 +922,7 @@ on_symbolic_icon_loaded (GObject      *source,
 {
   GdkPixbuf *pixbuf;
   pixbuf = gtk_icon_info_load_symbolic_finish (GTK_ICON_INFO (source), result, NULL, NULL);
-  finish_texture_load (user_data, pixbuf);
+  finish_running_texture_load (user_data, pixbuf);
   g_clear_object (&pixbuf);
 }
 
@@ -618,7 +933,7 @@ on_icon_loaded (GObject      *source,
 {
   GdkPixbuf *pixbuf;
   pixbuf = gtk_icon_info_load_icon_finish (GTK_ICON_INFO (source), result, NULL);
-  finish_texture_load (user_data, pixbuf);
+  finish_running_texture_load (user_data, pixbuf);
   g_clear_object (&pixbuf);
 }
 
@@ -629,20 +944,20 @@ on_pixbuf_loaded (GObject      *source,
 {
   GdkPixbuf *pixbuf;
   pixbuf = load_pixbuf_async_finish (ST_TEXTURE_CACHE (source), result, NULL);
-  finish_texture_load (user_data, pixbuf);
+  finish_running_texture_load (user_data, pixbuf);
   g_clear_object (&pixbuf);
 }
 
 static void
-load_texture_async (StTextureCache       *cache,
+start_texture_load (StTextureCache       *cache,
                     AsyncTextureLoadData *data)
 {
   if (data->uri)
     {
-      GTask *task = g_task_new (cache, NULL, on_pixbuf_loaded, data);
+      GTask *task = g_task_new (cache, data->cancellable, on_pixbuf_loaded, data);
       g_task_set_task_data (task, data, NULL);
-      g_task_run_in_thread (task, load_pixbuf_thread);
-      g_object_unref (task);
+      /* Transfer ownership of task */
+      g_thread_pool_push (cache->priv->decode_pool, task, NULL);
     }
   else if (data->icon_info)
     {
@@ -662,17 +977,128 @@ load_texture_async (StTextureCache       *cache,
           gtk_icon_info_load_symbolic_async (data->icon_info,
                                              &foreground_color, &success_color,
                                              &warning_color, &error_color,
-                                             NULL, on_symbolic_icon_loaded, data);
+                                             data->cancellable, on_symbolic_icon_loaded, data);
         }
       else
         {
-          gtk_icon_info_load_icon_async (data->icon_info, NULL, on_icon_loaded, data);
+          gtk_icon_info_load_icon_async (data->icon_info, data->cancellable, on_icon_loaded, data);
         }
     }
   else
     g_assert_not_reached ();
 }
 
+/* Starts the most important pending loads while there are free slots */
+static void
+run_pending_loads (StTextureCache *cache)
+{
+  StTextureCachePrivate *priv = cache->priv;
+  AsyncTextureLoadData *data;
+  int i = 0;
+
+  while (priv->n_running_loads < priv->max_running_loads && i < N_PRIORITIES)
+    {
+      data = g_queue_pop_head (&priv->pending_loads[i]);
+      if (data == NULL)
+        {
+          i++;
+          continue;
+        }
+
+      data->pending_link = NULL;
+      priv->n_running_loads++;
+      start_texture_load (cache, data);
+    }
+}
+
+/* Queues @data to be decoded once a slot is free and nothing more
+ * important is waiting. Call run_pending_loads() after queueing. */
+static void
+queue_texture_load (StTextureCache       *cache,
+                    AsyncTextureLoadData *data)
+{
+  GQueue *queue = &cache->priv->pending_loads[data->priority];
+
+  data->cancellable = g_cancellable_new ();
+
+  g_queue_push_tail (queue, data);
+  data->pending_link = g_queue_peek_tail_link (queue);
+}
+
+static void
+load_texture_async (StTextureCache       *cache,
+                    AsyncTextureLoadData *data)
+{
+  queue_texture_load (cache, data);
+  run_pending_loads (cache);
+}
+
+static void
+finish_running_texture_load (AsyncTextureLoadData *data,
+                             GdkPixbuf            *pixbuf)
+{
+  StTextureCache *cache = data->cache;
+
+  cache->priv->n_running_loads--;
+  finish_texture_load (data, pixbuf);
+  run_pending_loads (cache);
+}
+
+/* Moves @data up to @priority if that is more important than its own */
+static void
+raise_texture_load_priority (StTextureCache         *cache,
+                             AsyncTextureLoadData   *data,
+                             StTextureCachePriority  priority)
+{
+  if (priority >= data->priority)
+    return;
+
+  if (data->pending_link)
+    {
+      g_queue_unlink (&cache->priv->pending_loads[data->priority], data->pending_link);
+      g_queue_push_tail_link (&cache->priv->pending_loads[priority], data->pending_link);
+    }
+
+  data->priority = priority;
+}
+
+/* Drops a request none of whose textures is left to show the result */
+static void
+cancel_texture_load (AsyncTextureLoadData *data)
+{
+  StTextureCache *cache = data->cache;
+
+  /* Later requests for the same key start over */
+  if (g_hash_table_lookup (cache->priv->outstanding_requests, data->key) == data)
+    g_hash_table_remove (cache->priv->outstanding_requests, data->key);
+
+  if (data->pending_link)
+    {
+      g_queue_delete_link (&cache->priv->pending_loads[data->priority], data->pending_link);
+      data->pending_link = NULL;
+      texture_load_data_free (data);
+    }
+  else if (data->cancellable)
+    {
+      /* The decode finishes, or fails, as usual */
+      g_cancellable_cancel (data->cancellable);
+    }
+}
+
+static void
+on_request_texture_destroyed (ClutterActor *texture,
+                              gpointer      user_data)
+{
+  AsyncTextureLoadData *data = user_data;
+
+  g_signal_handlers_disconnect_by_func (texture, on_request_texture_destroyed, data);
+  data->textures = g_slist_remove (data->textures, texture);
+  g_object_unref (texture);
+
+  if (data->textures == NULL)
+    cancel_texture_load (data);
+}
+
 /**
  * st_texture_cache_load: (skip)
  * @cache: A #StTextureCache
@@ -698,31 +1124,51 @@ st_texture_cache_load (StTextureCache       *cache,
                        GError              **error)
 {
   CoglTexture *texture;
+  CacheEntry *entry;
+
+  entry = cache_lookup (cache, cache->priv->keyed_cache, key);
+  if (entry)
+    return cache_entry_hand_out_texture (entry);
+
+  texture = load (cache, key, data, error);
+  if (texture)
+    cache_insert (cache, key, texture, NULL)->pinned = TRUE;
 
-  texture = g_hash_table_lookup (cache->priv->keyed_cache, key);
-  if (!texture)
-    {
-      texture = load (cache, key, data, error);
-      if (texture)
-        g_hash_table_insert (cache->priv->keyed_cache, g_strdup (key), texture);
-      else
-        return NULL;
-    }
-  cogl_object_ref (texture);
   return texture;
 }
 
+/* Shows the cached texture for @key in @texture, if there is one */
+static gboolean
+set_texture_from_cache (StTextureCache *cache,
+                        const char     *key,
+                        ClutterActor   *texture)
+{
+  CacheEntry *entry;
+
+  entry = cache_lookup (cache, cache->priv->keyed_cache, key);
+  if (entry == NULL)
+    return FALSE;
+
+  set_texture_cogl_texture (CLUTTER_TEXTURE (texture), entry->texture);
+  cache_entry_add_actor (entry, texture);
+
+  return TRUE;
+}
+
 /**
  * ensure_request:
  * @cache:
  * @key: A cache key
  * @policy: Cache policy
+ * @priority: How soon @texture is needed
  * @request: (out): If no request is outstanding, one will be created and returned here
  * @texture: A texture to be added to the request
  *
- * Check for any outstanding load for the data represented by @key.  If there
- * is already a request pending, append it to that request to avoid loading
- * the data multiple times.
+ * Check for any outstanding load for the data represented by @key, which
+ * must not be cached already.  If there is already a request pending, append
+ * it to that request to avoid loading the data multiple times, and raise its
+ * priority to @priority if needed. The request is cancelled if all of its
+ * textures are destroyed before it completes.
  *
  * Returns: %TRUE iff there is already a request pending
  */
@@ -730,22 +1176,13 @@ static gboolean
 ensure_request (StTextureCache        *cache,
                 const char            *key,
                 StTextureCachePolicy   policy,
+                StTextureCachePriority priority,
                 AsyncTextureLoadData **request,
                 ClutterActor          *texture)
 {
-  CoglTexture *texdata;
   AsyncTextureLoadData *pending;
   gboolean had_pending;
 
-  texdata = g_hash_table_lookup (cache->priv->keyed_cache, key);
-
-  if (texdata != NULL)
-    {
-      /* We had this cached already, just set the texture and we're done. */
-      set_texture_cogl_texture (CLUTTER_TEXTURE (texture), texdata);
-      return TRUE;
-    }
-
   pending = g_hash_table_lookup (cache->priv->outstanding_requests, key);
   had_pending = pending != NULL;
 
@@ -753,32 +1190,84 @@ ensure_request (StTextureCache        *cache,
     {
       /* Not cached and no pending request, create it */
       *request = g_new0 (AsyncTextureLoadData, 1);
+      (*request)->priority = priority;
       if (policy != ST_TEXTURE_CACHE_POLICY_NONE)
         g_hash_table_insert (cache->priv->outstanding_requests, g_strdup (key), *request);
     }
   else
-   *request = pending;
+    {
+      *request = pending;
+      raise_texture_load_priority (cache, pending, priority);
+    }
 
   /* Regardless of whether there was a pending request, prepend our texture here. */
   (*request)->textures = g_slist_prepend ((*request)->textures, g_object_ref (texture));
+  g_signal_connect (texture, "destroy",
+                    G_CALLBACK (on_request_texture_destroyed), *request);
 
   return had_pending;
 }
 
+/* Appends the cache key of @icon to @key. Returns %FALSE if the icon
+ * can't be serialized, in which case the key doesn't identify it. */
+static gboolean
+append_gicon_key (GString      *key,
+                  GIcon        *icon,
+                  gint          size,
+                  gint          scale,
+                  StIconColors *colors)
+{
+  char *gicon_string;
+  gboolean serialized;
+
+  gicon_string = g_icon_to_string (icon);
+  serialized = gicon_string != NULL;
+
+  g_string_append_printf (key, CACHE_PREFIX_ICON "%s,size=%d,scale=%d",
+                          serialized ? gicon_string : "", size, scale);
+  if (colors)
+    {
+      /* This raises some doubts about the practice of using string keys */
+      g_string_append_printf (key, ",colors=%2x%2x%2x%2x,%2x%2x%2x%2x,%2x%2x%2x%2x,%2x%2x%2x%2x",
+                              colors->foreground.red, colors->foreground.blue, colors->foreground.green, colors->foreground.alpha,
+                              colors->warning.red, colors->warning.blue, colors->warning.green, colors->warning.alpha,
+                              colors->error.red, colors->error.blue, colors->error.green, colors->error.alpha,
+                              colors->success.red, colors->success.blue, colors->success.green, colors->success.alpha);
+    }
+  g_free (gicon_string);
+
+  return serialized;
+}
+
 static ClutterActor *
-load_gicon_with_colors (StTextureCache    *cache,
-                        GIcon             *icon,
-                        gint               size,
-                        gint               scale,
-                        StIconColors      *colors)
+create_gicon_texture (gint size,
+                      gint scale)
 {
-  AsyncTextureLoadData *request;
   ClutterActor *texture;
-  char *gicon_string;
-  char *key;
+
+  texture = (ClutterActor *) create_default_texture ();
+  clutter_actor_set_size (texture, size * scale, size * scale);
+
+  return texture;
+}
+
+/* Queues the load of @icon, which isn't cached, into @texture; the caller
+ * starts it with run_pending_loads(). Takes ownership of @key. */
+static void
+request_gicon (StTextureCache         *cache,
+               ClutterActor           *texture,
+               GIcon                  *icon,
+               char                   *key,
+               StTextureCachePolicy    policy,
+               gint                    size,
+               gint                    scale,
+               StIconColors           *colors,
+               StTextureCachePriority  priority)
+{
+  AsyncTextureLoadData *request;
+  CoglTexture *texdata;
   GtkIconTheme *theme;
   GtkIconInfo *info;
-  StTextureCachePolicy policy;
 
   /* Do theme lookups in the main thread to avoid thread-unsafety */
   theme = cache->priv->icon_theme;
@@ -786,40 +1275,13 @@ load_gicon_with_colors (StTextureCache    *cache,
   info = gtk_icon_theme_lookup_by_gicon_for_scale (theme, icon, size, scale, GTK_ICON_LOOKUP_USE_BUILTIN |
                                                                              GTK_ICON_LOOKUP_FORCE_SIZE);
 
-  if (info == NULL) {
-    texture = CLUTTER_ACTOR (create_default_texture ());
-    clutter_actor_set_size (texture, size * scale, size * scale);
-    return texture;
-  }
-
-  gicon_string = g_icon_to_string (icon);
-  /* A return value of NULL indicates that the icon can not be serialized,
-   * so don't have a unique identifier for it as a cache key, and thus can't
-   * be cached. If it is cachable, we hardcode a policy of FOREVER here for
-   * now; we should actually blow this away on icon theme changes probably */
-  policy = gicon_string != NULL ? ST_TEXTURE_CACHE_POLICY_FOREVER
-                                : ST_TEXTURE_CACHE_POLICY_NONE;
-  if (colors)
+  if (info == NULL)
     {
-      /* This raises some doubts about the practice of using string keys */
-      key = g_strdup_printf (CACHE_PREFIX_ICON "%s,size=%d,scale=%d,colors=%2x%2x%2x%2x,%2x%2x%2x%2x,%2x%2x%2x%2x,%2x%2x%2x%2x",
-                             gicon_string, size, scale,
-                             colors->foreground.red, colors->foreground.blue, colors->foreground.green, colors->foreground.alpha,
-                             colors->warning.red, colors->warning.blue, colors->warning.green, colors->warning.alpha,
-                             colors->error.red, colors->error.blue, colors->error.green, colors->error.alpha,
-                             colors->success.red, colors->success.blue, colors->success.green, colors->success.alpha);
-    }
-  else
-    {
-      key = g_strdup_printf (CACHE_PREFIX_ICON "%s,size=%d,scale=%d",
-                             gicon_string, size, scale);
+      g_free (key);
+      return;
     }
-  g_free (gicon_string);
-
-  texture = (ClutterActor *) create_default_texture ();
-  clutter_actor_set_size (texture, size * scale, size * scale);
 
-  if (ensure_request (cache, key, policy, &request, texture))
+  if (ensure_request (cache, key, policy, priority, &request, texture))
     {
       /* If there's an outstanding request, we've just added ourselves to it */
       g_object_unref (info);
@@ -837,17 +1299,64 @@ load_gicon_with_colors (StTextureCache    *cache,
       request->icon_info = info;
       request->width = request->height = size * scale;
 
-      load_texture_async (cache, request);
+      if (policy != ST_TEXTURE_CACHE_POLICY_NONE)
+        texture_load_data_use_raster_cache (request, key, gtk_icon_info_get_filename (info));
+
+      texdata = texture_load_data_lookup_raster (request);
+      if (texdata != NULL)
+        {
+          finish_texture_load_with_texture (request, texdata);
+          cogl_object_unref (texdata);
+        }
+      else
+        queue_texture_load (cache, request);
     }
 
   if (G_IS_FILE_ICON (icon))
-  {
-    GFile *file = g_file_icon_get_file (G_FILE_ICON (icon));
-    char *uri = g_file_get_uri (file);
-    ensure_monitor_for_uri (cache, uri);
-  }
+    {
+      GFile *file = g_file_icon_get_file (G_FILE_ICON (icon));
+      char *uri = g_file_get_uri (file);
+      ensure_monitor_for_uri (cache, uri);
+      g_free (uri);
+    }
+}
 
-  return CLUTTER_ACTOR (texture);
+static ClutterActor *
+load_gicon_with_colors (StTextureCache         *cache,
+                        GIcon                  *icon,
+                        gint                    size,
+                        gint                    scale,
+                        StIconColors           *colors,
+                        StTextureCachePriority  priority)
+{
+  ClutterActor *texture;
+  GString *key;
+  StTextureCachePolicy policy;
+
+  key = g_string_new (NULL);
+
+  /* If the icon can't be serialized, we don't have a unique identifier
+   * for it as a cache key, and thus can't cache it. If it is cachable,
+   * we hardcode a policy of FOREVER here for now; icon theme changes
+   * evict it. */
+  policy = append_gicon_key (key, icon, size, scale, colors) ? ST_TEXTURE_CACHE_POLICY_FOREVER
+                                                             : ST_TEXTURE_CACHE_POLICY_NONE;
+
+  texture = create_gicon_texture (size, scale);
+
+  if (policy != ST_TEXTURE_CACHE_POLICY_NONE &&
+      set_texture_from_cache (cache, key->str, texture))
+    {
+      g_string_free (key, TRUE);
+    }
+  else
+    {
+      request_gicon (cache, texture, icon, g_string_free (key, FALSE), policy,
+                     size, scale, colors, priority);
+      run_pending_loads (cache);
+    }
+
+  return texture;
 }
 
 /**
@@ -871,7 +1380,121 @@ st_texture_cache_load_gicon (StTextureCache    *cache,
                              GIcon             *icon,
                              gint               size)
 {
-    return load_gicon_with_colors (cache, icon, size, cache->priv->scale, theme_node ? st_theme_node_get_icon_colors (theme_node) : NULL);
+  return st_texture_cache_load_gicon_with_priority (cache, theme_node, icon, size,
+                                                    ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
+}
+
+/**
+ * st_texture_cache_load_gicon_with_priority:
+ * @cache: The texture cache instance
+ * @theme_node: (allow-none): The #StThemeNode to use for colors, or NULL
+ *                            if the icon must not be recolored
+ * @icon: the #GIcon to load
+ * @size: Size of themed
+ * @priority: how soon the icon is needed
+ *
+ * Like st_texture_cache_load_gicon(), but if the icon has to be loaded,
+ * the load waits for those of a higher @priority. Icons that are only
+ * likely to be shown, like those of a menu that isn't open yet, should
+ * be loaded with %ST_TEXTURE_CACHE_PRIORITY_PREFETCH.
+ *
+ * Return Value: (transfer none): A new #ClutterActor for the icon, or an empty ClutterActor
+ * if none was found.
+ */
+ClutterActor *
+st_texture_cache_load_gicon_with_priority (StTextureCache         *cache,
+                                           StThemeNode            *theme_node,
+                                           GIcon                  *icon,
+                                           gint                    size,
+                                           StTextureCachePriority  priority)
+{
+  return load_gicon_with_colors (cache, icon, size, cache->priv->scale,
+                                 theme_node ? st_theme_node_get_icon_colors (theme_node) : NULL,
+                                 priority);
+}
+
+typedef struct {
+  guint                index;
+  char                *key;
+  StTextureCachePolicy policy;
+} MissedIcon;
+
+/**
+ * st_texture_cache_load_gicons_batch:
+ * @cache: The texture cache instance
+ * @theme_node: (allow-none): The #StThemeNode to use for colors, or NULL
+ *                            if the icons must not be recolored
+ * @icons: (array length=n_icons): the #GIcon<!-- -->s to load
+ * @n_icons: the number of icons in @icons
+ * @size: Size of themed
+ * @priority: how soon the icons are needed
+ *
+ * Like calling st_texture_cache_load_gicon_with_priority() for each of
+ * @icons, for building long lists like the applications of a menu in one
+ * call. The icons that are already cached are looked up first, in a single
+ * pass; only the others are then resolved through the icon theme, and
+ * their loads are queued together.
+ *
+ * Return Value: (transfer container) (element-type Clutter.Actor): a new
+ *   #ClutterActor for each icon, in the order of @icons
+ */
+GPtrArray *
+st_texture_cache_load_gicons_batch (StTextureCache         *cache,
+                                    StThemeNode            *theme_node,
+                                    GIcon                 **icons,
+                                    guint                   n_icons,
+                                    gint                    size,
+                                    StTextureCachePriority  priority)
+{
+  StIconColors *colors;
+  GPtrArray *textures;
+  GArray *misses;
+  GString *key;
+  gint scale;
+  guint i;
+
+  colors = theme_node ? st_theme_node_get_icon_colors (theme_node) : NULL;
+  scale = cache->priv->scale;
+
+  textures = g_ptr_array_sized_new (n_icons);
+  misses = g_array_new (FALSE, FALSE, sizeof (MissedIcon));
+  key = g_string_new (NULL);
+
+  for (i = 0; i < n_icons; i++)
+    {
+      ClutterActor *texture = create_gicon_texture (size, scale);
+      MissedIcon miss;
+
+      g_ptr_array_add (textures, texture);
+
+      g_string_truncate (key, 0);
+      miss.policy = append_gicon_key (key, icons[i], size, scale, colors) ? ST_TEXTURE_CACHE_POLICY_FOREVER
+                                                                          : ST_TEXTURE_CACHE_POLICY_NONE;
+
+      if (miss.policy != ST_TEXTURE_CACHE_POLICY_NONE &&
+          set_texture_from_cache (cache, key->str, texture))
+        continue;
+
+      miss.index = i;
+      miss.key = g_strdup (key->str);
+      g_array_append_val (misses, miss);
+    }
+
+  for (i = 0; i < misses->len; i++)
+    {
+      MissedIcon *miss = &g_array_index (misses, MissedIcon, i);
+
+      /* Transfer ownership of key */
+      request_gicon (cache, textures->pdata[miss->index], icons[miss->index],
+                     miss->key, miss->policy, size, scale, colors, priority);
+    }
+
+  run_pending_loads (cache);
+
+  g_string_free (key, TRUE);
+  g_array_unref (misses);
+
+  return textures;
 }
 
 /**
@@ -1329,24 +1952,28 @@ st_texture_cache_load_icon_name (StTextureCache    *cache,
     {
     case ST_ICON_APPLICATION:
       themed = g_themed_icon_new (name);
-      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
       g_object_unref (themed);
       if (texture == NULL)
         {
           themed = g_themed_icon_new ("application-x-executable");
-          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
           g_object_unref (themed);
         }
       return CLUTTER_ACTOR (texture);
       break;
     case ST_ICON_DOCUMENT:
       themed = g_themed_icon_new (name);
-      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
       g_object_unref (themed);
       if (texture == NULL)
         {
           themed = g_themed_icon_new ("x-office-document");
-          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
           g_object_unref (themed);
         }
 
@@ -1357,19 +1984,22 @@ st_texture_cache_load_icon_name (StTextureCache    *cache,
       themed = g_themed_icon_new (symbolic_name);
       g_free (symbolic_name);
       texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale,
-                                        st_theme_node_get_icon_colors (theme_node));
+                                        st_theme_node_get_icon_colors (theme_node),
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
       g_object_unref (themed);
 
       return CLUTTER_ACTOR (texture);
       break;
     case ST_ICON_FULLCOLOR:
       themed = g_themed_icon_new (name);
-      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+      texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
       g_object_unref (themed);
       if (texture == NULL)
         {
           themed = g_themed_icon_new ("image-missing");
-          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL);
+          texture = load_gicon_with_colors (cache, themed, size, cache->priv->scale, NULL,
+                                        ST_TEXTURE_CACHE_PRIORITY_VISIBLE);
           g_object_unref (themed);
         }
 
@@ -1413,7 +2043,9 @@ st_texture_cache_load_uri_async (StTextureCache *cache,
 
   texture = (ClutterActor *) create_default_texture ();
 
-  if (ensure_request (cache, key, policy, &request, texture))
+  if (set_texture_from_cache (cache, key, texture) ||
+      ensure_request (cache, key, policy, ST_TEXTURE_CACHE_PRIORITY_VISIBLE,
+                      &request, texture))
     {
       /* If there's an outstanding request, we've just added ourselves to it */
       g_free (key);
@@ -1447,46 +2079,61 @@ st_texture_cache_load_uri_sync_to_cogl_texture (StTextureCache *cache,
                                                 int             available_height,
                                                 GError         **error)
 {
-  CoglTexture *texdata;
+  CoglTexture *texdata = NULL;
+  CacheEntry *entry;
   GdkPixbuf *pixbuf;
-  char *key;
+  char *key, *raster_key = NULL, *filename = NULL;
+  GStatBuf raster_stat;
 
   int width = available_width == -1 ? -1 : available_width * cache->priv->scale;
   int height = available_height == -1 ? -1 : available_height * cache->priv->scale;
 
   key = g_strconcat (CACHE_PREFIX_URI, uri, NULL);
 
-  texdata = g_hash_table_lookup (cache->priv->keyed_cache, key);
+  entry = cache_lookup (cache, cache->priv->keyed_cache, key);
 
-  if (texdata == NULL)
+  if (entry == NULL)
     {
-      pixbuf = impl_load_pixbuf_file (uri,
-                                      width,
-                                      height,
-                                      cache->priv->scale,
-                                      error);
-      if (!pixbuf)
-        goto out;
-
-      texdata = pixbuf_to_cogl_texture (pixbuf);
-      g_object_unref (pixbuf);
+      if (policy == ST_TEXTURE_CACHE_POLICY_FOREVER)
+        filename = g_filename_from_uri (uri, NULL, NULL);
 
-      if (!texdata)
-        goto out;
+      if (filename != NULL && _st_raster_cache_stat (filename, &raster_stat))
+        {
+          raster_key = raster_key_for_uri (key, width, height, cache->priv->scale);
+          texdata = _st_raster_cache_load (raster_key, filename, &raster_stat);
+        }
 
-      if (policy == ST_TEXTURE_CACHE_POLICY_FOREVER)
+      if (texdata == NULL)
         {
-          cogl_object_ref (texdata);
-          g_hash_table_insert (cache->priv->keyed_cache, g_strdup (key), texdata);
+          pixbuf = impl_load_pixbuf_file (uri,
+                                          width,
+                                          height,
+                                          cache->priv->scale,
+                                          error);
+          if (!pixbuf)
+            goto out;
+
+          texdata = pixbuf_to_cogl_texture (pixbuf);
+          if (texdata && raster_key)
+            _st_raster_cache_store (raster_key, filename, &raster_stat, pixbuf);
+          g_object_unref (pixbuf);
+
+          if (!texdata)
+            goto out;
         }
+
+      if (policy == ST_TEXTURE_CACHE_POLICY_FOREVER)
+        cache_insert (cache, key, texdata, NULL)->pinned = TRUE;
     }
   else
-    cogl_object_ref (texdata);
+    texdata = cache_entry_hand_out_texture (entry);
 
   ensure_monitor_for_uri (cache, uri);
 
 out:
   g_free (key);
+  g_free (raster_key);
+  g_free (filename);
   return texdata;
 }
 
@@ -1499,14 +2146,15 @@ st_texture_cache_load_uri_sync_to_cairo_surface (StTextureCache        *cache,
                                                  GError               **error)
 {
   cairo_surface_t *surface;
+  CacheEntry *entry;
   GdkPixbuf *pixbuf;
   char *key;
 
   key = g_strconcat (CACHE_PREFIX_URI_FOR_CAIRO, uri, NULL);
 
-  surface = g_hash_table_lookup (cache->priv->keyed_surface_cache, key);
+  entry = cache_lookup (cache, cache->priv->keyed_surface_cache, key);
 
-  if (surface == NULL)
+  if (entry == NULL)
     {
       int width = available_width == -1 ? -1 : available_width * cache->priv->scale;
       int height = available_height == -1 ? -1 : available_height * cache->priv->scale;
@@ -1519,14 +2167,10 @@ st_texture_cache_load_uri_sync_to_cairo_surface (StTextureCache        *cache,
       g_object_unref (pixbuf);
 
       if (policy == ST_TEXTURE_CACHE_POLICY_FOREVER)
-        {
-          cairo_surface_reference (surface);
-          g_hash_table_insert (cache->priv->keyed_surface_cache,
-                               g_strdup (key), surface);
-        }
+        cache_insert (cache, key, NULL, surface);
     }
   else
-    cairo_surface_reference (surface);
+    surface = cairo_surface_reference (entry->surface);
 
   ensure_monitor_for_uri (cache, uri);
 
@@ -1562,6 +2206,8 @@ st_texture_cache_load_uri_sync (StTextureCache *cache,
 {
   CoglTexture *texdata;
   ClutterTexture *texture;
+  CacheEntry *entry;
+  char *key;
 
   texdata = st_texture_cache_load_uri_sync_to_cogl_texture (cache, policy, uri, available_width, available_height, error);
 
@@ -1570,6 +2216,13 @@ st_texture_cache_load_uri_sync (StTextureCache *cache,
 
   texture = create_default_texture ();
   set_texture_cogl_texture (texture, texdata);
+
+  key = g_strconcat (CACHE_PREFIX_URI, uri, NULL);
+  entry = g_hash_table_lookup (cache->priv->keyed_cache, key);
+  if (entry != NULL && entry->texture == texdata)
+    cache_entry_add_actor (entry, CLUTTER_ACTOR (texture));
+  g_free (key);
+
   cogl_object_unref (texdata);
 
   return CLUTTER_ACTOR (texture);
@@ -1613,6 +2266,162 @@ st_texture_cache_load_file_to_cogl_texture (StTextureCache *cache,
   return texture;
 }
 
+/**
+ * st_texture_cache_lookup_file_cogl_texture: (skip)
+ * @cache: A #StTextureCache
+ * @file_path: Path to a file in supported image format
+ *
+ * Looks up the texture st_texture_cache_load_file_to_cogl_texture()
+ * or st_texture_cache_load_file_to_cogl_texture_async() loaded for
+ * @file_path, without decoding the file if it isn't cached. A raster
+ * of the file left in the on-disk cache by an earlier session counts
+ * as cached.
+ *
+ * Returns: (transfer full): a new reference to the #CoglTexture, or
+ *   %NULL if the file isn't loaded
+ */
+CoglTexture *
+st_texture_cache_lookup_file_cogl_texture (StTextureCache *cache,
+                                           const gchar    *file_path)
+{
+  CoglTexture *texture = NULL;
+  CacheEntry *entry;
+  GFile *file;
+  GStatBuf raster_stat;
+  char *uri, *key, *raster_key;
+
+  file = g_file_new_for_path (file_path);
+  uri = g_file_get_uri (file);
+  key = g_strconcat (CACHE_PREFIX_URI, uri, NULL);
+
+  entry = cache_lookup (cache, cache->priv->keyed_cache, key);
+  if (entry)
+    {
+      texture = cache_entry_hand_out_texture (entry);
+    }
+  else if (_st_raster_cache_stat (file_path, &raster_stat))
+    {
+      raster_key = raster_key_for_uri (key, -1, -1, cache->priv->scale);
+      texture = _st_raster_cache_load (raster_key, file_path, &raster_stat);
+      g_free (raster_key);
+
+      if (texture)
+        {
+          cache_insert (cache, key, texture, NULL)->pinned = TRUE;
+          ensure_monitor_for_uri (cache, uri);
+        }
+    }
+
+  g_object_unref (file);
+  g_free (uri);
+  g_free (key);
+
+  return texture;
+}
+
+/**
+ * st_texture_cache_load_file_to_cogl_texture_async: (skip)
+ * @cache: A #StTextureCache
+ * @file_path: Path to a file in supported image format
+ * @cancellable: (allow-none): a #GCancellable
+ * @callback: function to call when the file is loaded
+ * @user_data: data to pass to @callback
+ *
+ * Like st_texture_cache_load_file_to_cogl_texture(), but decodes the
+ * file in a thread. Call st_texture_cache_load_file_to_cogl_texture_finish()
+ * from @callback to get the texture, which is then cached the same way.
+ */
+void
+st_texture_cache_load_file_to_cogl_texture_async (StTextureCache      *cache,
+                                                  const gchar         *file_path,
+                                                  GCancellable        *cancellable,
+                                                  GAsyncReadyCallback  callback,
+                                                  gpointer             user_data)
+{
+  AsyncTextureLoadData *data;
+  GTask *task;
+  GFile *file;
+  char *raster_key;
+
+  file = g_file_new_for_path (file_path);
+
+  data = g_new0 (AsyncTextureLoadData, 1);
+  data->cache = cache;
+  data->policy = ST_TEXTURE_CACHE_POLICY_FOREVER;
+  data->uri = g_file_get_uri (file);
+  data->key = g_strconcat (CACHE_PREFIX_URI, data->uri, NULL);
+  data->width = -1;
+  data->height = -1;
+  data->scale = cache->priv->scale;
+
+  raster_key = raster_key_for_uri (data->key, -1, -1, data->scale);
+  texture_load_data_use_raster_cache (data, raster_key, file_path);
+  g_free (raster_key);
+
+  task = g_task_new (cache, cancellable, callback, user_data);
+  g_task_set_source_tag (task, st_texture_cache_load_file_to_cogl_texture_async);
+  g_task_set_task_data (task, data, texture_load_data_free);
+  g_task_run_in_thread (task, load_pixbuf_thread);
+
+  g_object_unref (task);
+  g_object_unref (file);
+}
+
+/**
+ * st_texture_cache_load_file_to_cogl_texture_finish: (skip)
+ * @cache: A #StTextureCache
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Finishes a load started with st_texture_cache_load_file_to_cogl_texture_async().
+ *
+ * Returns: (transfer full): a new #CoglTexture, or %NULL on error
+ */
+CoglTexture *
+st_texture_cache_load_file_to_cogl_texture_finish (StTextureCache  *cache,
+                                                   GAsyncResult    *result,
+                                                   GError         **error)
+{
+  AsyncTextureLoadData *data;
+  CoglTexture *texture;
+  CacheEntry *entry;
+  GdkPixbuf *pixbuf;
+
+  g_return_val_if_fail (g_task_is_valid (result, cache), NULL);
+
+  data = g_task_get_task_data (G_TASK (result));
+
+  pixbuf = g_task_propagate_pointer (G_TASK (result), error);
+  if (pixbuf == NULL)
+    return NULL;
+
+  /* Someone may have loaded the file synchronously in the meantime */
+  entry = g_hash_table_lookup (cache->priv->keyed_cache, data->key);
+  if (entry)
+    {
+      texture = cache_entry_hand_out_texture (entry);
+    }
+  else
+    {
+      texture = pixbuf_to_cogl_texture (pixbuf);
+      if (texture)
+        {
+          cache_insert (cache, data->key, texture, NULL)->pinned = TRUE;
+          ensure_monitor_for_uri (cache, data->uri);
+          texture_load_data_store_raster (data, pixbuf);
+        }
+      else
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Could not create a texture for %s", data->uri);
+        }
+    }
+
+  g_object_unref (pixbuf);
+
+  return texture;
+}
+
 /**
  * st_texture_cache_load_file_to_cairo_surface:
  * @cache: A #StTextureCache
@@ -1743,3 +2552,77 @@ st_texture_cache_get_default (void)
     instance = g_object_new (ST_TYPE_TEXTURE_CACHE, NULL);
   return instance;
 }
+
+/**
+ * st_texture_cache_set_memory_budget:
+ * @cache: A #StTextureCache
+ * @bytes: the memory budget in bytes, or 0 for no limit
+ *
+ * Sets how much memory the cached textures and surfaces may take. When
+ * they take more, the least recently used ones that aren't in use are
+ * dropped from the cache. Textures returned as #CoglTexture, rather
+ * than shown in an actor made by the cache, count as in use for as
+ * long as they are cached.
+ */
+void
+st_texture_cache_set_memory_budget (StTextureCache *cache,
+                                    gsize           bytes)
+{
+  g_return_if_fail (ST_IS_TEXTURE_CACHE (cache));
+
+  cache->priv->memory_budget = bytes;
+  st_texture_cache_enforce_budget (cache);
+}
+
+/**
+ * st_texture_cache_get_memory_budget:
+ * @cache: A #StTextureCache
+ *
+ * Returns: the memory budget set with st_texture_cache_set_memory_budget()
+ */
+gsize
+st_texture_cache_get_memory_budget (StTextureCache *cache)
+{
+  g_return_val_if_fail (ST_IS_TEXTURE_CACHE (cache), 0);
+
+  return cache->priv->memory_budget;
+}
+
+/**
+ * st_texture_cache_get_statistics:
+ * @cache: A #StTextureCache
+ * @n_entries: (out) (allow-none): return location for the number of
+ *   cached textures and surfaces
+ * @bytes: (out) (allow-none): return location for the memory they take,
+ *   assuming 4 bytes per texture pixel
+ * @n_hits: (out) (allow-none): return location for the number of
+ *   lookups that found a cached texture or surface
+ * @n_misses: (out) (allow-none): return location for the number of
+ *   lookups that didn't
+ * @n_evictions: (out) (allow-none): return location for the number of
+ *   textures and surfaces dropped to stay within the memory budget
+ *
+ * Gets statistics about the cached textures and surfaces. The hit, miss
+ * and eviction counts are totals since the cache was created.
+ */
+void
+st_texture_cache_get_statistics (StTextureCache *cache,
+                                 guint          *n_entries,
+                                 gsize          *bytes,
+                                 guint          *n_hits,
+                                 guint          *n_misses,
+                                 guint          *n_evictions)
+{
+  g_return_if_fail (ST_IS_TEXTURE_CACHE (cache));
+
+  if (n_entries)
+    *n_entries = cache->priv->lru.length;
+  if (bytes)
+    *bytes = cache->priv->cache_size;
+  if (n_hits)
+    *n_hits = cache->priv->n_hits;
+  if (n_misses)
+    *n_misses = cache->priv->n_misses;
+  if (n_evictions)
+    *n_evictions = cache->priv->n_evictions;
+}
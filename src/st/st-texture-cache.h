@@ -64,10 +64,35 @@ typedef enum {
   ST_TEXTURE_CACHE_POLICY_FOREVER
 } StTextureCachePolicy;
 
+/**
+ * StTextureCachePriority:
+ * @ST_TEXTURE_CACHE_PRIORITY_VISIBLE: the texture is shown right away
+ * @ST_TEXTURE_CACHE_PRIORITY_PREFETCH: the texture is likely to be shown soon
+ * @ST_TEXTURE_CACHE_PRIORITY_BACKGROUND: nobody is waiting for the texture
+ *
+ * Decides which of the textures waiting to be decoded go first.
+ */
+typedef enum {
+  ST_TEXTURE_CACHE_PRIORITY_VISIBLE,
+  ST_TEXTURE_CACHE_PRIORITY_PREFETCH,
+  ST_TEXTURE_CACHE_PRIORITY_BACKGROUND
+} StTextureCachePriority;
+
 GType st_texture_cache_get_type (void) G_GNUC_CONST;
 
 StTextureCache* st_texture_cache_get_default (void);
 
+void  st_texture_cache_set_memory_budget (StTextureCache *cache,
+                                          gsize           bytes);
+gsize st_texture_cache_get_memory_budget (StTextureCache *cache);
+
+void  st_texture_cache_get_statistics    (StTextureCache *cache,
+                                          guint          *n_entries,
+                                          gsize          *bytes,
+                                          guint          *n_hits,
+                                          guint          *n_misses,
+                                          guint          *n_evictions);
+
 ClutterActor *
 st_texture_cache_load_sliced_image (StTextureCache *cache,
                                     const gchar    *path,
@@ -84,6 +109,19 @@ ClutterActor *st_texture_cache_load_gicon (StTextureCache *cache,
                                            GIcon          *icon,
                                            gint            size);
 
+ClutterActor *st_texture_cache_load_gicon_with_priority (StTextureCache         *cache,
+                                                         StThemeNode            *theme_node,
+                                                         GIcon                  *icon,
+                                                         gint                    size,
+                                                         StTextureCachePriority  priority);
+
+GPtrArray    *st_texture_cache_load_gicons_batch (StTextureCache         *cache,
+                                                  StThemeNode            *theme_node,
+                                                  GIcon                 **icons,
+                                                  guint                   n_icons,
+                                                  gint                    size,
+                                                  StTextureCachePriority  priority);
+
 ClutterActor *st_texture_cache_load_icon_name (StTextureCache    *cache,
                                  StThemeNode       *theme_node,
                                  const char        *name,
@@ -105,6 +143,18 @@ ClutterActor *st_texture_cache_load_uri_sync (StTextureCache       *cache,
 CoglTexture  *st_texture_cache_load_file_to_cogl_texture (StTextureCache *cache,
                                                           const gchar    *file_path);
 
+CoglTexture  *st_texture_cache_lookup_file_cogl_texture (StTextureCache *cache,
+                                                         const gchar    *file_path);
+
+void          st_texture_cache_load_file_to_cogl_texture_async  (StTextureCache      *cache,
+                                                                 const gchar         *file_path,
+                                                                 GCancellable        *cancellable,
+                                                                 GAsyncReadyCallback  callback,
+                                                                 gpointer             user_data);
+CoglTexture  *st_texture_cache_load_file_to_cogl_texture_finish (StTextureCache      *cache,
+                                                                 GAsyncResult        *result,
+                                                                 GError             **error);
+
 cairo_surface_t *st_texture_cache_load_file_to_cairo_surface (StTextureCache *cache,
                                                               const gchar    *file_path);
 
@@ -25,6 +25,8 @@
 #include "st-texture-cache.h"
 #include "st-theme.h"
 #include "st-theme-context.h"
+#include "st-theme-node-private.h"
+#include "st-theme-private.h"
 
 struct _StThemeContext {
   GObject parent;
@@ -33,12 +35,21 @@ struct _StThemeContext {
   StThemeNode *root_node;
   StTheme *theme;
 
-  /* set of StThemeNode */
+  /* set of StThemeNode, each mapped to its link in nodes_lru */
   GHashTable *nodes;
+  /* the interned nodes, most recently used first */
+  GQueue nodes_lru;
+  guint max_cached_nodes;
+
+  guint node_hits;
+  guint node_misses;
+  guint node_evictions;
 
   gint scale_factor;
 };
 
+#define DEFAULT_MAX_CACHED_NODES 4096
+
 struct _StThemeContextClass {
   GObjectClass parent_class;
 };
@@ -46,7 +57,8 @@ struct _StThemeContextClass {
 enum
 {
   PROP_0,
-  PROP_SCALE_FACTOR
+  PROP_SCALE_FACTOR,
+  PROP_MAX_CACHED_NODES
 };
 
 enum
@@ -68,6 +80,9 @@ static void on_icon_theme_changed (StTextureCache *cache,
                                    StThemeContext *context);
 
 static void st_theme_context_changed (StThemeContext *context);
+static void on_stylesheet_changed (StTheme        *theme,
+                                   CRStyleSheet   *stylesheet,
+                                   StThemeContext *context);
 
 static void st_theme_context_set_property (GObject      *object,
                                            guint         prop_id,
@@ -96,10 +111,16 @@ st_theme_context_finalize (GObject *object)
 
   if (context->nodes)
     g_hash_table_unref (context->nodes);
+  g_queue_clear (&context->nodes_lru);
   if (context->root_node)
     g_object_unref (context->root_node);
   if (context->theme)
-    g_object_unref (context->theme);
+    {
+      g_signal_handlers_disconnect_by_func (context->theme,
+                                            (gpointer) on_stylesheet_changed,
+                                            context);
+      g_object_unref (context->theme);
+    }
 
   pango_font_description_free (context->font);
 
@@ -128,6 +149,21 @@ st_theme_context_class_init (StThemeContextClass *klass)
                                                      0, G_MAXINT, 1,
                                                      G_PARAM_READABLE | G_PARAM_WRITABLE));
 
+  /**
+   * StThemeContext:max-cached-nodes:
+   *
+   * The number of interned theme nodes above which nodes that are no
+   * longer used by anything are dropped, least recently used first.
+   * Nodes still in use are never dropped. 0 means no limit.
+   */
+  g_object_class_install_property (object_class,
+                                   PROP_MAX_CACHED_NODES,
+                                   g_param_spec_uint ("max-cached-nodes",
+                                                      "Maximum cached nodes",
+                                                      "Number of interned theme nodes above which unused ones are dropped",
+                                                      0, G_MAXUINT, DEFAULT_MAX_CACHED_NODES,
+                                                      G_PARAM_READABLE | G_PARAM_WRITABLE));
+
   signals[CHANGED] =
     g_signal_new ("changed",
                   G_TYPE_FROM_CLASS (klass),
@@ -159,6 +195,8 @@ st_theme_context_init (StThemeContext *context)
   context->nodes = g_hash_table_new_full ((GHashFunc) st_theme_node_hash,
                                           (GEqualFunc) st_theme_node_equal,
                                           g_object_unref, NULL);
+  g_queue_init (&context->nodes_lru);
+  context->max_cached_nodes = DEFAULT_MAX_CACHED_NODES;
 
   context->scale_factor = 1;
 }
@@ -184,6 +222,9 @@ st_theme_context_set_property (GObject      *object,
 
         break;
       }
+    case PROP_MAX_CACHED_NODES:
+      context->max_cached_nodes = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -203,6 +244,9 @@ st_theme_context_get_property (GObject    *object,
     case PROP_SCALE_FACTOR:
       g_value_set_int (value, context->scale_factor);
       break;
+    case PROP_MAX_CACHED_NODES:
+      g_value_set_uint (value, context->max_cached_nodes);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -252,6 +296,7 @@ st_theme_context_changed (StThemeContext *context)
   StThemeNode *old_root = context->root_node;
   context->root_node = NULL;
   g_hash_table_remove_all (context->nodes);
+  g_queue_clear (&context->nodes_lru);
 
   g_signal_emit (context, signals[CHANGED], 0);
 
@@ -259,6 +304,110 @@ st_theme_context_changed (StThemeContext *context)
     g_object_unref (old_root);
 }
 
+/* Returns whether @node, or any of its ancestors, may be matched by a
+ * rule of @stylesheet. @memo caches the answer for each node visited,
+ * since sibling nodes share most of their ancestors.
+ */
+static gboolean
+node_is_affected (StTheme      *theme,
+                  CRStyleSheet *stylesheet,
+                  StThemeNode  *node,
+                  GHashTable   *memo)
+{
+  gpointer cached;
+  gboolean affected;
+
+  if (node == NULL)
+    return FALSE;
+
+  if (g_hash_table_lookup_extended (memo, node, NULL, &cached))
+    return GPOINTER_TO_INT (cached);
+
+  affected = (node->theme == theme &&
+              _st_theme_stylesheet_may_match (theme, stylesheet, node)) ||
+             node_is_affected (theme, stylesheet, node->parent_node, memo);
+
+  g_hash_table_insert (memo, node, GINT_TO_POINTER (affected));
+
+  return affected;
+}
+
+static void
+on_stylesheet_changed (StTheme        *theme,
+                       CRStyleSheet   *stylesheet,
+                       StThemeContext *context)
+{
+  GHashTableIter iter;
+  GHashTable *memo;
+  StThemeNode *node;
+  GList *link;
+  gboolean changed = FALSE;
+
+  /* Everything descends from the root node */
+  if (context->root_node &&
+      _st_theme_stylesheet_may_match (theme, stylesheet, context->root_node))
+    {
+      st_theme_context_changed (context);
+      return;
+    }
+
+  /* Drop only the nodes the stylesheet may match, and their
+   * descendants; widgets whose node is no longer interned are
+   * restyled when ::changed is emitted, see
+   * _st_theme_context_node_is_current().
+   */
+  memo = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, context->nodes);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &node, (gpointer *) &link))
+    {
+      if (node_is_affected (theme, stylesheet, node, memo))
+        {
+          g_queue_delete_link (&context->nodes_lru, link);
+          g_hash_table_iter_remove (&iter);
+          changed = TRUE;
+        }
+    }
+
+  g_hash_table_unref (memo);
+
+  if (changed)
+    g_signal_emit (context, signals[CHANGED], 0);
+}
+
+/* Drops unused nodes, least recently used first, once there are more
+ * than max-cached-nodes of them. We let the table overshoot a bit, so
+ * that a table full of nodes that are all in use isn't scanned again
+ * on every insertion.
+ */
+static void
+maybe_evict_nodes (StThemeContext *context)
+{
+  guint n_nodes = g_hash_table_size (context->nodes);
+  guint max = context->max_cached_nodes;
+  GList *link, *prev;
+
+  if (max == 0 || n_nodes <= max + max / 8)
+    return;
+
+  for (link = context->nodes_lru.tail; link && n_nodes > max; link = prev)
+    {
+      StThemeNode *node = link->data;
+
+      prev = link->prev;
+
+      /* Still used by a widget, or as the parent of another node */
+      if (G_OBJECT (node)->ref_count > 1)
+        continue;
+
+      g_queue_delete_link (&context->nodes_lru, link);
+      g_hash_table_remove (context->nodes, node);
+
+      context->node_evictions++;
+      n_nodes--;
+    }
+}
+
 static void
 on_font_name_changed (StSettings     *settings,
                       GParamSpec     *pspect,
@@ -334,12 +483,21 @@ st_theme_context_set_theme (StThemeContext          *context,
   if (context->theme != theme)
     {
       if (context->theme)
-        g_object_unref (context->theme);
+        {
+          g_signal_handlers_disconnect_by_func (context->theme,
+                                                (gpointer) on_stylesheet_changed,
+                                                context);
+          g_object_unref (context->theme);
+        }
 
       context->theme = theme;
 
       if (context->theme)
-        g_object_ref (context->theme);
+        {
+          g_object_ref (context->theme);
+          g_signal_connect (context->theme, "stylesheet-changed",
+                            G_CALLBACK (on_stylesheet_changed), context);
+        }
 
       st_theme_context_changed (context);
     }
@@ -438,12 +596,96 @@ StThemeNode *
 st_theme_context_intern_node (StThemeContext *context,
                               StThemeNode    *node)
 {
-  StThemeNode *mine = g_hash_table_lookup (context->nodes, node);
+  StThemeNode *mine;
+  GList *link;
 
   /* this might be node or not - it doesn't actually matter */
-  if (mine != NULL)
-    return mine;
+  if (g_hash_table_lookup_extended (context->nodes, node,
+                                    (gpointer *) &mine, (gpointer *) &link))
+    {
+      context->node_hits++;
+
+      g_queue_unlink (&context->nodes_lru, link);
+      g_queue_push_head_link (&context->nodes_lru, link);
+
+      return mine;
+    }
+
+  context->node_misses++;
+
+  g_queue_push_head (&context->nodes_lru, node);
+  g_hash_table_insert (context->nodes, g_object_ref (node),
+                       context->nodes_lru.head);
+
+  maybe_evict_nodes (context);
 
-  g_hash_table_add (context->nodes, g_object_ref (node));
   return node;
 }
+
+/**
+ * st_theme_context_get_node_statistics:
+ * @context: a #StThemeContext
+ * @n_nodes: (out) (allow-none): return location for the number of
+ *   interned nodes
+ * @n_hits: (out) (allow-none): return location for the number of times
+ *   st_theme_context_intern_node() found an existing node
+ * @n_misses: (out) (allow-none): return location for the number of
+ *   nodes added by st_theme_context_intern_node()
+ * @n_evictions: (out) (allow-none): return location for the number of
+ *   unused nodes dropped because of #StThemeContext:max-cached-nodes
+ * @drawing_state_bytes: (out) (allow-none): return location for an
+ *   estimate of the texture memory held by the interned nodes
+ *
+ * Gets statistics about the nodes interned by @context. The hit, miss
+ * and eviction counts are totals since the context was created.
+ */
+void
+st_theme_context_get_node_statistics (StThemeContext *context,
+                                      guint          *n_nodes,
+                                      guint          *n_hits,
+                                      guint          *n_misses,
+                                      guint          *n_evictions,
+                                      gsize          *drawing_state_bytes)
+{
+  g_return_if_fail (ST_IS_THEME_CONTEXT (context));
+
+  if (n_nodes)
+    *n_nodes = g_hash_table_size (context->nodes);
+  if (n_hits)
+    *n_hits = context->node_hits;
+  if (n_misses)
+    *n_misses = context->node_misses;
+  if (n_evictions)
+    *n_evictions = context->node_evictions;
+
+  if (drawing_state_bytes)
+    {
+      GList *l;
+
+      *drawing_state_bytes = 0;
+      for (l = context->nodes_lru.head; l; l = l->next)
+        *drawing_state_bytes += _st_theme_node_get_drawing_state_size (l->data);
+    }
+}
+
+/**
+ * _st_theme_context_node_is_current:
+ * @context: a #StThemeContext
+ * @node: a #StThemeNode
+ *
+ * Checks whether @node is still the interned node for its style in
+ * @context; nodes stop being current when the theme changes or when a
+ * stylesheet that may match them is loaded or unloaded.
+ *
+ * Return value: %TRUE if st_theme_context_intern_node() would return
+ *   @node for an equal node
+ */
+gboolean
+_st_theme_context_node_is_current (StThemeContext *context,
+                                   StThemeNode    *node)
+{
+  gpointer mine;
+
+  return g_hash_table_lookup_extended (context->nodes, node, &mine, NULL) &&
+         mine == node;
+}
@@ -64,6 +64,13 @@ StThemeNode *               st_theme_context_get_root_node  (StThemeContext
 StThemeNode *               st_theme_context_intern_node    (StThemeContext             *context,
                                                              StThemeNode                *node);
 
+void                        st_theme_context_get_node_statistics (StThemeContext *context,
+                                                                  guint          *n_nodes,
+                                                                  guint          *n_hits,
+                                                                  guint          *n_misses,
+                                                                  guint          *n_evictions,
+                                                                  gsize          *drawing_state_bytes);
+
 G_END_DECLS
 
 #endif /* __ST_THEME_CONTEXT_H__ */
@@ -27,6 +27,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "st-shadow.h"
@@ -166,12 +167,10 @@ create_corner_material (StCornerSpec *corner)
 
   cairo_surface_destroy (surface);
 
-  texture = st_cogl_texture_new_from_data_wrapper (size, size,
-                                                   COGL_TEXTURE_NONE,
-                                                   CLUTTER_CAIRO_FORMAT_ARGB32,
-                                                   COGL_PIXEL_FORMAT_ANY,
-                                                   rowstride,
-                                                   data);
+  texture = st_cogl_atlas_texture_new_from_data_wrapper (size, size,
+                                                         CLUTTER_CAIRO_FORMAT_ARGB32,
+                                                         rowstride,
+                                                         data);
 
   g_free (data);
 
@@ -1278,11 +1277,583 @@ st_theme_node_prerender_background (StThemeNode *node)
   return texture;
 }
 
+/*****
+ * Prerendered backgrounds
+ *****/
+
+/* Nodes that paint the same way at the same size prerender the same
+ * background, so the textures are shared between them through a cache
+ * keyed by everything st_theme_node_prerender_background() looks at.
+ * The textures are kept while they fit in the cache's budget, and the
+ * least recently used go first; dropping one only means the next node
+ * that would have used it renders its own.
+ */
+typedef struct {
+  float            width;
+  float            height;
+  ClutterColor     background_color;
+  StGradientType   background_gradient_type;
+  ClutterColor     background_gradient_end;
+  char            *background_image;
+  int              background_position_x;
+  int              background_position_y;
+  gboolean         background_position_set;
+  gboolean         background_repeat;
+  StBackgroundSize background_size;
+  int              background_size_w;
+  int              background_size_h;
+  int              border_width[4];
+  int              border_radius[4];
+  ClutterColor     border_color[4];
+  StBorderImage   *border_image;
+  StShadow        *inset_box_shadow;
+  StShadow        *background_image_shadow;
+} PrerenderKey;
+
+typedef struct {
+  PrerenderKey key;
+  CoglHandle   texture;
+  gsize        size;
+  GList        lru_link;   /* in prerendered_backgrounds_lru, most recent first */
+} PrerenderedBackground;
+
+#define PRERENDERED_BACKGROUNDS_BUDGET (16 * 1024 * 1024)
+
+static GHashTable *prerendered_backgrounds = NULL;
+static GQueue prerendered_backgrounds_lru = G_QUEUE_INIT;
+static gsize prerendered_backgrounds_size = 0;
+static guint prerendered_backgrounds_hits = 0;
+static guint prerendered_backgrounds_misses = 0;
+static guint prerendered_backgrounds_evictions = 0;
+
+/* Fills in @key with borrowed references to @node's properties */
+static void
+prerender_key_init (PrerenderKey *key,
+                    StThemeNode  *node)
+{
+  StShadow *box_shadow;
+  int i;
+
+  memset (key, 0, sizeof (PrerenderKey));
+
+  key->width = node->alloc_width;
+  key->height = node->alloc_height;
+  key->background_color = node->background_color;
+  key->background_gradient_type = node->background_gradient_type;
+  key->background_gradient_end = node->background_gradient_end;
+  key->background_image = (char *) st_theme_node_get_background_image (node);
+  key->background_position_x = node->background_position_x;
+  key->background_position_y = node->background_position_y;
+  key->background_position_set = node->background_position_set;
+  key->background_repeat = node->background_repeat;
+  key->background_size = node->background_size;
+  key->background_size_w = node->background_size_w;
+  key->background_size_h = node->background_size_h;
+
+  for (i = 0; i < 4; i++)
+    {
+      key->border_width[i] = node->border_width[i];
+      key->border_radius[i] = node->border_radius[i];
+      key->border_color[i] = node->border_color[i];
+    }
+
+  key->border_image = st_theme_node_get_border_image (node);
+
+  box_shadow = st_theme_node_get_box_shadow (node);
+  if (box_shadow && box_shadow->inset)
+    key->inset_box_shadow = box_shadow;
+
+  key->background_image_shadow = st_theme_node_get_background_image_shadow (node);
+}
+
+static void
+prerender_key_copy (PrerenderKey       *key,
+                    const PrerenderKey *other)
+{
+  *key = *other;
+
+  key->background_image = g_strdup (other->background_image);
+  if (key->border_image)
+    g_object_ref (key->border_image);
+  if (key->inset_box_shadow)
+    st_shadow_ref (key->inset_box_shadow);
+  if (key->background_image_shadow)
+    st_shadow_ref (key->background_image_shadow);
+}
+
+static void
+prerender_key_clear (PrerenderKey *key)
+{
+  g_free (key->background_image);
+  g_clear_object (&key->border_image);
+  if (key->inset_box_shadow)
+    st_shadow_unref (key->inset_box_shadow);
+  if (key->background_image_shadow)
+    st_shadow_unref (key->background_image_shadow);
+}
+
+static guint
+prerender_key_hash (gconstpointer data)
+{
+  const PrerenderKey *key = data;
+  guint hash;
+  int i;
+
+  hash = (guint) key->width * 33 + (guint) key->height;
+  hash = hash * 33 + clutter_color_hash (&key->background_color);
+  hash = hash * 33 + key->background_gradient_type;
+  if (key->background_image)
+    hash = hash * 33 + g_str_hash (key->background_image);
+
+  for (i = 0; i < 4; i++)
+    {
+      hash = hash * 33 + key->border_width[i];
+      hash = hash * 33 + key->border_radius[i];
+    }
+
+  return hash;
+}
+
+static gboolean
+prerender_key_equal (gconstpointer a,
+                     gconstpointer b)
+{
+  const PrerenderKey *key_a = a;
+  const PrerenderKey *key_b = b;
+
+  if (key_a->width != key_b->width ||
+      key_a->height != key_b->height ||
+      !clutter_color_equal (&key_a->background_color, &key_b->background_color) ||
+      key_a->background_gradient_type != key_b->background_gradient_type ||
+      g_strcmp0 (key_a->background_image, key_b->background_image) != 0 ||
+      key_a->background_position_set != key_b->background_position_set ||
+      key_a->background_position_x != key_b->background_position_x ||
+      key_a->background_position_y != key_b->background_position_y ||
+      key_a->background_repeat != key_b->background_repeat ||
+      key_a->background_size != key_b->background_size ||
+      key_a->background_size_w != key_b->background_size_w ||
+      key_a->background_size_h != key_b->background_size_h)
+    return FALSE;
+
+  if (key_a->background_gradient_type != ST_GRADIENT_NONE &&
+      !clutter_color_equal (&key_a->background_gradient_end, &key_b->background_gradient_end))
+    return FALSE;
+
+  if (memcmp (key_a->border_width, key_b->border_width, sizeof (key_a->border_width)) != 0 ||
+      memcmp (key_a->border_radius, key_b->border_radius, sizeof (key_a->border_radius)) != 0 ||
+      memcmp (key_a->border_color, key_b->border_color, sizeof (key_a->border_color)) != 0)
+    return FALSE;
+
+  if (key_a->border_image != key_b->border_image &&
+      (key_a->border_image == NULL || key_b->border_image == NULL ||
+       !st_border_image_equal (key_a->border_image, key_b->border_image)))
+    return FALSE;
+
+  if (key_a->inset_box_shadow != key_b->inset_box_shadow &&
+      (key_a->inset_box_shadow == NULL || key_b->inset_box_shadow == NULL ||
+       !st_shadow_equal (key_a->inset_box_shadow, key_b->inset_box_shadow)))
+    return FALSE;
+
+  if (key_a->background_image_shadow != key_b->background_image_shadow &&
+      (key_a->background_image_shadow == NULL || key_b->background_image_shadow == NULL ||
+       !st_shadow_equal (key_a->background_image_shadow, key_b->background_image_shadow)))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+prerendered_background_free (PrerenderedBackground *background)
+{
+  g_hash_table_remove (prerendered_backgrounds, &background->key);
+  g_queue_unlink (&prerendered_backgrounds_lru, &background->lru_link);
+  prerendered_backgrounds_size -= background->size;
+
+  cogl_handle_unref (background->texture);
+  prerender_key_clear (&background->key);
+  g_slice_free (PrerenderedBackground, background);
+}
+
+/* Background images are drawn into the prerendered textures, so those
+ * go stale when the files change */
+static void
+on_texture_file_changed (StTextureCache *cache,
+                         const char     *uri,
+                         gpointer        user_data)
+{
+  GList *l, *next;
+
+  for (l = prerendered_backgrounds_lru.head; l; l = next)
+    {
+      PrerenderedBackground *background = l->data;
+
+      next = l->next;
+      if (background->key.background_image != NULL)
+        prerendered_background_free (background);
+    }
+}
+
+/* Returns a new reference to the prerendered background of @node,
+ * rendering it unless an identical node has already done so */
+static CoglHandle
+st_theme_node_lookup_prerendered_background (StThemeNode *node)
+{
+  PrerenderedBackground *background;
+  PrerenderKey key;
+  CoglHandle texture;
+  gsize size;
+
+  if (G_UNLIKELY (prerendered_backgrounds == NULL))
+    {
+      prerendered_backgrounds = g_hash_table_new (prerender_key_hash, prerender_key_equal);
+      g_signal_connect (st_texture_cache_get_default (), "texture-file-changed",
+                        G_CALLBACK (on_texture_file_changed), NULL);
+    }
+
+  prerender_key_init (&key, node);
+
+  background = g_hash_table_lookup (prerendered_backgrounds, &key);
+  if (background != NULL)
+    {
+      prerendered_backgrounds_hits++;
+
+      g_queue_unlink (&prerendered_backgrounds_lru, &background->lru_link);
+      g_queue_push_head_link (&prerendered_backgrounds_lru, &background->lru_link);
+
+      return cogl_handle_ref (background->texture);
+    }
+
+  prerendered_backgrounds_misses++;
+
+  texture = st_theme_node_prerender_background (node);
+  if (texture == COGL_INVALID_HANDLE)
+    return COGL_INVALID_HANDLE;
+
+  size = (gsize) cogl_texture_get_width (texture) * cogl_texture_get_height (texture) * 4;
+  if (size > PRERENDERED_BACKGROUNDS_BUDGET / 4)
+    return texture;
+
+  while (prerendered_backgrounds_size + size > PRERENDERED_BACKGROUNDS_BUDGET)
+    {
+      prerendered_background_free (prerendered_backgrounds_lru.tail->data);
+      prerendered_backgrounds_evictions++;
+    }
+
+  background = g_slice_new0 (PrerenderedBackground);
+  prerender_key_copy (&background->key, &key);
+  background->texture = cogl_handle_ref (texture);
+  background->size = size;
+  background->lru_link.data = background;
+
+  g_hash_table_insert (prerendered_backgrounds, &background->key, background);
+  g_queue_push_head_link (&prerendered_backgrounds_lru, &background->lru_link);
+  prerendered_backgrounds_size += size;
+
+  return texture;
+}
+
+/**
+ * st_theme_node_get_background_cache_statistics:
+ * @n_entries: (out) (allow-none): return location for the number of
+ *   cached backgrounds
+ * @bytes: (out) (allow-none): return location for the texture memory
+ *   of the cached backgrounds, assuming 4 bytes per pixel
+ * @n_hits: (out) (allow-none): return location for the number of
+ *   backgrounds found in the cache
+ * @n_misses: (out) (allow-none): return location for the number of
+ *   backgrounds that had to be rendered
+ * @n_evictions: (out) (allow-none): return location for the number of
+ *   backgrounds dropped to keep the cache within its budget
+ *
+ * Gets statistics about the cache sharing the backgrounds that theme
+ * nodes render with cairo (for gradients, rounded background images
+ * and the like) between nodes that look the same. The hit, miss and
+ * eviction counts are totals since the cache was created.
+ */
 void
-_st_theme_node_free_drawing_state (StThemeNode  *node)
+st_theme_node_get_background_cache_statistics (guint *n_entries,
+                                               gsize *bytes,
+                                               guint *n_hits,
+                                               guint *n_misses,
+                                               guint *n_evictions)
+{
+  if (n_entries)
+    *n_entries = prerendered_backgrounds_lru.length;
+  if (bytes)
+    *bytes = prerendered_backgrounds_size;
+  if (n_hits)
+    *n_hits = prerendered_backgrounds_hits;
+  if (n_misses)
+    *n_misses = prerendered_backgrounds_misses;
+  if (n_evictions)
+    *n_evictions = prerendered_backgrounds_evictions;
+}
+
+static void st_theme_node_paint_borders (StThemeNode           *node,
+                                         CoglFramebuffer       *framebuffer,
+                                         const ClutterActorBox *box,
+                                         guint8                 paint_opacity);
+
+/*****
+ * Box shadows
+ *****/
+
+/* Renders @node's background and borders into a @width x @height
+ * texture and blurs it into a shadow pipeline */
+static CoglPipeline *
+create_box_shadow_pipeline (StThemeNode *node,
+                            StShadow    *shadow_spec,
+                            float        width,
+                            float        height)
+{
+  CoglHandle buffer, offscreen;
+  CoglPipeline *pipeline = COGL_INVALID_HANDLE;
+  CoglError *error = NULL;
+  int texture_width = ceil (width);
+  int texture_height = ceil (height);
+
+  buffer = st_cogl_texture_new_with_size_wrapper (texture_width,
+                                                  texture_height,
+                                                  COGL_TEXTURE_NO_SLICING,
+                                                  COGL_PIXEL_FORMAT_ANY);
+  if (buffer == NULL)
+    return COGL_INVALID_HANDLE;
+
+  offscreen = cogl_offscreen_new_with_texture (buffer);
+
+  if (cogl_framebuffer_allocate (COGL_FRAMEBUFFER (offscreen), &error))
+    {
+      ClutterActorBox box = { 0, 0, width, height };
+      cogl_framebuffer_orthographic (offscreen, 0, 0,
+                                     width,
+                                     height, 0, 1.0);
+      cogl_framebuffer_clear4f (offscreen, COGL_BUFFER_BIT_COLOR, 0, 0, 0, 0);
+
+      st_theme_node_paint_borders (node, offscreen, &box, 0xFF);
+
+      pipeline = _st_create_shadow_pipeline (shadow_spec, buffer);
+    }
+  else
+    {
+      if (error)
+        {
+          cogl_error_free (error);
+        }
+    }
+
+  cogl_handle_unref (offscreen);
+  cogl_handle_unref (buffer);
+
+  return pipeline;
+}
+
+/* Apart from its corners, a node drawn with only a background color
+ * and borders looks the same all along each side, so the outset shadow
+ * of any such node larger than its corners is the shadow of a node
+ * just large enough for them, with the middle stretched. These shadows
+ * are blurred once, at that size, and shared by all the nodes of the
+ * same shape, which then never need blurring again when resized.
+ *
+ * Only the alpha channel of the node ends up in the shadow, so colors
+ * are only compared by their alpha.
+ */
+typedef struct {
+  double blur;
+  double spread;
+  guint  border_width[4];
+  guint  border_radius[4];
+  guint8 background_alpha;
+  guint8 border_alpha[4];
+} BoxShadowKey;
+
+struct _StBoxShadowSlices {
+  BoxShadowKey  key;
+  CoglPipeline *pipeline;    /* only copied, never painted with */
+  float         slices[4];   /* see _st_paint_sliced_shadow_with_opacity() */
+  guint         ref_count;
+  GList         unused_link; /* in unused_box_shadow_slices, when ref_count is 0 */
+};
+
+/* How many shadows nobody uses to keep around, for nodes that come and
+ * go, like those of menus opening and closing */
+#define MAX_UNUSED_BOX_SHADOW_SLICES 32
+
+static GHashTable *box_shadow_slices_cache = NULL;
+static GQueue unused_box_shadow_slices = G_QUEUE_INIT;
+
+static guint
+box_shadow_key_hash (gconstpointer data)
+{
+  const BoxShadowKey *key = data;
+  guint hash;
+  int i;
+
+  hash = g_double_hash (&key->blur) * 33 + g_double_hash (&key->spread);
+  for (i = 0; i < 4; i++)
+    {
+      hash = hash * 33 + key->border_width[i];
+      hash = hash * 33 + key->border_radius[i];
+      hash = hash * 33 + key->border_alpha[i];
+    }
+  hash = hash * 33 + key->background_alpha;
+
+  return hash;
+}
+
+static gboolean
+box_shadow_key_equal (gconstpointer a,
+                      gconstpointer b)
+{
+  const BoxShadowKey *key_a = a;
+  const BoxShadowKey *key_b = b;
+
+  return key_a->blur == key_b->blur &&
+         key_a->spread == key_b->spread &&
+         key_a->background_alpha == key_b->background_alpha &&
+         memcmp (key_a->border_width, key_b->border_width, sizeof (key_a->border_width)) == 0 &&
+         memcmp (key_a->border_radius, key_b->border_radius, sizeof (key_a->border_radius)) == 0 &&
+         memcmp (key_a->border_alpha, key_b->border_alpha, sizeof (key_a->border_alpha)) == 0;
+}
+
+static void
+box_shadow_slices_free (StBoxShadowSlices *slices)
+{
+  g_hash_table_remove (box_shadow_slices_cache, &slices->key);
+  cogl_handle_unref (slices->pipeline);
+  g_slice_free (StBoxShadowSlices, slices);
+}
+
+static void
+box_shadow_slices_unref (StBoxShadowSlices *slices)
+{
+  if (--slices->ref_count > 0)
+    return;
+
+  g_queue_push_head_link (&unused_box_shadow_slices, &slices->unused_link);
+
+  if (unused_box_shadow_slices.length > MAX_UNUSED_BOX_SHADOW_SLICES)
+    {
+      GList *oldest = g_queue_pop_tail_link (&unused_box_shadow_slices);
+
+      box_shadow_slices_free (oldest->data);
+    }
+}
+
+static StBoxShadowSlices *
+box_shadow_slices_lookup (StThemeNode *node,
+                          StShadow    *shadow_spec,
+                          float        width,
+                          float        height)
+{
+  StBoxShadowSlices *slices;
+  BoxShadowKey key;
+  guint radius[4], max_radius = 0;
+  int extent[4], margin, min_width, min_height;
+  int side;
+
+  st_theme_node_reduce_border_radius (node, radius);
+
+  memset (&key, 0, sizeof (key));
+  key.blur = shadow_spec->blur;
+  key.spread = shadow_spec->spread;
+  key.background_alpha = node->background_color.alpha;
+
+  for (side = 0; side < 4; side++)
+    {
+      key.border_width[side] = node->border_width[side];
+      key.border_radius[side] = radius[side];
+      key.border_alpha[side] = node->border_color[side].alpha;
+      max_radius = MAX (max_radius, radius[side]);
+    }
+
+  /* How far in from each side the node stops being the same all along
+   * it (st_theme_node_paint_borders() pads all corners to the largest
+   * radius). Three texels in the middle of the minimal node's shadow
+   * are past the reach of the blur from either side, so the middle one
+   * can be stretched without picking up anything from its neighbours.
+   */
+  for (side = 0; side < 4; side++)
+    extent[side] = MAX (max_radius, node->border_width[side]);
+
+  margin = _st_shadow_get_blur_margin (shadow_spec);
+  min_width = extent[ST_SIDE_LEFT] + extent[ST_SIDE_RIGHT] + 2 * margin + 3;
+  min_height = extent[ST_SIDE_TOP] + extent[ST_SIDE_BOTTOM] + 2 * margin + 3;
+
+  if (width < min_width || height < min_height)
+    return NULL;
+
+  if (G_UNLIKELY (box_shadow_slices_cache == NULL))
+    box_shadow_slices_cache = g_hash_table_new (box_shadow_key_hash, box_shadow_key_equal);
+
+  slices = g_hash_table_lookup (box_shadow_slices_cache, &key);
+  if (slices != NULL)
+    {
+      if (slices->ref_count++ == 0)
+        g_queue_unlink (&unused_box_shadow_slices, &slices->unused_link);
+
+      return slices;
+    }
+
+  slices = g_slice_new0 (StBoxShadowSlices);
+  slices->pipeline = create_box_shadow_pipeline (node, shadow_spec, min_width, min_height);
+  if (slices->pipeline == COGL_INVALID_HANDLE)
+    {
+      g_slice_free (StBoxShadowSlices, slices);
+      return NULL;
+    }
+
+  slices->key = key;
+  slices->ref_count = 1;
+  slices->unused_link.data = slices;
+
+  /* The shadow texture is the minimal node with the margin added all
+   * around; the middle texel is the second of the three */
+  slices->slices[ST_SIDE_LEFT] = extent[ST_SIDE_LEFT] + 2 * margin + 1;
+  slices->slices[ST_SIDE_RIGHT] = extent[ST_SIDE_RIGHT] + 2 * margin + 1;
+  slices->slices[ST_SIDE_TOP] = extent[ST_SIDE_TOP] + 2 * margin + 1;
+  slices->slices[ST_SIDE_BOTTOM] = extent[ST_SIDE_BOTTOM] + 2 * margin + 1;
+
+  g_hash_table_insert (box_shadow_slices_cache, &slices->key, slices);
+
+  return slices;
+}
+
+/* Frees the drawing state that depends on the allocation of @node */
+static void
+st_theme_node_free_sized_drawing_state (StThemeNode *node)
+{
+  if (node->prerendered_texture != COGL_INVALID_HANDLE)
+    cogl_handle_unref (node->prerendered_texture);
+  if (node->prerendered_material != COGL_INVALID_HANDLE)
+    cogl_handle_unref (node->prerendered_material);
+  if (node->box_shadow_material != COGL_INVALID_HANDLE)
+    cogl_handle_unref (node->box_shadow_material);
+  if (node->box_shadow_slices != NULL)
+    box_shadow_slices_unref (node->box_shadow_slices);
+
+  node->prerendered_texture = COGL_INVALID_HANDLE;
+  node->prerendered_material = COGL_INVALID_HANDLE;
+  node->box_shadow_material = COGL_INVALID_HANDLE;
+  node->box_shadow_slices = NULL;
+}
+
+static void
+st_theme_node_free_corners (StThemeNode *node)
 {
   int corner_id;
 
+  for (corner_id = 0; corner_id < 4; corner_id++)
+    {
+      if (node->corner_material[corner_id] != COGL_INVALID_HANDLE)
+        cogl_handle_unref (node->corner_material[corner_id]);
+      node->corner_material[corner_id] = COGL_INVALID_HANDLE;
+    }
+}
+
+/* Frees the images of @node and the pipelines that go with them */
+static void
+st_theme_node_free_size_independent_state (StThemeNode *node)
+{
   if (node->background_texture != COGL_INVALID_HANDLE)
     cogl_handle_unref (node->background_texture);
   if (node->background_material != COGL_INVALID_HANDLE)
@@ -1293,18 +1864,24 @@ _st_theme_node_free_drawing_state (StThemeNode  *node)
     cogl_handle_unref (node->border_slices_texture);
   if (node->border_slices_material != COGL_INVALID_HANDLE)
     cogl_handle_unref (node->border_slices_material);
-  if (node->prerendered_texture != COGL_INVALID_HANDLE)
-    cogl_handle_unref (node->prerendered_texture);
-  if (node->prerendered_material != COGL_INVALID_HANDLE)
-    cogl_handle_unref (node->prerendered_material);
-  if (node->box_shadow_material != COGL_INVALID_HANDLE)
-    cogl_handle_unref (node->box_shadow_material);
   if (node->color_pipeline != COGL_INVALID_HANDLE)
     cogl_handle_unref (node->color_pipeline);
 
-  for (corner_id = 0; corner_id < 4; corner_id++)
-    if (node->corner_material[corner_id] != COGL_INVALID_HANDLE)
-      cogl_handle_unref (node->corner_material[corner_id]);
+  node->background_texture = COGL_INVALID_HANDLE;
+  node->background_material = COGL_INVALID_HANDLE;
+  node->background_shadow_material = COGL_INVALID_HANDLE;
+  node->border_slices_texture = COGL_INVALID_HANDLE;
+  node->border_slices_material = COGL_INVALID_HANDLE;
+  node->color_pipeline = COGL_INVALID_HANDLE;
+  node->size_independent_state_loaded = FALSE;
+}
+
+void
+_st_theme_node_free_drawing_state (StThemeNode  *node)
+{
+  st_theme_node_free_size_independent_state (node);
+  st_theme_node_free_corners (node);
+  st_theme_node_free_sized_drawing_state (node);
 
   _st_theme_node_init_drawing_state (node);
 }
@@ -1318,45 +1895,295 @@ _st_theme_node_init_drawing_state (StThemeNode *node)
   node->background_material = COGL_INVALID_HANDLE;
   node->background_shadow_material = COGL_INVALID_HANDLE;
   node->box_shadow_material = COGL_INVALID_HANDLE;
+  node->box_shadow_slices = NULL;
   node->border_slices_texture = COGL_INVALID_HANDLE;
   node->border_slices_material = COGL_INVALID_HANDLE;
   node->prerendered_texture = COGL_INVALID_HANDLE;
   node->prerendered_material = COGL_INVALID_HANDLE;
   node->color_pipeline = COGL_INVALID_HANDLE;
+  node->size_independent_state_loaded = FALSE;
 
   for (corner_id = 0; corner_id < 4; corner_id++)
     node->corner_material[corner_id] = COGL_INVALID_HANDLE;
 }
 
-static void st_theme_node_paint_borders (StThemeNode           *node,
-                                         CoglFramebuffer       *framebuffer,
-                                         const ClutterActorBox *box,
-                                         guint8                 paint_opacity);
+static gsize
+texture_size (CoglHandle texture)
+{
+  if (texture == COGL_INVALID_HANDLE)
+    return 0;
+
+  return (gsize) cogl_texture_get_width (texture) * cogl_texture_get_height (texture) * 4;
+}
+
+static gsize
+pipeline_texture_size (CoglPipeline *pipeline)
+{
+  if (pipeline == COGL_INVALID_HANDLE)
+    return 0;
+
+  return texture_size (cogl_pipeline_get_layer_texture (pipeline, 0));
+}
+
+/* An estimate of the texture memory the cached drawing state of @node
+ * keeps alive, assuming 4 bytes per pixel. Textures shared with other
+ * nodes or with the texture cache are counted for each node. */
+gsize
+_st_theme_node_get_drawing_state_size (StThemeNode *node)
+{
+  gsize size = 0;
+  int corner_id;
+
+  size += texture_size (node->background_texture);
+  size += texture_size (node->border_slices_texture);
+  size += texture_size (node->prerendered_texture);
+  size += pipeline_texture_size (node->background_shadow_material);
+  size += pipeline_texture_size (node->box_shadow_material);
+
+  for (corner_id = 0; corner_id < 4; corner_id++)
+    size += pipeline_texture_size (node->corner_material[corner_id]);
+
+  return size;
+}
+
+/*****
+ * Image loads
+ *****/
+
+/* Images that aren't in the texture cache yet are decoded in a thread
+ * rather than during the paint; the nodes that wanted them paint
+ * without them meanwhile, and load them again once they are cached.
+ */
+typedef struct {
+  GSList *nodes;   /* of StThemeNode, waiting for the image */
+  GSList *actors;  /* of ClutterActor, that painted those nodes */
+} PendingImageLoad;
+
+static GHashTable *pending_image_loads = NULL; /* file name -> PendingImageLoad */
+
+static void
+queue_redraw_stages (void)
+{
+  const GSList *l;
+
+  for (l = clutter_stage_manager_peek_stages (clutter_stage_manager_get_default ()); l; l = l->next)
+    clutter_actor_queue_redraw (l->data);
+}
+
+static void
+on_image_loaded (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  char *filename = user_data;
+  PendingImageLoad *load;
+  CoglTexture *texture;
+  GError *error = NULL;
+  GSList *l;
+
+  texture = st_texture_cache_load_file_to_cogl_texture_finish (ST_TEXTURE_CACHE (source),
+                                                               result, &error);
+  if (texture == NULL)
+    {
+      g_warning ("Failed to load %s: %s", filename, error->message);
+      g_clear_error (&error);
+    }
+
+  load = g_hash_table_lookup (pending_image_loads, filename);
+  g_hash_table_remove (pending_image_loads, filename);
+
+  for (l = load->nodes; l; l = l->next)
+    {
+      StThemeNode *node = l->data;
+
+      /* Load the images again on the next paint, from the cache */
+      if (texture != NULL)
+        st_theme_node_free_size_independent_state (node);
+
+      g_object_unref (node);
+    }
+
+  if (texture != NULL)
+    {
+      cogl_object_unref (texture);
+
+      /* Nodes painted outside of a widget don't say where they are */
+      if (load->actors == NULL)
+        queue_redraw_stages ();
+    }
+
+  for (l = load->actors; l; l = l->next)
+    {
+      if (texture != NULL)
+        clutter_actor_queue_redraw (l->data);
+
+      g_object_unref (l->data);
+    }
+
+  g_slist_free (load->nodes);
+  g_slist_free (load->actors);
+  g_slice_free (PendingImageLoad, load);
+  g_free (filename);
+}
+
+/* Returns the texture of @filename if it's cached, otherwise starts
+ * loading it for @node and returns %COGL_INVALID_HANDLE */
+static CoglHandle
+st_theme_node_load_image (StThemeNode *node,
+                          const char  *filename)
+{
+  StTextureCache *texture_cache;
+  PendingImageLoad *load;
+  CoglHandle texture;
+
+  texture_cache = st_texture_cache_get_default ();
+
+  texture = st_texture_cache_lookup_file_cogl_texture (texture_cache, filename);
+  if (texture != COGL_INVALID_HANDLE)
+    return texture;
+
+  if (G_UNLIKELY (pending_image_loads == NULL))
+    pending_image_loads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  load = g_hash_table_lookup (pending_image_loads, filename);
+  if (load == NULL)
+    {
+      load = g_slice_new0 (PendingImageLoad);
+      g_hash_table_insert (pending_image_loads, g_strdup (filename), load);
+      st_texture_cache_load_file_to_cogl_texture_async (texture_cache, filename, NULL,
+                                                        on_image_loaded, g_strdup (filename));
+    }
+
+  if (g_slist_find (load->nodes, node) == NULL)
+    load->nodes = g_slist_prepend (load->nodes, g_object_ref (node));
+
+  return COGL_INVALID_HANDLE;
+}
+
+/* Makes @node wait for the images @other is waiting for, when it takes
+ * over the drawing state of @other */
+static void
+st_theme_node_copy_pending_image_loads (StThemeNode *node,
+                                        StThemeNode *other)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (pending_image_loads == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, pending_image_loads);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      PendingImageLoad *load = value;
+
+      if (g_slist_find (load->nodes, other) != NULL && g_slist_find (load->nodes, node) == NULL)
+        load->nodes = g_slist_prepend (load->nodes, g_object_ref (node));
+    }
+}
+
+/**
+ * _st_theme_node_queue_redraw_on_image_loads:
+ * @node: a #StThemeNode
+ * @actor: the actor @node was just painted for
+ *
+ * Makes @actor be redrawn when the images @node paints without, because
+ * they are still loading, are ready; other actors are left alone.
+ */
+void
+_st_theme_node_queue_redraw_on_image_loads (StThemeNode  *node,
+                                            ClutterActor *actor)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (pending_image_loads == NULL || g_hash_table_size (pending_image_loads) == 0)
+    return;
+
+  g_hash_table_iter_init (&iter, pending_image_loads);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      PendingImageLoad *load = value;
+
+      if (g_slist_find (load->nodes, node) != NULL && g_slist_find (load->actors, actor) == NULL)
+        load->actors = g_slist_prepend (load->actors, g_object_ref (actor));
+    }
+}
+
+/* Loads what @node draws whatever its allocation: the images, and the
+ * pipelines for them */
+static void
+st_theme_node_load_size_independent_state (StThemeNode *node,
+                                           gboolean     has_border,
+                                           gboolean     has_border_radius)
+{
+  StBorderImage *border_image;
+  StShadow *background_image_shadow_spec;
+  const char *background_image;
+
+  background_image = st_theme_node_get_background_image (node);
+  border_image = st_theme_node_get_border_image (node);
+
+  if (border_image)
+    {
+      const char *filename;
+
+      filename = st_border_image_get_filename (border_image);
+
+      node->border_slices_texture = st_theme_node_load_image (node, filename);
+    }
+
+  if (node->border_slices_texture)
+    node->border_slices_material = _st_create_texture_pipeline (node->border_slices_texture);
+  else
+    node->border_slices_material = COGL_INVALID_HANDLE;
+
+  background_image_shadow_spec = st_theme_node_get_background_image_shadow (node);
+  if (background_image != NULL && !has_border && !has_border_radius)
+    {
+      node->background_texture = st_theme_node_load_image (node, background_image);
+    }
+
+  if (node->background_texture != COGL_INVALID_HANDLE)
+    {
+      node->background_material = _st_create_texture_pipeline (node->background_texture);
+
+      if (node->background_repeat)
+        cogl_pipeline_set_layer_wrap_mode (node->background_material, 0, COGL_PIPELINE_WRAP_MODE_REPEAT);
+
+      if (background_image_shadow_spec)
+        {
+          node->background_shadow_material = _st_create_shadow_pipeline (background_image_shadow_spec,
+                                                                         node->background_texture);
+        }
+    }
+
+  node->size_independent_state_loaded = TRUE;
+}
 
 static void
 st_theme_node_render_resources (StThemeNode   *node,
                                 float          width,
                                 float          height)
 {
-  StTextureCache *texture_cache;
-  StBorderImage *border_image;
   gboolean has_border;
   gboolean has_border_radius;
   gboolean has_inset_box_shadow;
   gboolean has_large_corners;
   StShadow *box_shadow_spec;
-  StShadow *background_image_shadow_spec;
   const char *background_image;
+  guint old_border_radius[4];
+  guint border_radius[4];
+  int corner;
 
   g_return_if_fail (width > 0 && height > 0);
 
-  texture_cache = st_texture_cache_get_default ();
-
-  /* FIXME - need to separate this into things that need to be recomputed on
-   * geometry change versus things that can be cached regardless, such as
-   * a background image.
+  /* Only the shadows and the backgrounds drawn with cairo depend on the
+   * size; the images stay loaded, and the corners too unless the radii
+   * have to be reduced differently to fit.
    */
-  _st_theme_node_free_drawing_state (node);
+  st_theme_node_reduce_border_radius (node, old_border_radius);
+  st_theme_node_free_sized_drawing_state (node);
 
   node->alloc_width = width;
   node->alloc_height = height;
@@ -1383,6 +2210,8 @@ st_theme_node_render_resources (StThemeNode   *node,
   else
     has_border_radius = FALSE;
 
+  st_theme_node_reduce_border_radius (node, border_radius);
+
   /* The cogl code pads each corner to the maximum border radius,
    * which results in overlapping corner areas if the radius
    * exceeds the actor's halfsize, causing rendering errors.
@@ -1390,11 +2219,6 @@ st_theme_node_render_resources (StThemeNode   *node,
   has_large_corners = FALSE;
 
   if (has_border_radius) {
-    guint border_radius[4];
-    int corner;
-
-    st_theme_node_reduce_border_radius (node, border_radius);
-
     for (corner = 0; corner < 4; corner ++) {
       if (border_radius[corner] * 2 > height ||
           border_radius[corner] * 2 > width) {
@@ -1405,31 +2229,30 @@ st_theme_node_render_resources (StThemeNode   *node,
   }
 
   /* Load referenced images from disk and draw anything we need with cairo now */
-  background_image = st_theme_node_get_background_image (node);
-  border_image = st_theme_node_get_border_image (node);
-
-  if (border_image)
+  if (!node->size_independent_state_loaded)
     {
-      const char *filename;
+      st_theme_node_free_size_independent_state (node);
+      st_theme_node_load_size_independent_state (node, has_border, has_border_radius);
 
-      filename = st_border_image_get_filename (border_image);
-
-      node->border_slices_texture = st_texture_cache_load_file_to_cogl_texture (texture_cache, filename);
+      /* Make sure the corners are looked up below */
+      memset (old_border_radius, 0xff, sizeof (old_border_radius));
     }
 
-  if (node->border_slices_texture)
-    node->border_slices_material = _st_create_texture_pipeline (node->border_slices_texture);
-  else
-    node->border_slices_material = COGL_INVALID_HANDLE;
+  if (memcmp (old_border_radius, border_radius, sizeof (border_radius)) != 0)
+    {
+      st_theme_node_free_corners (node);
+
+      node->corner_material[ST_CORNER_TOPLEFT] =
+        st_theme_node_lookup_corner (node, ST_CORNER_TOPLEFT);
+      node->corner_material[ST_CORNER_TOPRIGHT] =
+        st_theme_node_lookup_corner (node, ST_CORNER_TOPRIGHT);
+      node->corner_material[ST_CORNER_BOTTOMRIGHT] =
+        st_theme_node_lookup_corner (node, ST_CORNER_BOTTOMRIGHT);
+      node->corner_material[ST_CORNER_BOTTOMLEFT] =
+        st_theme_node_lookup_corner (node, ST_CORNER_BOTTOMLEFT);
+    }
 
-  node->corner_material[ST_CORNER_TOPLEFT] =
-    st_theme_node_lookup_corner (node, ST_CORNER_TOPLEFT);
-  node->corner_material[ST_CORNER_TOPRIGHT] =
-    st_theme_node_lookup_corner (node, ST_CORNER_TOPRIGHT);
-  node->corner_material[ST_CORNER_BOTTOMRIGHT] =
-    st_theme_node_lookup_corner (node, ST_CORNER_BOTTOMRIGHT);
-  node->corner_material[ST_CORNER_BOTTOMLEFT] =
-    st_theme_node_lookup_corner (node, ST_CORNER_BOTTOMLEFT);
+  background_image = st_theme_node_get_background_image (node);
 
   /* Use cairo to prerender the node if there is a gradient, or
    * background image with borders and/or rounded corners,
@@ -1444,7 +2267,7 @@ st_theme_node_render_resources (StThemeNode   *node,
       || (has_inset_box_shadow && (has_border || node->background_color.alpha > 0))
       || (background_image && (has_border || has_border_radius))
       || has_large_corners)
-    node->prerendered_texture = st_theme_node_prerender_background (node);
+    node->prerendered_texture = st_theme_node_lookup_prerendered_background (node);
 
   if (node->prerendered_texture)
     node->prerendered_material = _st_create_texture_pipeline (node->prerendered_texture);
@@ -1461,61 +2284,15 @@ st_theme_node_render_resources (StThemeNode   *node,
                                                                 node->prerendered_texture);
       else if (node->background_color.alpha > 0 || has_border)
         {
-          CoglHandle buffer, offscreen;
-          CoglError *error = NULL;
-          int texture_width = ceil (width);
-          int texture_height = ceil (height);
-
-          buffer = st_cogl_texture_new_with_size_wrapper (texture_width,
-                                                          texture_height,
-                                                          COGL_TEXTURE_NO_SLICING,
-                                                          COGL_PIXEL_FORMAT_ANY);
-          if (buffer == NULL)
-            {
-              return;
-            }
-
-          offscreen = cogl_offscreen_new_with_texture (buffer);
-
-          if (cogl_framebuffer_allocate (COGL_FRAMEBUFFER (offscreen), &error))
-            {
-              ClutterActorBox box = { 0, 0, width, height };
-              cogl_framebuffer_orthographic (offscreen, 0, 0,
-                                     width,
-                                     height, 0, 1.0);
-              cogl_framebuffer_clear4f (offscreen, COGL_BUFFER_BIT_COLOR, 0, 0, 0, 0);
-
-              st_theme_node_paint_borders (node, offscreen, &box, 0xFF);
-              cogl_handle_unref (offscreen);
-
-              node->box_shadow_material = _st_create_shadow_pipeline (box_shadow_spec,
-                                                                      buffer);
-            }
+          node->box_shadow_slices = box_shadow_slices_lookup (node, box_shadow_spec,
+                                                              width, height);
+          /* The texture is shared, but painting sets the color of the
+           * pipeline, so each node paints with its own copy */
+          if (node->box_shadow_slices != NULL)
+            node->box_shadow_material = cogl_pipeline_copy (node->box_shadow_slices->pipeline);
           else
-            {
-              if (error)
-                {
-                  cogl_error_free (error);
-                }
-            }
-
-          cogl_handle_unref (buffer);
-        }
-    }
-
-  background_image_shadow_spec = st_theme_node_get_background_image_shadow (node);
-  if (background_image != NULL && !has_border && !has_border_radius)
-    {
-      node->background_texture = st_texture_cache_load_file_to_cogl_texture (texture_cache, background_image);
-      node->background_material = _st_create_texture_pipeline (node->background_texture);
-
-      if (node->background_repeat)
-        cogl_pipeline_set_layer_wrap_mode (node->background_material, 0, COGL_PIPELINE_WRAP_MODE_REPEAT);
-
-      if (background_image_shadow_spec)
-        {
-          node->background_shadow_material = _st_create_shadow_pipeline (background_image_shadow_spec,
-                                                                         node->background_texture);
+            node->box_shadow_material = create_box_shadow_pipeline (node, box_shadow_spec,
+                                                                    width, height);
         }
     }
 }
@@ -2015,7 +2792,8 @@ st_theme_node_paint (StThemeNode           *node,
   allocation.x2 = width;
   allocation.y2 = height;
 
-  if (node->alloc_width != width || node->alloc_height != height)
+  if (node->alloc_width != width || node->alloc_height != height ||
+      !node->size_independent_state_loaded)
     st_theme_node_render_resources (node, width, height);
 
   /* Rough notes about the relationship of borders and backgrounds in CSS3;
@@ -2044,7 +2822,14 @@ st_theme_node_paint (StThemeNode           *node,
    *    such that it's aligned to the outside edges)
    */
 
-  if (node->box_shadow_material)
+  if (node->box_shadow_slices)
+    _st_paint_sliced_shadow_with_opacity (node->box_shadow,
+                                          node->box_shadow_material,
+                                          node->box_shadow_slices->slices,
+                                          fb,
+                                          &allocation,
+                                          paint_opacity);
+  else if (node->box_shadow_material)
     _st_paint_shadow_with_opacity (node->box_shadow,
                                    node->box_shadow_material,
                                    fb,
@@ -2161,6 +2946,11 @@ st_theme_node_copy_cached_paint_state (StThemeNode *node,
     node->background_shadow_material = cogl_handle_ref (other->background_shadow_material);
   if (other->box_shadow_material)
     node->box_shadow_material = cogl_handle_ref (other->box_shadow_material);
+  if (other->box_shadow_slices)
+    {
+      node->box_shadow_slices = other->box_shadow_slices;
+      node->box_shadow_slices->ref_count++;
+    }
   if (other->background_texture)
     node->background_texture = cogl_handle_ref (other->background_texture);
   if (other->background_material)
@@ -2175,6 +2965,8 @@ st_theme_node_copy_cached_paint_state (StThemeNode *node,
     node->prerendered_material = cogl_handle_ref (other->prerendered_material);
   if (other->color_pipeline)
     node->color_pipeline = cogl_handle_ref (other->color_pipeline);
+  node->size_independent_state_loaded = other->size_independent_state_loaded;
+  st_theme_node_copy_pending_image_loads (node, other);
   for (corner_id = 0; corner_id < 4; corner_id++)
     if (other->corner_material[corner_id])
       node->corner_material[corner_id] = cogl_handle_ref (other->corner_material[corner_id]);
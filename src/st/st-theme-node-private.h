@@ -29,6 +29,33 @@
 
 G_BEGIN_DECLS
 
+/* Size of the Bloom filter of ancestor ids, classes and element names
+ * kept in each node; must be a power of two. */
+#define ST_ANCESTOR_FILTER_BITS 256
+
+/* Groups of properties that are resolved together into the cached
+ * computed values of a node; see ensure_properties() */
+typedef enum {
+  ST_STYLE_GROUP_GEOMETRY,
+  ST_STYLE_GROUP_BACKGROUND,
+  ST_STYLE_GROUP_FONT,
+  ST_STYLE_GROUP_ICON_COLORS,
+  ST_STYLE_GROUP_OTHER,
+  ST_N_STYLE_GROUPS
+} StStyleGroup;
+
+/* What a string hashed into the ancestor filter names; pseudo-classes
+ * are not part of the filter, but are tracked as ancestor selector
+ * keys by the theme, see _st_theme_has_ancestor_key() */
+typedef enum {
+  ST_ANCESTOR_KEY_ID           = '#',
+  ST_ANCESTOR_KEY_CLASS        = '.',
+  ST_ANCESTOR_KEY_TYPE         = 't',
+  ST_ANCESTOR_KEY_PSEUDO_CLASS = ':'
+} StAncestorKeyKind;
+
+typedef struct _StBoxShadowSlices StBoxShadowSlices;
+
 struct _StThemeNode {
   GObject parent;
 
@@ -84,10 +111,40 @@ struct _StThemeNode {
   char *inline_style;
   gboolean important;
 
+  /* The id, classes and pseudo-classes as quarks for selector
+   * matching; the arrays are 0-terminated, or NULL when empty */
+  GQuark element_id_quark;
+  GQuark *element_class_quarks;
+  GQuark *pseudo_class_quarks;
+
+  /* Bloom filter of the ids, classes and element names of all our
+   * ancestors, see _st_theme_node_ancestors_may_have() */
+  guint32 ancestor_filter[ST_ANCESTOR_FILTER_BITS / 32];
+
   CRDeclaration **properties;
   int n_properties;
-
-  /* We hold onto these separately so we can destroy them on finalize */
+  /* properties[0 .. n_matched_properties - 1] come from the stylesheets,
+   * the rest from inline_style */
+  int n_matched_properties;
+
+  /* Index of properties[] by property name quark: property_slots is an
+   * open-addressed table holding the index of the last (winning)
+   * declaration of each property, and property_prev[i] is the index of
+   * the previous declaration with the same name as properties[i], or -1.
+   */
+  int *property_slots;
+  int *property_prev;
+  guint property_slots_mask;
+
+  /* Indices of properties[] sorted by style group, keeping cascade
+   * order within each group; the declarations of group g are
+   * style_group_decls[style_group_start[g] .. style_group_start[g + 1] - 1]
+   */
+  int *style_group_decls;
+  int style_group_start[ST_N_STYLE_GROUPS + 1];
+
+  /* Shared with the other nodes with the same inline_style, see
+   * _st_theme_ref_declaration_list() */
   CRDeclaration *inline_properties;
 
   guint background_position_set : 1;
@@ -107,16 +164,22 @@ struct _StThemeNode {
   float alloc_width;
   float alloc_height;
 
+  /* Kept when the allocation changes; the corners as long as the
+   * border radii don't need reducing differently to fit */
   CoglPipeline *background_shadow_material;
-  CoglPipeline *box_shadow_material;
   CoglPipeline *background_texture;
   CoglPipeline *background_material;
   CoglPipeline *border_slices_texture;
   CoglPipeline *border_slices_material;
-  CoglPipeline *prerendered_texture;
-  CoglPipeline *prerendered_material;
   CoglPipeline *color_pipeline;
   CoglHandle corner_material[4];
+  guint size_independent_state_loaded : 1;
+
+  /* Rendered again for each allocation */
+  CoglPipeline *box_shadow_material;
+  StBoxShadowSlices *box_shadow_slices;
+  CoglPipeline *prerendered_texture;
+  CoglPipeline *prerendered_material;
 };
 
 struct _StThemeNodeClass {
@@ -129,8 +192,22 @@ void _st_theme_node_ensure_geometry (StThemeNode *node);
 void _st_theme_node_apply_margins (StThemeNode *node,
                                    ClutterActor *actor);
 
+guint    _st_ancestor_filter_hash          (StAncestorKeyKind  kind,
+                                            const char        *name);
+gboolean _st_theme_node_ancestors_may_have (StThemeNode       *node,
+                                            guint              hash);
+
+void _st_theme_node_reuse_matched_properties (StThemeNode *node,
+                                              StThemeNode *old_node);
+
+gboolean _st_theme_context_node_is_current (StThemeContext *context,
+                                            StThemeNode    *node);
+
 void _st_theme_node_init_drawing_state (StThemeNode *node);
+gsize _st_theme_node_get_drawing_state_size (StThemeNode *node);
 void _st_theme_node_free_drawing_state (StThemeNode *node);
+void _st_theme_node_queue_redraw_on_image_loads (StThemeNode  *node,
+                                                 ClutterActor *actor);
 
 G_END_DECLS
 
@@ -28,15 +28,14 @@ enum {
   LAST_SIGNAL
 };
 
+typedef struct _OffscreenBuffer OffscreenBuffer;
+
 struct _StThemeNodeTransitionPrivate {
   StThemeNode *old_theme_node;
   StThemeNode *new_theme_node;
 
-  CoglHandle old_texture;
-  CoglHandle new_texture;
-
-  CoglHandle old_offscreen;
-  CoglHandle new_offscreen;
+  OffscreenBuffer *old_buffer;
+  OffscreenBuffer *new_buffer;
 
   CoglHandle material;
 
@@ -55,6 +54,194 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (StThemeNodeTransition, st_theme_node_transition, G_TYPE_OBJECT);
 
+/* Hover transitions come and go all the time, so the offscreen buffers
+ * they are painted into are pooled rather than allocated for each one.
+ * Buffer sizes are rounded up to a multiple of OFFSCREEN_BUFFER_STEP so
+ * that transitions of similar widgets share them; a transition only
+ * uses the top left corner. Buffers nobody used for a while are freed.
+ */
+struct _OffscreenBuffer {
+  CoglHandle texture;
+  CoglHandle offscreen;
+  guint      width;
+  guint      height;
+  gint64     release_time;
+};
+
+#define OFFSCREEN_BUFFER_STEP 32
+#define MAX_POOLED_OFFSCREEN_BUFFERS 16
+#define OFFSCREEN_BUFFER_IDLE_SECONDS 10
+
+static GQueue offscreen_buffer_pool = G_QUEUE_INIT; /* most recently released first */
+static guint offscreen_buffer_trim_id = 0;
+static guint n_offscreen_buffers_in_use = 0;
+static guint n_transitions = 0;
+static guint n_transitions_created = 0;
+
+static void
+offscreen_buffer_free (OffscreenBuffer *buffer)
+{
+  cogl_handle_unref (buffer->offscreen);
+  cogl_handle_unref (buffer->texture);
+  g_slice_free (OffscreenBuffer, buffer);
+}
+
+static OffscreenBuffer *
+offscreen_buffer_acquire (guint width,
+                          guint height)
+{
+  OffscreenBuffer *buffer;
+  CoglError *error = NULL;
+  GList *l;
+
+  width = (width + OFFSCREEN_BUFFER_STEP - 1) / OFFSCREEN_BUFFER_STEP * OFFSCREEN_BUFFER_STEP;
+  height = (height + OFFSCREEN_BUFFER_STEP - 1) / OFFSCREEN_BUFFER_STEP * OFFSCREEN_BUFFER_STEP;
+
+  for (l = offscreen_buffer_pool.head; l; l = l->next)
+    {
+      buffer = l->data;
+
+      if (buffer->width == width && buffer->height == height)
+        {
+          g_queue_delete_link (&offscreen_buffer_pool, l);
+          n_offscreen_buffers_in_use++;
+          return buffer;
+        }
+    }
+
+  buffer = g_slice_new0 (OffscreenBuffer);
+  buffer->width = width;
+  buffer->height = height;
+
+  buffer->texture = st_cogl_texture_new_with_size_wrapper (width, height,
+                                                           COGL_TEXTURE_NO_SLICING,
+                                                           COGL_PIXEL_FORMAT_ANY);
+  if (buffer->texture == COGL_INVALID_HANDLE)
+    {
+      g_slice_free (OffscreenBuffer, buffer);
+      return NULL;
+    }
+
+  buffer->offscreen = cogl_offscreen_new_with_texture (buffer->texture);
+
+  if (!cogl_framebuffer_allocate (COGL_FRAMEBUFFER (buffer->offscreen), &error))
+    {
+      g_clear_pointer (&error, cogl_error_free);
+      offscreen_buffer_free (buffer);
+      return NULL;
+    }
+
+  n_offscreen_buffers_in_use++;
+
+  return buffer;
+}
+
+static gboolean
+trim_offscreen_buffer_pool (gpointer data)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  while (offscreen_buffer_pool.length > 0)
+    {
+      OffscreenBuffer *buffer = g_queue_peek_tail (&offscreen_buffer_pool);
+
+      if (now - buffer->release_time < OFFSCREEN_BUFFER_IDLE_SECONDS * G_USEC_PER_SEC)
+        break;
+
+      offscreen_buffer_free (g_queue_pop_tail (&offscreen_buffer_pool));
+    }
+
+  if (offscreen_buffer_pool.length > 0)
+    return G_SOURCE_CONTINUE;
+
+  offscreen_buffer_trim_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+offscreen_buffer_release (OffscreenBuffer *buffer)
+{
+  n_offscreen_buffers_in_use--;
+
+  buffer->release_time = g_get_monotonic_time ();
+  g_queue_push_head (&offscreen_buffer_pool, buffer);
+
+  if (offscreen_buffer_pool.length > MAX_POOLED_OFFSCREEN_BUFFERS)
+    offscreen_buffer_free (g_queue_pop_tail (&offscreen_buffer_pool));
+
+  if (offscreen_buffer_trim_id == 0)
+    {
+      offscreen_buffer_trim_id = g_timeout_add_seconds (OFFSCREEN_BUFFER_IDLE_SECONDS,
+                                                        trim_offscreen_buffer_pool,
+                                                        NULL);
+      g_source_set_name_by_id (offscreen_buffer_trim_id, "[st] trim_offscreen_buffer_pool");
+    }
+}
+
+static void
+release_offscreen_buffers (StThemeNodeTransition *transition)
+{
+  StThemeNodeTransitionPrivate *priv = transition->priv;
+
+  if (priv->old_buffer)
+    {
+      offscreen_buffer_release (priv->old_buffer);
+      priv->old_buffer = NULL;
+    }
+
+  if (priv->new_buffer)
+    {
+      offscreen_buffer_release (priv->new_buffer);
+      priv->new_buffer = NULL;
+    }
+}
+
+/**
+ * st_theme_node_get_transition_statistics:
+ * @n_active: (out) (allow-none): return location for the number of
+ *   theme node transitions alive
+ * @n_created: (out) (allow-none): return location for the number of
+ *   transitions created so far
+ * @n_buffers_in_use: (out) (allow-none): return location for the number
+ *   of offscreen buffers transitions are painted into
+ * @n_buffers_pooled: (out) (allow-none): return location for the number
+ *   of offscreen buffers kept for later transitions
+ * @pooled_bytes: (out) (allow-none): return location for the texture
+ *   memory of the kept buffers, assuming 4 bytes per pixel
+ *
+ * Gets statistics about the transitions between the theme nodes of
+ * widgets, and the pool of offscreen buffers they share.
+ */
+void
+st_theme_node_get_transition_statistics (guint *n_active,
+                                         guint *n_created,
+                                         guint *n_buffers_in_use,
+                                         guint *n_buffers_pooled,
+                                         gsize *pooled_bytes)
+{
+  if (n_active)
+    *n_active = n_transitions;
+  if (n_created)
+    *n_created = n_transitions_created;
+  if (n_buffers_in_use)
+    *n_buffers_in_use = n_offscreen_buffers_in_use;
+  if (n_buffers_pooled)
+    *n_buffers_pooled = offscreen_buffer_pool.length;
+
+  if (pooled_bytes)
+    {
+      GList *l;
+
+      *pooled_bytes = 0;
+      for (l = offscreen_buffer_pool.head; l; l = l->next)
+        {
+          OffscreenBuffer *buffer = l->data;
+
+          *pooled_bytes += (gsize) buffer->width * buffer->height * 4;
+        }
+    }
+}
+
 
 static void
 on_timeline_completed (ClutterTimeline       *timeline,
@@ -217,7 +404,7 @@ setup_framebuffers (StThemeNodeTransition *transition,
 {
   StThemeNodeTransitionPrivate *priv = transition->priv;
   guint width, height;
-  CoglError *error = NULL;
+  CoglFramebuffer *old_offscreen, *new_offscreen;
 
   /* template material to avoid unnecessary shader compilation */
   static CoglHandle material_template = COGL_INVALID_HANDLE;
@@ -228,50 +415,18 @@ setup_framebuffers (StThemeNodeTransition *transition,
   g_return_val_if_fail (width  > 0, FALSE);
   g_return_val_if_fail (height > 0, FALSE);
 
-  if (priv->old_texture)
-    cogl_handle_unref (priv->old_texture);
+  release_offscreen_buffers (transition);
 
-  priv->old_texture = st_cogl_texture_new_with_size_wrapper (width, height,
-                                                             COGL_TEXTURE_NO_SLICING,
-                                                             COGL_PIXEL_FORMAT_ANY);
-
-  if (priv->new_texture)
-    cogl_handle_unref (priv->new_texture);
-
-  priv->new_texture = st_cogl_texture_new_with_size_wrapper (width, height,
-                                                             COGL_TEXTURE_NO_SLICING,
-                                                             COGL_PIXEL_FORMAT_ANY);
-
-  if (priv->old_texture == COGL_INVALID_HANDLE)
-    return FALSE;
-  if (priv->new_texture == COGL_INVALID_HANDLE)
+  priv->old_buffer = offscreen_buffer_acquire (width, height);
+  if (priv->old_buffer == NULL)
     return FALSE;
 
-  if (priv->old_offscreen)
-    cogl_handle_unref (priv->old_offscreen);
-
-  priv->old_offscreen = cogl_offscreen_new_with_texture (priv->old_texture);
-
-  if (!cogl_framebuffer_allocate (COGL_FRAMEBUFFER (priv->old_offscreen), &error))
-    {
-      cogl_object_unref (priv->old_offscreen);
-      g_clear_pointer (&error, cogl_error_free);
-      priv->old_offscreen = COGL_INVALID_HANDLE;
-      return FALSE;
-    }
-
-  if (priv->new_offscreen)
-    cogl_handle_unref (priv->new_offscreen);
-
-  priv->new_offscreen = cogl_offscreen_new_with_texture (priv->new_texture);
+  priv->new_buffer = offscreen_buffer_acquire (width, height);
+  if (priv->new_buffer == NULL)
+    return FALSE;
 
-  if (!cogl_framebuffer_allocate (COGL_FRAMEBUFFER (priv->new_offscreen), &error))
-    {
-      cogl_object_unref (priv->new_offscreen);
-      g_clear_pointer (&error, cogl_error_free);
-      priv->new_offscreen = COGL_INVALID_HANDLE;
-      return FALSE;
-    }
+  old_offscreen = COGL_FRAMEBUFFER (priv->old_buffer->offscreen);
+  new_offscreen = COGL_FRAMEBUFFER (priv->new_buffer->offscreen);
 
   if (priv->material == NULL)
     {
@@ -295,28 +450,32 @@ setup_framebuffers (StThemeNodeTransition *transition,
       priv->material = cogl_pipeline_copy (material_template);
     }
 
-  cogl_pipeline_set_layer_texture (priv->material, 0, priv->new_texture);
-  cogl_pipeline_set_layer_texture (priv->material, 1, priv->old_texture);
+  cogl_pipeline_set_layer_texture (priv->material, 0, priv->new_buffer->texture);
+  cogl_pipeline_set_layer_texture (priv->material, 1, priv->old_buffer->texture);
 
-  cogl_framebuffer_clear4f (priv->old_offscreen, COGL_BUFFER_BIT_COLOR,
+  /* The offscreen box is drawn into the top left corner of the buffers,
+   * which may be larger */
+  cogl_framebuffer_clear4f (old_offscreen, COGL_BUFFER_BIT_COLOR,
                             0, 0, 0, 0);
-  cogl_framebuffer_orthographic (priv->old_offscreen,
+  cogl_framebuffer_orthographic (old_offscreen,
                                  priv->offscreen_box.x1,
                                  priv->offscreen_box.y1,
-                                 priv->offscreen_box.x2,
-                                 priv->offscreen_box.y2, 0.0, 1.0);
+                                 priv->offscreen_box.x1 + priv->old_buffer->width,
+                                 priv->offscreen_box.y1 + priv->old_buffer->height,
+                                 0.0, 1.0);
 
-  cogl_framebuffer_clear4f (priv->new_offscreen, COGL_BUFFER_BIT_COLOR,
+  cogl_framebuffer_clear4f (new_offscreen, COGL_BUFFER_BIT_COLOR,
                             0, 0, 0, 0);
-  cogl_framebuffer_orthographic (priv->new_offscreen,
+  cogl_framebuffer_orthographic (new_offscreen,
                                  priv->offscreen_box.x1,
                                  priv->offscreen_box.y1,
-                                 priv->offscreen_box.x2,
-                                 priv->offscreen_box.y2, 0.0, 1.0);
+                                 priv->offscreen_box.x1 + priv->new_buffer->width,
+                                 priv->offscreen_box.y1 + priv->new_buffer->height,
+                                 0.0, 1.0);
 
-  st_theme_node_paint (priv->old_theme_node, priv->old_offscreen, allocation, 255);
+  st_theme_node_paint (priv->old_theme_node, old_offscreen, allocation, 255);
 
-  st_theme_node_paint (priv->new_theme_node, priv->new_offscreen, allocation, 255);
+  st_theme_node_paint (priv->new_theme_node, new_offscreen, allocation, 255);
 
   return TRUE;
 }
@@ -330,10 +489,7 @@ st_theme_node_transition_paint (StThemeNodeTransition *transition,
   CoglFramebuffer *fb = cogl_get_draw_framebuffer ();
 
   CoglColor constant;
-  float tex_coords[] = {
-    0.0, 0.0, 1.0, 1.0,
-    0.0, 0.0, 1.0, 1.0,
-  };
+  float tex_coords[8];
 
   g_return_if_fail (ST_IS_THEME_NODE (priv->old_theme_node));
   g_return_if_fail (ST_IS_THEME_NODE (priv->new_theme_node));
@@ -352,6 +508,14 @@ st_theme_node_transition_paint (StThemeNodeTransition *transition,
         return;
     }
 
+  /* Both buffers have the same size */
+  tex_coords[0] = tex_coords[4] = 0.0;
+  tex_coords[1] = tex_coords[5] = 0.0;
+  tex_coords[2] = tex_coords[6] = (priv->offscreen_box.x2 - priv->offscreen_box.x1) /
+                                  priv->new_buffer->width;
+  tex_coords[3] = tex_coords[7] = (priv->offscreen_box.y2 - priv->offscreen_box.y1) /
+                                  priv->new_buffer->height;
+
   cogl_color_init_from_4f (&constant, 0., 0., 0.,
                            clutter_timeline_get_progress (priv->timeline));
   cogl_pipeline_set_layer_combine_constant (priv->material, 1, &constant);
@@ -386,29 +550,7 @@ st_theme_node_transition_dispose (GObject *object)
       priv->new_theme_node = NULL;
     }
 
-  if (priv->old_texture)
-    {
-      cogl_handle_unref (priv->old_texture);
-      priv->old_texture = NULL;
-    }
-
-  if (priv->new_texture)
-    {
-      cogl_handle_unref (priv->new_texture);
-      priv->new_texture = NULL;
-    }
-
-  if (priv->old_offscreen)
-    {
-      cogl_handle_unref (priv->old_offscreen);
-      priv->old_offscreen = NULL;
-    }
-
-  if (priv->new_offscreen)
-    {
-      cogl_handle_unref (priv->new_offscreen);
-      priv->new_offscreen = NULL;
-    }
+  release_offscreen_buffers (ST_THEME_NODE_TRANSITION (object));
 
   if (priv->material)
     {
@@ -443,13 +585,21 @@ st_theme_node_transition_init (StThemeNodeTransition *transition)
   transition->priv->old_theme_node = NULL;
   transition->priv->new_theme_node = NULL;
 
-  transition->priv->old_texture = NULL;
-  transition->priv->new_texture = NULL;
-
-  transition->priv->old_offscreen = NULL;
-  transition->priv->new_offscreen = NULL;
+  transition->priv->old_buffer = NULL;
+  transition->priv->new_buffer = NULL;
 
   transition->priv->needs_setup = TRUE;
+
+  n_transitions++;
+  n_transitions_created++;
+}
+
+static void
+st_theme_node_transition_finalize (GObject *object)
+{
+  n_transitions--;
+
+  G_OBJECT_CLASS (st_theme_node_transition_parent_class)->finalize (object);
 }
 
 static void
@@ -458,6 +608,7 @@ st_theme_node_transition_class_init (StThemeNodeTransitionClass *klass)
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->dispose = st_theme_node_transition_dispose;
+  object_class->finalize = st_theme_node_transition_finalize;
 
   signals[COMPLETED] =
     g_signal_new ("completed",
@@ -68,23 +68,38 @@ maybe_free_properties (StThemeNode *node)
       g_free (node->properties);
       node->properties = NULL;
       node->n_properties = 0;
+      node->n_matched_properties = 0;
     }
 
-  if (node->inline_properties)
+  g_clear_pointer (&node->property_slots, g_free);
+  g_clear_pointer (&node->property_prev, g_free);
+  node->property_slots_mask = 0;
+
+  g_clear_pointer (&node->style_group_decls, g_free);
+  memset (node->style_group_start, 0, sizeof (node->style_group_start));
+
+  /* set_properties() took a reference even if the style didn't parse */
+  if (node->properties_computed && node->inline_style)
     {
-      /* This destroys the list, not just the head of the list */
-      cr_declaration_destroy (node->inline_properties);
+      _st_theme_unref_declaration_list (node->inline_style);
       node->inline_properties = NULL;
     }
+
+  node->properties_computed = FALSE;
 }
 
 static void
-on_custom_stylesheets_changed (StTheme *theme,
-                               gpointer data)
+on_stylesheet_changed (StTheme      *theme,
+                       CRStyleSheet *stylesheet,
+                       gpointer      data)
 {
   StThemeNode *node = data;
+
+  if (!node->properties_computed ||
+      !_st_theme_stylesheet_may_match (theme, stylesheet, node))
+    return;
+
   maybe_free_properties (node);
-  node->properties_computed = FALSE;
 }
 
 static void
@@ -100,7 +115,7 @@ st_theme_node_dispose (GObject *gobject)
 
   if (node->theme)
     {
-      g_signal_handlers_disconnect_by_func (node->theme, on_custom_stylesheets_changed, node);
+      g_signal_handlers_disconnect_by_func (node->theme, on_stylesheet_changed, node);
       g_object_unref (node->theme);
       node->theme = NULL;
     }
@@ -134,10 +149,13 @@ st_theme_node_finalize (GObject *object)
   g_free (node->element_id);
   g_strfreev (node->element_classes);
   g_strfreev (node->pseudo_classes);
-  g_free (node->inline_style);
+  g_free (node->element_class_quarks);
+  g_free (node->pseudo_class_quarks);
 
   maybe_free_properties (node);
 
+  g_free (node->inline_style);
+
   if (node->font_desc)
     {
       pango_font_description_free (node->font_desc);
@@ -197,6 +215,143 @@ split_on_whitespace (const gchar *s)
   return (GStrv) g_ptr_array_free (arr, FALSE);
 }
 
+static GQuark *
+quarks_from_strv (GStrv strv)
+{
+  GQuark *quarks;
+  guint n, i;
+
+  if (strv == NULL || strv[0] == NULL)
+    return NULL;
+
+  n = g_strv_length (strv);
+  quarks = g_new (GQuark, n + 1);
+  for (i = 0; i < n; i++)
+    quarks[i] = g_quark_from_string (strv[i]);
+  quarks[n] = 0;
+
+  return quarks;
+}
+
+static gboolean
+quark_arrays_equal (const GQuark *a,
+                    const GQuark *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  for (; *a != 0 && *a == *b; a++, b++)
+    ;
+
+  return *a == *b;
+}
+
+static gboolean
+quark_in_array (GQuark        quark,
+                const GQuark *array)
+{
+  if (array == NULL)
+    return FALSE;
+
+  for (; *array != 0; array++)
+    {
+      if (*array == quark)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+guint
+_st_ancestor_filter_hash (StAncestorKeyKind  kind,
+                          const char        *name)
+{
+  guint hash = 5381 + kind;
+  const char *p;
+
+  for (p = name; *p; p++)
+    hash = (hash << 5) + hash + *p;
+
+  /* Spread the bits, the two filter indexes come from the high bytes */
+  return hash * 0x9e3779b1;
+}
+
+#define ANCESTOR_FILTER_INDEX_1(hash) (((hash) >> 24) & (ST_ANCESTOR_FILTER_BITS - 1))
+#define ANCESTOR_FILTER_INDEX_2(hash) (((hash) >> 12) & (ST_ANCESTOR_FILTER_BITS - 1))
+
+static void
+ancestor_filter_add (guint32           *filter,
+                     StAncestorKeyKind  kind,
+                     const char        *name)
+{
+  guint hash = _st_ancestor_filter_hash (kind, name);
+  guint i1 = ANCESTOR_FILTER_INDEX_1 (hash);
+  guint i2 = ANCESTOR_FILTER_INDEX_2 (hash);
+
+  filter[i1 / 32] |= 1u << (i1 % 32);
+  filter[i2 / 32] |= 1u << (i2 % 32);
+}
+
+/* Adds what a selector could match on @ancestor to @filter; element
+ * names match the type of the node or any of its parent types or
+ * interfaces, as in the theme's selector matching. */
+static void
+ancestor_filter_add_node (guint32     *filter,
+                          StThemeNode *ancestor)
+{
+  if (ancestor->element_id)
+    ancestor_filter_add (filter, ST_ANCESTOR_KEY_ID, ancestor->element_id);
+
+  if (ancestor->element_classes)
+    {
+      char **it;
+
+      for (it = ancestor->element_classes; *it; it++)
+        ancestor_filter_add (filter, ST_ANCESTOR_KEY_CLASS, *it);
+    }
+
+  if (ancestor->element_type == G_TYPE_NONE)
+    {
+      ancestor_filter_add (filter, ST_ANCESTOR_KEY_TYPE, "stage");
+    }
+  else if (ancestor->element_type != G_TYPE_INVALID)
+    {
+      GType *interfaces;
+      guint n_interfaces, i;
+      GType t;
+
+      for (t = ancestor->element_type; t != G_TYPE_INVALID; t = g_type_parent (t))
+        ancestor_filter_add (filter, ST_ANCESTOR_KEY_TYPE, g_type_name (t));
+
+      interfaces = g_type_interfaces (ancestor->element_type, &n_interfaces);
+      for (i = 0; i < n_interfaces; i++)
+        ancestor_filter_add (filter, ST_ANCESTOR_KEY_TYPE, g_type_name (interfaces[i]));
+      g_free (interfaces);
+    }
+}
+
+/**
+ * _st_theme_node_ancestors_may_have:
+ * @node: a #StThemeNode
+ * @hash: a value returned by _st_ancestor_filter_hash()
+ *
+ * Checks the ancestor filter of @node. A %FALSE return means that no
+ * ancestor of @node has the id, class or element name that @hash was
+ * computed from; %TRUE means that one might.
+ *
+ * Return value: whether an ancestor may have the hashed key
+ */
+gboolean
+_st_theme_node_ancestors_may_have (StThemeNode *node,
+                                   guint        hash)
+{
+  guint i1 = ANCESTOR_FILTER_INDEX_1 (hash);
+  guint i2 = ANCESTOR_FILTER_INDEX_2 (hash);
+
+  return (node->ancestor_filter[i1 / 32] & (1u << (i1 % 32))) != 0 &&
+         (node->ancestor_filter[i2 / 32] & (1u << (i2 % 32))) != 0;
+}
+
 /**
  * st_theme_node_new:
  * @context: the context representing global state for this themed tree
@@ -239,7 +394,13 @@ st_theme_node_new (StThemeContext    *context,
 
   node->context = g_object_ref (context);
   if (parent_node != NULL)
-    node->parent_node = g_object_ref (parent_node);
+    {
+      node->parent_node = g_object_ref (parent_node);
+
+      memcpy (node->ancestor_filter, parent_node->ancestor_filter,
+              sizeof (node->ancestor_filter));
+      ancestor_filter_add_node (node->ancestor_filter, parent_node);
+    }
   else
     node->parent_node = NULL;
 
@@ -249,8 +410,8 @@ st_theme_node_new (StThemeContext    *context,
   if (theme != NULL)
     {
       node->theme = g_object_ref (theme);
-      g_signal_connect (node->theme, "custom-stylesheets-changed",
-                        G_CALLBACK (on_custom_stylesheets_changed), node);
+      g_signal_connect (node->theme, "stylesheet-changed",
+                        G_CALLBACK (on_stylesheet_changed), node);
     }
 
   node->important = (parent_node ? parent_node->important : FALSE) || important;
@@ -258,6 +419,9 @@ st_theme_node_new (StThemeContext    *context,
   node->element_id = g_strdup (element_id);
   node->element_classes = split_on_whitespace (element_class);
   node->pseudo_classes = split_on_whitespace (pseudo_class);
+  node->element_id_quark = element_id ? g_quark_from_string (element_id) : 0;
+  node->element_class_quarks = quarks_from_strv (node->element_classes);
+  node->pseudo_class_quarks = quarks_from_strv (node->pseudo_classes);
   node->inline_style = g_strdup (inline_style);
 
   return node;
@@ -380,46 +544,14 @@ st_theme_node_equal (StThemeNode *node_a, StThemeNode *node_b)
       node_a->theme != node_b->theme ||
       node_a->element_type != node_b->element_type ||
       node_a->important != node_b->important ||
-      g_strcmp0 (node_a->element_id, node_b->element_id) ||
+      node_a->element_id_quark != node_b->element_id_quark ||
       g_strcmp0 (node_a->inline_style, node_b->inline_style))
     return FALSE;
 
-  if ((node_a->element_classes == NULL) != (node_b->element_classes == NULL))
-    return FALSE;
-
-  if ((node_a->pseudo_classes == NULL) != (node_b->pseudo_classes == NULL))
+  if (!quark_arrays_equal (node_a->element_class_quarks, node_b->element_class_quarks) ||
+      !quark_arrays_equal (node_a->pseudo_class_quarks, node_b->pseudo_class_quarks))
     return FALSE;
 
-  if (node_a->element_classes != NULL)
-    {
-      int i;
-
-      for (i = 0; ; i++)
-        {
-          if (g_strcmp0 (node_a->element_classes[i],
-                         node_b->element_classes[i]))
-            return FALSE;
-
-          if (node_a->element_classes[i] == NULL)
-            break;
-        }
-    }
-
-  if (node_a->pseudo_classes != NULL)
-    {
-      int i;
-
-      for (i = 0; ; i++)
-        {
-          if (g_strcmp0 (node_a->pseudo_classes[i],
-                         node_b->pseudo_classes[i]))
-            return FALSE;
-
-          if (node_a->pseudo_classes[i] == NULL)
-            break;
-        }
-    }
-
   return TRUE;
 }
 
@@ -432,31 +564,180 @@ st_theme_node_hash (StThemeNode *node)
   hash = hash * 33 + GPOINTER_TO_UINT (node->theme);
   hash = hash * 33 + ((guint) node->element_type);
 
-  if (node->element_id != NULL)
-    hash = hash * 33 + g_str_hash (node->element_id);
+  hash = hash * 33 + node->element_id_quark;
 
   if (node->inline_style != NULL)
     hash = hash * 33 + g_str_hash (node->inline_style);
 
-  if (node->element_classes != NULL)
+  if (node->element_class_quarks != NULL)
     {
-      gchar **it;
+      GQuark *it;
 
-      for (it = node->element_classes; *it != NULL; it++)
-        hash = hash * 33 + g_str_hash (*it) + 1;
+      for (it = node->element_class_quarks; *it != 0; it++)
+        hash = hash * 33 + *it + 1;
     }
 
-  if (node->pseudo_classes != NULL)
+  if (node->pseudo_class_quarks != NULL)
     {
-      gchar **it;
+      GQuark *it;
 
-      for (it = node->pseudo_classes; *it != NULL; it++)
-        hash = hash * 33 + g_str_hash (*it) + 1;
+      for (it = node->pseudo_class_quarks; *it != 0; it++)
+        hash = hash * 33 + *it + 1;
     }
 
   return hash;
 }
 
+/* Property names are interned as quarks the first time a declaration
+ * is indexed; the quark is kept in the otherwise unused rfu0 field so
+ * that declarations shared between nodes are only interned once.
+ */
+static GQuark
+declaration_property_id (CRDeclaration *decl)
+{
+  if (decl->rfu0 == NULL)
+    decl->rfu0 = GUINT_TO_POINTER (g_quark_from_string (decl->property->stryng->str));
+
+  return GPOINTER_TO_UINT (decl->rfu0);
+}
+
+static StStyleGroup
+style_group_for_property (const char *property_name)
+{
+  if (g_str_has_prefix (property_name, "border") ||
+      g_str_has_prefix (property_name, "outline") ||
+      g_str_has_prefix (property_name, "padding") ||
+      g_str_has_prefix (property_name, "margin") ||
+      strcmp (property_name, "width") == 0 ||
+      strcmp (property_name, "height") == 0 ||
+      strcmp (property_name, "min-width") == 0 ||
+      strcmp (property_name, "min-height") == 0 ||
+      strcmp (property_name, "max-width") == 0 ||
+      strcmp (property_name, "max-height") == 0)
+    return ST_STYLE_GROUP_GEOMETRY;
+
+  if (g_str_has_prefix (property_name, "background"))
+    return ST_STYLE_GROUP_BACKGROUND;
+
+  if (strcmp (property_name, "font") == 0 ||
+      strcmp (property_name, "font-family") == 0 ||
+      strcmp (property_name, "font-weight") == 0 ||
+      strcmp (property_name, "font-style") == 0 ||
+      strcmp (property_name, "font-variant") == 0 ||
+      strcmp (property_name, "font-size") == 0)
+    return ST_STYLE_GROUP_FONT;
+
+  if (strcmp (property_name, "color") == 0 ||
+      strcmp (property_name, "warning-color") == 0 ||
+      strcmp (property_name, "error-color") == 0 ||
+      strcmp (property_name, "success-color") == 0)
+    return ST_STYLE_GROUP_ICON_COLORS;
+
+  return ST_STYLE_GROUP_OTHER;
+}
+
+/* Like the property quark, the style group is computed once per
+ * declaration and kept in rfu1, offset by one so that 0 means unset */
+static StStyleGroup
+declaration_style_group (CRDeclaration *decl)
+{
+  if (decl->rfu1 == NULL)
+    decl->rfu1 = GUINT_TO_POINTER (style_group_for_property (decl->property->stryng->str) + 1);
+
+  return GPOINTER_TO_UINT (decl->rfu1) - 1;
+}
+
+static void
+build_property_index (StThemeNode *node)
+{
+  int fill[ST_N_STYLE_GROUPS];
+  guint n_slots;
+  int i, g;
+
+  if (node->n_properties == 0)
+    return;
+
+  /* Counting sort of the declarations by style group, so that each
+   * computed value only visits the declarations that can affect it */
+  node->style_group_decls = g_new (int, node->n_properties);
+  memset (node->style_group_start, 0, sizeof (node->style_group_start));
+
+  for (i = 0; i < node->n_properties; i++)
+    node->style_group_start[declaration_style_group (node->properties[i]) + 1]++;
+
+  for (g = 0; g < ST_N_STYLE_GROUPS; g++)
+    {
+      node->style_group_start[g + 1] += node->style_group_start[g];
+      fill[g] = node->style_group_start[g];
+    }
+
+  for (i = 0; i < node->n_properties; i++)
+    node->style_group_decls[fill[declaration_style_group (node->properties[i])]++] = i;
+
+  n_slots = 8;
+  while (n_slots < 2 * (guint) node->n_properties)
+    n_slots *= 2;
+
+  node->property_slots_mask = n_slots - 1;
+  node->property_slots = g_new (int, n_slots);
+  node->property_prev = g_new (int, node->n_properties);
+  for (i = 0; i < (int) n_slots; i++)
+    node->property_slots[i] = -1;
+
+  /* Later declarations win, so each one replaces the previous entry
+   * for its property and links back to it */
+  for (i = 0; i < node->n_properties; i++)
+    {
+      GQuark id = declaration_property_id (node->properties[i]);
+      guint slot = id & node->property_slots_mask;
+      int j;
+
+      node->property_prev[i] = -1;
+
+      while ((j = node->property_slots[slot]) >= 0)
+        {
+          if (declaration_property_id (node->properties[j]) == id)
+            {
+              node->property_prev[i] = j;
+              break;
+            }
+          slot = (slot + 1) & node->property_slots_mask;
+        }
+
+      node->property_slots[slot] = i;
+    }
+}
+
+/* Takes the declarations matched from the stylesheets, appends the
+ * inline style and indexes the result */
+static void
+set_properties (StThemeNode *node,
+                GPtrArray   *properties)
+{
+  node->properties_computed = TRUE;
+  node->n_matched_properties = properties ? properties->len : 0;
+
+  if (node->inline_style)
+    {
+      CRDeclaration *cur_decl;
+
+      if (!properties)
+        properties = g_ptr_array_new ();
+
+      node->inline_properties = _st_theme_ref_declaration_list (node->inline_style);
+      for (cur_decl = node->inline_properties; cur_decl; cur_decl = cur_decl->next)
+        g_ptr_array_add (properties, cur_decl);
+    }
+
+  if (properties)
+    {
+      node->n_properties = properties->len;
+      node->properties = (CRDeclaration **)g_ptr_array_free (properties, FALSE);
+    }
+
+  build_property_index (node);
+}
+
 static void
 ensure_properties (StThemeNode *node)
 {
@@ -464,33 +745,157 @@ ensure_properties (StThemeNode *node)
     {
       GPtrArray *properties = NULL;
 
-      node->properties_computed = TRUE;
-
       if (node->theme)
         {
           properties = _st_theme_get_matched_properties (node->theme, node);
           if ((!properties || properties->len == 0) && node->important)
-            properties = _st_theme_get_matched_properties_fallback (node->theme, node);
+            {
+              if (properties)
+                g_ptr_array_free (properties, TRUE);
+              properties = _st_theme_get_matched_properties_fallback (node->theme, node);
+            }
         }
 
-      if (node->inline_style)
-        {
-          CRDeclaration *cur_decl;
+      set_properties (node, properties);
+    }
+}
 
-          if (!properties)
-            properties = g_ptr_array_new ();
+/* Whether a quark present in only one of @a and @b is required of an
+ * ancestor by some selector of @theme */
+static gboolean
+quark_change_matters (StTheme           *theme,
+                      StAncestorKeyKind  kind,
+                      const GQuark      *a,
+                      const GQuark      *b)
+{
+  const GQuark *it;
 
-          node->inline_properties = _st_theme_parse_declaration_list (node->inline_style);
-          for (cur_decl = node->inline_properties; cur_decl; cur_decl = cur_decl->next)
-            g_ptr_array_add (properties, cur_decl);
-        }
+  for (it = a; it && *it; it++)
+    {
+      if (!quark_in_array (*it, b) && _st_theme_has_ancestor_key (theme, kind, *it))
+        return TRUE;
+    }
+
+  for (it = b; it && *it; it++)
+    {
+      if (!quark_in_array (*it, a) && _st_theme_has_ancestor_key (theme, kind, *it))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Whether a node below @a matches the same rules of @theme as the
+ * same node below @b would: the two ancestor chains must have the same
+ * element types, and may only differ in ids, classes and pseudo-classes
+ * that no selector of @theme requires of an ancestor.
+ */
+static gboolean
+ancestors_match_alike (StTheme     *theme,
+                       StThemeNode *a,
+                       StThemeNode *b)
+{
+  while (a != b)
+    {
+      if (a == NULL || b == NULL)
+        return FALSE;
+
+      if (a->element_type != b->element_type)
+        return FALSE;
 
-      if (properties)
+      if (a->element_id_quark != b->element_id_quark)
         {
-          node->n_properties = properties->len;
-          node->properties = (CRDeclaration **)g_ptr_array_free (properties, FALSE);
+          if (a->element_id_quark != 0 &&
+              _st_theme_has_ancestor_key (theme, ST_ANCESTOR_KEY_ID, a->element_id_quark))
+            return FALSE;
+          if (b->element_id_quark != 0 &&
+              _st_theme_has_ancestor_key (theme, ST_ANCESTOR_KEY_ID, b->element_id_quark))
+            return FALSE;
         }
+
+      if (quark_change_matters (theme, ST_ANCESTOR_KEY_CLASS,
+                                a->element_class_quarks, b->element_class_quarks))
+        return FALSE;
+
+      if (quark_change_matters (theme, ST_ANCESTOR_KEY_PSEUDO_CLASS,
+                                a->pseudo_class_quarks, b->pseudo_class_quarks))
+        return FALSE;
+
+      a = a->parent_node;
+      b = b->parent_node;
+    }
+
+  return TRUE;
+}
+
+/**
+ * _st_theme_node_reuse_matched_properties:
+ * @node: a #StThemeNode whose properties have not been computed yet
+ * @old_node: the node previously used for the same actor
+ *
+ * When the state of an ancestor changes, every descendant gets a new
+ * node, but rules can only match it differently if some selector
+ * depends on the changed state in an ancestor position. If none does,
+ * @node takes the stylesheet declarations matched for @old_node instead
+ * of matching the stylesheets again. The same goes for a node created
+ * because only the inline style of its actor changed, since the inline
+ * style is not part of what is compared.
+ */
+void
+_st_theme_node_reuse_matched_properties (StThemeNode *node,
+                                         StThemeNode *old_node)
+{
+  GPtrArray *properties;
+  int i;
+
+  g_return_if_fail (ST_IS_THEME_NODE (node));
+  g_return_if_fail (ST_IS_THEME_NODE (old_node));
+
+  if (node == old_node || node->properties_computed || !old_node->properties_computed)
+    return;
+
+  if (node->theme == NULL ||
+      node->theme != old_node->theme ||
+      node->element_type != old_node->element_type ||
+      node->element_id_quark != old_node->element_id_quark ||
+      node->important != old_node->important ||
+      !quark_arrays_equal (node->element_class_quarks, old_node->element_class_quarks) ||
+      !quark_arrays_equal (node->pseudo_class_quarks, old_node->pseudo_class_quarks))
+    return;
+
+  if (!ancestors_match_alike (node->theme, node->parent_node, old_node->parent_node))
+    return;
+
+  properties = g_ptr_array_sized_new (old_node->n_matched_properties);
+  for (i = 0; i < old_node->n_matched_properties; i++)
+    g_ptr_array_add (properties, old_node->properties[i]);
+
+  set_properties (node, properties);
+}
+
+/* Returns the index in node->properties of the winning declaration of
+ * the property with the quark @id, or -1. Earlier declarations of the
+ * same property are reached through node->property_prev.
+ */
+static int
+find_property (StThemeNode *node,
+               GQuark       id)
+{
+  guint slot;
+  int i;
+
+  if (id == 0 || node->property_slots == NULL)
+    return -1;
+
+  for (slot = id & node->property_slots_mask;
+       (i = node->property_slots[slot]) >= 0;
+       slot = (slot + 1) & node->property_slots_mask)
+    {
+      if (declaration_property_id (node->properties[i]) == id)
+        return i;
     }
+
+  return -1;
 }
 
 typedef enum {
@@ -705,6 +1110,40 @@ get_color_from_term (StThemeNode  *node,
   return VALUE_FOUND;
 }
 
+static gboolean
+lookup_color_internal (StThemeNode  *node,
+                       GQuark        property_id,
+                       gboolean      inherit,
+                       ClutterColor *color)
+{
+  int i;
+
+  ensure_properties (node);
+
+  for (i = find_property (node, property_id); i >= 0; i = node->property_prev[i])
+    {
+      CRDeclaration *decl = node->properties[i];
+      GetFromTermResult result = get_color_from_term (node, decl->value, color);
+
+      if (result == VALUE_FOUND)
+        {
+          return TRUE;
+        }
+      else if (result == VALUE_INHERIT)
+        {
+          if (node->parent_node)
+            return lookup_color_internal (node->parent_node, property_id, inherit, color);
+          else
+            break;
+        }
+    }
+
+  if (inherit && node->parent_node)
+    return lookup_color_internal (node->parent_node, property_id, inherit, color);
+
+  return FALSE;
+}
+
 /**
  * st_theme_node_lookup_color:
  * @node: a #StThemeNode
@@ -734,36 +1173,7 @@ st_theme_node_lookup_color (StThemeNode  *node,
                             gboolean      inherit,
                             ClutterColor *color)
 {
-
-  int i;
-
-  ensure_properties (node);
-
-  for (i = node->n_properties - 1; i >= 0; i--)
-    {
-      CRDeclaration *decl = node->properties[i];
-
-      if (strcmp (decl->property->stryng->str, property_name) == 0)
-        {
-          GetFromTermResult result = get_color_from_term (node, decl->value, color);
-          if (result == VALUE_FOUND)
-            {
-              return TRUE;
-            }
-          else if (result == VALUE_INHERIT)
-            {
-              if (node->parent_node)
-                return st_theme_node_lookup_color (node->parent_node, property_name, inherit, color);
-              else
-                break;
-            }
-        }
-    }
-
-  if (inherit && node->parent_node)
-    return st_theme_node_lookup_color (node->parent_node, property_name, inherit, color);
-
-  return FALSE;
+  return lookup_color_internal (node, g_quark_try_string (property_name), inherit, color);
 }
 
 /**
@@ -797,6 +1207,35 @@ st_theme_node_get_color (StThemeNode  *node,
     }
 }
 
+static gboolean
+lookup_double_internal (StThemeNode *node,
+                        GQuark       property_id,
+                        gboolean     inherit,
+                        double      *value)
+{
+  gboolean result = FALSE;
+  int i;
+
+  ensure_properties (node);
+
+  for (i = find_property (node, property_id); i >= 0; i = node->property_prev[i])
+    {
+      CRTerm *term = node->properties[i]->value;
+
+      if (term->type != TERM_NUMBER || term->content.num->type != NUM_GENERIC)
+        continue;
+
+      *value = term->content.num->val;
+      result = TRUE;
+      break;
+    }
+
+  if (!result && inherit && node->parent_node)
+    result = lookup_double_internal (node->parent_node, property_id, inherit, value);
+
+  return result;
+}
+
 /**
  * st_theme_node_lookup_double:
  * @node: a #StThemeNode
@@ -824,32 +1263,7 @@ st_theme_node_lookup_double (StThemeNode *node,
                              gboolean     inherit,
                              double      *value)
 {
-  gboolean result = FALSE;
-  int i;
-
-  ensure_properties (node);
-
-  for (i = node->n_properties - 1; i >= 0; i--)
-    {
-      CRDeclaration *decl = node->properties[i];
-
-      if (strcmp (decl->property->stryng->str, property_name) == 0)
-        {
-          CRTerm *term = decl->value;
-
-          if (term->type != TERM_NUMBER || term->content.num->type != NUM_GENERIC)
-            continue;
-
-          *value = term->content.num->val;
-          result = TRUE;
-          break;
-        }
-    }
-
-  if (!result && inherit && node->parent_node)
-    result = st_theme_node_lookup_double (node->parent_node, property_name, inherit, value);
-
-  return result;
+  return lookup_double_internal (node, g_quark_try_string (property_name), inherit, value);
 }
 
 /**
@@ -1065,21 +1479,33 @@ get_length_internal (StThemeNode *node,
                      const char  *suffixed,
                      gdouble     *length)
 {
-  int i;
+  int i, j;
 
   ensure_properties (node);
 
-  for (i = node->n_properties - 1; i >= 0; i--)
+  /* Walk the declarations of both names together, latest first */
+  i = find_property (node, g_quark_try_string (property_name));
+  j = suffixed != NULL ? find_property (node, g_quark_try_string (suffixed)) : -1;
+
+  while (i >= 0 || j >= 0)
     {
-      CRDeclaration *decl = node->properties[i];
+      CRDeclaration *decl;
+      GetFromTermResult result;
 
-      if (strcmp (decl->property->stryng->str, property_name) == 0 ||
-          (suffixed != NULL && strcmp (decl->property->stryng->str, suffixed) == 0))
+      if (i > j)
         {
-          GetFromTermResult result = get_length_from_term (node, decl->value, FALSE, length);
-          if (result != VALUE_NOT_FOUND)
-            return result;
+          decl = node->properties[i];
+          i = node->property_prev[i];
         }
+      else
+        {
+          decl = node->properties[j];
+          j = node->property_prev[j];
+        }
+
+      result = get_length_from_term (node, decl->value, FALSE, length);
+      if (result != VALUE_NOT_FOUND)
+        return result;
     }
 
   return VALUE_NOT_FOUND;
@@ -1646,7 +2072,7 @@ do_size_property (StThemeNode   *node,
 void
 _st_theme_node_ensure_geometry (StThemeNode *node)
 {
-  int i, j;
+  int k, j;
 
   if (node->geometry_computed)
     return;
@@ -1671,9 +2097,11 @@ _st_theme_node_ensure_geometry (StThemeNode *node)
   node->max_width = -1;
   node->max_height = -1;
 
-  for (i = 0; i < node->n_properties; i++)
+  for (k = node->style_group_start[ST_STYLE_GROUP_GEOMETRY];
+       k < node->style_group_start[ST_STYLE_GROUP_GEOMETRY + 1];
+       k++)
     {
-      CRDeclaration *decl = node->properties[i];
+      CRDeclaration *decl = node->properties[node->style_group_decls[k]];
       const char *property_name = decl->property->stryng->str;
 
       if (g_str_has_prefix (property_name, "border"))
@@ -1850,7 +2278,7 @@ get_background_color_from_term (StThemeNode  *node,
 void
 _st_theme_node_ensure_background (StThemeNode *node)
 {
-  int i;
+  int k;
 
   if (node->background_computed)
     return;
@@ -1864,15 +2292,12 @@ _st_theme_node_ensure_background (StThemeNode *node)
 
   ensure_properties (node);
 
-  for (i = 0; i < node->n_properties; i++)
+  for (k = node->style_group_start[ST_STYLE_GROUP_BACKGROUND];
+       k < node->style_group_start[ST_STYLE_GROUP_BACKGROUND + 1];
+       k++)
     {
-      CRDeclaration *decl = node->properties[i];
-      const char *property_name = decl->property->stryng->str;
-
-      if (g_str_has_prefix (property_name, "background"))
-        property_name += 10;
-      else
-        continue;
+      CRDeclaration *decl = node->properties[node->style_group_decls[k]];
+      const char *property_name = decl->property->stryng->str + 10;
 
       if (strcmp (property_name, "") == 0)
         {
@@ -2195,18 +2620,17 @@ st_theme_node_get_foreground_color (StThemeNode  *node,
 
       ensure_properties (node);
 
-      for (i = node->n_properties - 1; i >= 0; i--)
+      for (i = find_property (node, g_quark_from_static_string ("color"));
+           i >= 0;
+           i = node->property_prev[i])
         {
           CRDeclaration *decl = node->properties[i];
+          GetFromTermResult result = get_color_from_term (node, decl->value, &node->foreground_color);
 
-          if (strcmp (decl->property->stryng->str, "color") == 0)
-            {
-              GetFromTermResult result = get_color_from_term (node, decl->value, &node->foreground_color);
-              if (result == VALUE_FOUND)
-                goto out;
-              else if (result == VALUE_INHERIT)
-                break;
-            }
+          if (result == VALUE_FOUND)
+            goto out;
+          else if (result == VALUE_INHERIT)
+            break;
         }
 
       if (node->parent_node)
@@ -2327,59 +2751,57 @@ st_theme_node_get_text_decoration (StThemeNode *node)
 
   ensure_properties (node);
 
-  for (i = node->n_properties - 1; i >= 0; i--)
+  for (i = find_property (node, g_quark_from_static_string ("text-decoration"));
+       i >= 0;
+       i = node->property_prev[i])
     {
       CRDeclaration *decl = node->properties[i];
+      CRTerm *term = decl->value;
+      StTextDecoration decoration = 0;
 
-      if (strcmp (decl->property->stryng->str, "text-decoration") == 0)
+      /* Specification is none | [ underline || overline || line-through || blink ] | inherit
+       *
+       * We're a bit more liberal, and for example treat 'underline none' as the same as
+       * none.
+       */
+      for (; term; term = term->next)
         {
-          CRTerm *term = decl->value;
-          StTextDecoration decoration = 0;
+          if (term->type != TERM_IDENT)
+            goto next_decl;
 
-          /* Specification is none | [ underline || overline || line-through || blink ] | inherit
-           *
-           * We're a bit more liberal, and for example treat 'underline none' as the same as
-           * none.
-           */
-          for (; term; term = term->next)
+          if (strcmp (term->content.str->stryng->str, "none") == 0)
             {
-              if (term->type != TERM_IDENT)
-                goto next_decl;
-
-              if (strcmp (term->content.str->stryng->str, "none") == 0)
-                {
-                  return 0;
-                }
-              else if (strcmp (term->content.str->stryng->str, "inherit") == 0)
-                {
-                  if (node->parent_node)
-                    return st_theme_node_get_text_decoration (node->parent_node);
-                }
-              else if (strcmp (term->content.str->stryng->str, "underline") == 0)
-                {
-                  decoration |= ST_TEXT_DECORATION_UNDERLINE;
-                }
-              else if (strcmp (term->content.str->stryng->str, "overline") == 0)
-                {
-                  decoration |= ST_TEXT_DECORATION_OVERLINE;
-                }
-              else if (strcmp (term->content.str->stryng->str, "line-through") == 0)
-                {
-                  decoration |= ST_TEXT_DECORATION_LINE_THROUGH;
-                }
-              else if (strcmp (term->content.str->stryng->str, "blink") == 0)
-                {
-                  decoration |= ST_TEXT_DECORATION_BLINK;
-                }
-              else
-                {
-                  goto next_decl;
-                }
+              return 0;
+            }
+          else if (strcmp (term->content.str->stryng->str, "inherit") == 0)
+            {
+              if (node->parent_node)
+                return st_theme_node_get_text_decoration (node->parent_node);
+            }
+          else if (strcmp (term->content.str->stryng->str, "underline") == 0)
+            {
+              decoration |= ST_TEXT_DECORATION_UNDERLINE;
+            }
+          else if (strcmp (term->content.str->stryng->str, "overline") == 0)
+            {
+              decoration |= ST_TEXT_DECORATION_OVERLINE;
+            }
+          else if (strcmp (term->content.str->stryng->str, "line-through") == 0)
+            {
+              decoration |= ST_TEXT_DECORATION_LINE_THROUGH;
+            }
+          else if (strcmp (term->content.str->stryng->str, "blink") == 0)
+            {
+              decoration |= ST_TEXT_DECORATION_BLINK;
+            }
+          else
+            {
+              goto next_decl;
             }
-
-          return decoration;
         }
 
+      return decoration;
+
     next_decl:
       ;
     }
@@ -2394,39 +2816,37 @@ st_theme_node_get_text_align(StThemeNode *node)
 
   ensure_properties(node);
 
-  for (i = node->n_properties - 1; i >= 0; i--)
+  for (i = find_property (node, g_quark_from_static_string ("text-align"));
+       i >= 0;
+       i = node->property_prev[i])
     {
       CRDeclaration *decl = node->properties[i];
+      CRTerm *term = decl->value;
 
-      if (strcmp(decl->property->stryng->str, "text-align") == 0)
-        {
-          CRTerm *term = decl->value;
-
-          if (term->type != TERM_IDENT || term->next)
-            continue;
+      if (term->type != TERM_IDENT || term->next)
+        continue;
 
-          if (strcmp(term->content.str->stryng->str, "inherit") == 0)
-            {
-              if (node->parent_node)
-                return st_theme_node_get_text_align(node->parent_node);
-              return ST_TEXT_ALIGN_LEFT;
-            }
-          else if (strcmp(term->content.str->stryng->str, "left") == 0)
-            {
-              return ST_TEXT_ALIGN_LEFT;
-            }
-          else if (strcmp(term->content.str->stryng->str, "right") == 0)
-            {
-              return ST_TEXT_ALIGN_RIGHT;
-            }
-          else if (strcmp(term->content.str->stryng->str, "center") == 0)
-            {
-              return ST_TEXT_ALIGN_CENTER;
-            }
-          else if (strcmp(term->content.str->stryng->str, "justify") == 0)
-            {
-              return ST_TEXT_ALIGN_JUSTIFY;
-            }
+      if (strcmp(term->content.str->stryng->str, "inherit") == 0)
+        {
+          if (node->parent_node)
+            return st_theme_node_get_text_align(node->parent_node);
+          return ST_TEXT_ALIGN_LEFT;
+        }
+      else if (strcmp(term->content.str->stryng->str, "left") == 0)
+        {
+          return ST_TEXT_ALIGN_LEFT;
+        }
+      else if (strcmp(term->content.str->stryng->str, "right") == 0)
+        {
+          return ST_TEXT_ALIGN_RIGHT;
+        }
+      else if (strcmp(term->content.str->stryng->str, "center") == 0)
+        {
+          return ST_TEXT_ALIGN_CENTER;
+        }
+      else if (strcmp(term->content.str->stryng->str, "justify") == 0)
+        {
+          return ST_TEXT_ALIGN_JUSTIFY;
         }
     }
   if(node->parent_node)
@@ -2714,7 +3134,7 @@ st_theme_node_get_font (StThemeNode *node)
   gboolean size_set = FALSE;
   char *family = NULL;
   double parent_size;
-  int i;
+  int k;
 
   resolution = clutter_backend_get_resolution (clutter_get_default_backend ());
 
@@ -2727,9 +3147,11 @@ st_theme_node_get_font (StThemeNode *node)
 
   ensure_properties (node);
 
-  for (i = 0; i < node->n_properties; i++)
+  for (k = node->style_group_start[ST_STYLE_GROUP_FONT];
+       k < node->style_group_start[ST_STYLE_GROUP_FONT + 1];
+       k++)
     {
-      CRDeclaration *decl = node->properties[i];
+      CRDeclaration *decl = node->properties[node->style_group_decls[k]];
 
       if (strcmp (decl->property->stryng->str, "font") == 0)
         {
@@ -2915,122 +3337,120 @@ st_theme_node_get_border_image (StThemeNode *node)
 
   ensure_properties (node);
 
-  for (i = node->n_properties - 1; i >= 0; i--)
+  for (i = find_property (node, g_quark_from_static_string ("border-image"));
+       i >= 0;
+       i = node->property_prev[i])
     {
       CRDeclaration *decl = node->properties[i];
-
-      if (strcmp (decl->property->stryng->str, "border-image") == 0)
+      CRTerm *term = decl->value;
+      CRStyleSheet *base_stylesheet;
+      int borders[4];
+      int n_borders = 0;
+      int j;
+
+      const char *url;
+      int border_top;
+      int border_right;
+      int border_bottom;
+      int border_left;
+
+      GFile *file;
+      char *filename = NULL;
+
+      /* Support border-image: none; to suppress a previously specified border image */
+      if (term_is_none (term))
         {
-          CRTerm *term = decl->value;
-          CRStyleSheet *base_stylesheet;
-          int borders[4];
-          int n_borders = 0;
-          int j;
-
-          const char *url;
-          int border_top;
-          int border_right;
-          int border_bottom;
-          int border_left;
-
-          GFile *file;
-          char *filename = NULL;
-
-          /* Support border-image: none; to suppress a previously specified border image */
-          if (term_is_none (term))
-            {
-              if (term->next == NULL)
-                return NULL;
-              else
-                goto next_property;
-            }
-
-          /* First term must be the URL to the image */
-          if (term->type != TERM_URI)
+          if (term->next == NULL)
+            return NULL;
+          else
             goto next_property;
+        }
 
-          url = term->content.str->stryng->str;
+      /* First term must be the URL to the image */
+      if (term->type != TERM_URI)
+        goto next_property;
 
-          term = term->next;
+      url = term->content.str->stryng->str;
 
-          /* Followed by 0 to 4 numbers or percentages. *Not lengths*. The interpretation
-           * of a number is supposed to be pixels if the image is pixel based, otherwise CSS pixels.
-           */
-          for (j = 0; j < 4; j++)
-            {
-              if (term == NULL)
-                break;
+      term = term->next;
 
-              if (term->type != TERM_NUMBER)
-                goto next_property;
+      /* Followed by 0 to 4 numbers or percentages. *Not lengths*. The interpretation
+       * of a number is supposed to be pixels if the image is pixel based, otherwise CSS pixels.
+       */
+      for (j = 0; j < 4; j++)
+        {
+          if (term == NULL)
+            break;
 
-              if (term->content.num->type == NUM_GENERIC)
-                {
+          if (term->type != TERM_NUMBER)
+            goto next_property;
 
-                  borders[n_borders] = (int)(0.5 + term->content.num->val) * scale_factor;
-                  n_borders++;
-                }
-              else if (term->content.num->type == NUM_PERCENTAGE)
-                {
-                  /* This would be easiest to support if we moved image handling into StBorderImage */
-                  g_warning ("Percentages not supported for border-image");
-                  goto next_property;
-                }
-              else
-                goto next_property;
+          if (term->content.num->type == NUM_GENERIC)
+            {
 
-              term = term->next;
+              borders[n_borders] = (int)(0.5 + term->content.num->val) * scale_factor;
+              n_borders++;
             }
-
-          switch (n_borders)
+          else if (term->content.num->type == NUM_PERCENTAGE)
             {
-            case 0:
-              border_top = border_right = border_bottom = border_left = 0;
-              break;
-            case 1:
-              border_top = border_right = border_bottom = border_left = borders[0];
-              break;
-            case 2:
-              border_top = border_bottom = borders[0];
-              border_left = border_right = borders[1];
-              break;
-            case 3:
-              border_top = borders[0];
-              border_left = border_right = borders[1];
-              border_bottom = borders[2];
-              break;
-            case 4:
-            default:
-              border_top = borders[0];
-              border_right = borders[1];
-              border_bottom = borders[2];
-              border_left = borders[3];
-              break;
+              /* This would be easiest to support if we moved image handling into StBorderImage */
+              g_warning ("Percentages not supported for border-image");
+              goto next_property;
             }
-
-          if (decl->parent_statement != NULL)
-            base_stylesheet = decl->parent_statement->parent_sheet;
           else
-            base_stylesheet = NULL;
-
-          file = _st_theme_resolve_url (node->theme, base_stylesheet, url);
-          if (file)
-            {
-              filename = g_file_get_path (file);
-              g_object_unref (file);
-            }
-
-          if (filename == NULL)
             goto next_property;
 
-          node->border_image = st_border_image_new (filename,
-                                                    border_top, border_right, border_bottom, border_left);
+          term = term->next;
+        }
+
+      switch (n_borders)
+        {
+        case 0:
+          border_top = border_right = border_bottom = border_left = 0;
+          break;
+        case 1:
+          border_top = border_right = border_bottom = border_left = borders[0];
+          break;
+        case 2:
+          border_top = border_bottom = borders[0];
+          border_left = border_right = borders[1];
+          break;
+        case 3:
+          border_top = borders[0];
+          border_left = border_right = borders[1];
+          border_bottom = borders[2];
+          break;
+        case 4:
+        default:
+          border_top = borders[0];
+          border_right = borders[1];
+          border_bottom = borders[2];
+          border_left = borders[3];
+          break;
+        }
 
-          g_free (filename);
+      if (decl->parent_statement != NULL)
+        base_stylesheet = decl->parent_statement->parent_sheet;
+      else
+        base_stylesheet = NULL;
 
-          return node->border_image;
+      file = _st_theme_resolve_url (node->theme, base_stylesheet, url);
+      if (file)
+        {
+          filename = g_file_get_path (file);
+          g_object_unref (file);
         }
 
+      if (filename == NULL)
+        goto next_property;
+
+      node->border_image = st_border_image_new (filename,
+                                                border_top, border_right, border_bottom, border_left);
+
+      g_free (filename);
+
+      return node->border_image;
+
     next_property:
       ;
     }
@@ -3250,41 +3670,39 @@ st_theme_node_lookup_shadow (StThemeNode  *node,
 
   ensure_properties (node);
 
-  for (i = node->n_properties - 1; i >= 0; i--)
+  for (i = find_property (node, g_quark_try_string (property_name));
+       i >= 0;
+       i = node->property_prev[i])
     {
       CRDeclaration *decl = node->properties[i];
-
-      if (strcmp (decl->property->stryng->str, property_name) == 0)
-        {
-          GetFromTermResult result = parse_shadow_property (node,
-                                                            decl,
-                                                            &color,
-                                                            &xoffset,
-                                                            &yoffset,
-                                                            &blur,
-                                                            &spread,
-                                                            &inset,
-                                                            &is_none);
-          if (result == VALUE_FOUND)
-            {
-              if (is_none)
-                return FALSE;
-              *shadow = st_shadow_new (&color,
-                                       xoffset, yoffset,
-                                       blur, spread,
-                                       inset);
-              return TRUE;
-            }
-          else if (result == VALUE_INHERIT)
-            {
-              if (node->parent_node)
-                return st_theme_node_lookup_shadow (node->parent_node,
-                                                    property_name,
-                                                    inherit,
-                                                    shadow);
-              else
-                break;
-            }
+      GetFromTermResult result = parse_shadow_property (node,
+                                                        decl,
+                                                        &color,
+                                                        &xoffset,
+                                                        &yoffset,
+                                                        &blur,
+                                                        &spread,
+                                                        &inset,
+                                                        &is_none);
+      if (result == VALUE_FOUND)
+        {
+          if (is_none)
+            return FALSE;
+          *shadow = st_shadow_new (&color,
+                                   xoffset, yoffset,
+                                   blur, spread,
+                                   inset);
+          return TRUE;
+        }
+      else if (result == VALUE_INHERIT)
+        {
+          if (node->parent_node)
+            return st_theme_node_lookup_shadow (node->parent_node,
+                                                property_name,
+                                                inherit,
+                                                shadow);
+          else
+            break;
         }
     }
 
@@ -3471,7 +3889,7 @@ st_theme_node_get_icon_colors (StThemeNode *node)
   };
 
   gboolean shared_with_parent;
-  int i;
+  int k;
   ClutterColor color = { 0, };
 
   guint still_need;
@@ -3500,9 +3918,11 @@ st_theme_node_get_icon_colors (StThemeNode *node)
 
   ensure_properties (node);
 
-  for (i = node->n_properties - 1; i >= 0 && still_need != 0; i--)
+  for (k = node->style_group_start[ST_STYLE_GROUP_ICON_COLORS + 1] - 1;
+       k >= node->style_group_start[ST_STYLE_GROUP_ICON_COLORS] && still_need != 0;
+       k--)
     {
-      CRDeclaration *decl = node->properties[i];
+      CRDeclaration *decl = node->properties[node->style_group_decls[k]];
       GetFromTermResult result = VALUE_NOT_FOUND;
       guint found = 0;
 
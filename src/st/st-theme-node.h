@@ -253,6 +253,18 @@ void st_theme_node_paint (StThemeNode            *node,
 void st_theme_node_copy_cached_paint_state (StThemeNode *node,
                                             StThemeNode *other);
 
+void st_theme_node_get_background_cache_statistics (guint *n_entries,
+                                                    gsize *bytes,
+                                                    guint *n_hits,
+                                                    guint *n_misses,
+                                                    guint *n_evictions);
+
+void st_theme_node_get_transition_statistics (guint *n_active,
+                                              guint *n_created,
+                                              guint *n_buffers_in_use,
+                                              guint *n_buffers_pooled,
+                                              gsize *pooled_bytes);
+
 G_END_DECLS
 
 #endif /* __ST_THEME_NODE_H__ */
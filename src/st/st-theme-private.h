@@ -23,6 +23,7 @@
 
 #include "croco/libcroco.h"
 #include "st-theme.h"
+#include "st-theme-node-private.h"
 
 G_BEGIN_DECLS
 
@@ -39,6 +40,17 @@ GFile *_st_theme_resolve_url (StTheme      *theme,
 
 CRDeclaration *_st_theme_parse_declaration_list (const char *str);
 
+CRDeclaration *_st_theme_ref_declaration_list   (const char *str);
+void           _st_theme_unref_declaration_list (const char *str);
+
+gboolean _st_theme_stylesheet_may_match (StTheme      *theme,
+                                         CRStyleSheet *stylesheet,
+                                         StThemeNode  *node);
+
+gboolean _st_theme_has_ancestor_key (StTheme           *theme,
+                                     StAncestorKeyKind  kind,
+                                     GQuark             quark);
+
 G_END_DECLS
 
 #endif /* __ST_THEME_PRIVATE_H__ */
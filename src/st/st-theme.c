@@ -42,9 +42,12 @@
 
 #include <gio/gio.h>
 
-#include "st-theme-node.h"
+#include "st-stylesheet-cache.h"
+#include "st-theme-node-private.h"
 #include "st-theme-private.h"
 
+typedef struct _RuleIndex RuleIndex;
+
 static GObject *st_theme_constructor (GType                  type,
                                       guint                  n_construct_properties,
                                       GObjectConstructParam *construct_properties);
@@ -76,6 +79,11 @@ struct _StTheme
 
   CRCascade *cascade;
   CRStyleSheet *fallback_cr_stylesheet;
+
+  /* CRStyleSheet => RuleIndex, built the first time a sheet is matched */
+  GHashTable *rule_indexes;
+  /* GType => GArray of the element name quarks a node of that type matches */
+  GHashTable *type_names;
 };
 
 struct _StThemeClass
@@ -94,17 +102,18 @@ enum
 
 enum
 {
+  STYLESHEET_CHANGED,
   STYLESHEETS_CHANGED,
   LAST_SIGNAL
 };
 
 static guint signals[LAST_SIGNAL] = { 0, };
 
+static GQuark stage_quark;
+
 G_DEFINE_TYPE (StTheme, st_theme, G_TYPE_OBJECT)
 
-/* Quick strcmp.  Test only for == 0 or != 0, not < 0 or > 0.  */
-#define strqcmp(str,lit,lit_len) \
-  (strlen (str) != (lit_len) || memcmp (str, lit, lit_len))
+static void rule_index_free (RuleIndex *index);
 
 static void
 st_theme_init (StTheme *theme)
@@ -112,6 +121,10 @@ st_theme_init (StTheme *theme)
   theme->stylesheets_by_filename = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                           (GDestroyNotify)g_free, (GDestroyNotify)cr_stylesheet_unref);
   theme->filenames_by_stylesheet = g_hash_table_new (g_direct_hash, g_direct_equal);
+  theme->rule_indexes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                               NULL, (GDestroyNotify)rule_index_free);
+  theme->type_names = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, (GDestroyNotify)g_array_unref);
 }
 
 static void
@@ -180,12 +193,25 @@ st_theme_class_init (StThemeClass *klass)
                                                         NULL,
                                                         G_PARAM_READABLE | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
 
+  stage_quark = g_quark_from_static_string ("stage");
+
   signals[STYLESHEETS_CHANGED] = g_signal_new ("custom-stylesheets-changed",
                                                G_TYPE_FROM_CLASS (klass),
                                                G_SIGNAL_RUN_LAST,
                                                0, /* no default handler slot */
                                                NULL, NULL, NULL,
                                                G_TYPE_NONE, 0);
+
+  /* Emitted with the CRStyleSheet that was just loaded or unloaded,
+   * before ::custom-stylesheets-changed, so that theme nodes and
+   * contexts can invalidate only what the stylesheet may match.
+   */
+  signals[STYLESHEET_CHANGED] = g_signal_new ("stylesheet-changed",
+                                              G_TYPE_FROM_CLASS (klass),
+                                              G_SIGNAL_RUN_LAST,
+                                              0, /* no default handler slot */
+                                              NULL, NULL, NULL,
+                                              G_TYPE_NONE, 1, G_TYPE_POINTER);
 }
 
 static CRStyleSheet *
@@ -194,10 +220,23 @@ parse_stylesheet (const char  *filename,
 {
   enum CRStatus status;
   CRStyleSheet *stylesheet;
+  GStatBuf stat_buf;
+  gboolean have_stat;
 
   if (filename == NULL)
     return NULL;
 
+  /* Stat before parsing, so that a file changing under us can't leave
+   * its old contents cached under the new modification time. */
+  have_stat = g_stat (filename, &stat_buf) == 0;
+
+  if (have_stat)
+    {
+      stylesheet = _st_stylesheet_cache_load (filename, &stat_buf);
+      if (stylesheet != NULL)
+        return stylesheet;
+    }
+
   status = cr_om_parser_simply_parse_file ((const guchar *) filename,
                                            CR_UTF_8,
                                            &stylesheet);
@@ -209,6 +248,9 @@ parse_stylesheet (const char  *filename,
       return NULL;
     }
 
+  if (have_stat)
+    _st_stylesheet_cache_store (filename, &stat_buf, stylesheet);
+
   return stylesheet;
 }
 
@@ -219,6 +261,75 @@ _st_theme_parse_declaration_list (const char *str)
                                              CR_UTF_8);
 }
 
+/* Inline styles are usually set to the same few strings over and over
+ * (for example on every frame of an animation, or on each item of a
+ * list), so parsed declaration lists are shared between nodes with the
+ * same inline style and kept until the last of them is gone.
+ */
+typedef struct {
+  CRDeclaration *declarations;
+  guint          ref_count;
+} InlineStyle;
+
+static GHashTable *inline_styles = NULL;
+
+static void
+inline_style_free (gpointer data)
+{
+  InlineStyle *style = data;
+
+  /* This destroys the list, not just the head of the list */
+  if (style->declarations)
+    cr_declaration_destroy (style->declarations);
+
+  g_slice_free (InlineStyle, style);
+}
+
+/**
+ * _st_theme_ref_declaration_list:
+ * @str: an inline style
+ *
+ * Parses @str as a list of declarations, or returns the list already
+ * parsed for an identical string. Each call must be balanced by a call
+ * to _st_theme_unref_declaration_list() with the same string.
+ *
+ * Return value: (transfer none): the declarations, or %NULL
+ */
+CRDeclaration *
+_st_theme_ref_declaration_list (const char *str)
+{
+  InlineStyle *style;
+
+  if (G_UNLIKELY (inline_styles == NULL))
+    inline_styles = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, inline_style_free);
+
+  style = g_hash_table_lookup (inline_styles, str);
+  if (style == NULL)
+    {
+      style = g_slice_new (InlineStyle);
+      style->declarations = _st_theme_parse_declaration_list (str);
+      style->ref_count = 0;
+      g_hash_table_insert (inline_styles, g_strdup (str), style);
+    }
+
+  style->ref_count++;
+
+  return style->declarations;
+}
+
+void
+_st_theme_unref_declaration_list (const char *str)
+{
+  InlineStyle *style;
+
+  style = inline_styles ? g_hash_table_lookup (inline_styles, str) : NULL;
+  g_return_if_fail (style != NULL);
+
+  if (--style->ref_count == 0)
+    g_hash_table_remove (inline_styles, str);
+}
+
 /* Just g_warning for now until we have something nicer to do */
 static CRStyleSheet *
 parse_stylesheet_nofail (const char *filename)
@@ -235,40 +346,363 @@ parse_stylesheet_nofail (const char *filename)
   return result;
 }
 
-static void
+/* Registers @stylesheet as the one loaded from @filename, unless one
+ * already is: import rules point to stylesheets without holding a
+ * reference, so a registered stylesheet must never be replaced. Returns
+ * the stylesheet registered for @filename.
+ */
+static CRStyleSheet *
 insert_stylesheet (StTheme      *theme,
                    const char   *filename,
                    CRStyleSheet *stylesheet)
 {
+  CRStyleSheet *existing;
   char *filename_copy;
 
   if (stylesheet == NULL)
-    return;
+    return NULL;
+
+  existing = g_hash_table_lookup (theme->stylesheets_by_filename, filename);
+  if (existing)
+    return existing;
 
   filename_copy = g_strdup(filename);
   cr_stylesheet_ref (stylesheet);
 
   g_hash_table_insert (theme->stylesheets_by_filename, filename_copy, stylesheet);
   g_hash_table_insert (theme->filenames_by_stylesheet, stylesheet, filename_copy);
+
+  return stylesheet;
 }
 
-gboolean
-st_theme_load_stylesheet (StTheme    *theme,
-                          const char *path,
-                          GError    **error)
+/* Upper bound on the nesting of @import rules, which also keeps
+ * stylesheets that import each other from being loaded forever */
+#define MAX_IMPORT_DEPTH 16
+
+typedef struct {
+  char           *filename;
+  CRStyleSheet   *stylesheet;   /* NULL once inserted into the theme */
+  CRAtImportRule *import_rule;  /* the rule importing it */
+} ImportedStylesheet;
+
+/* A custom stylesheet and the stylesheets it imports, parsed without
+ * touching the theme so that it can be done from a worker thread, then
+ * committed to the theme on the main thread.
+ */
+typedef struct {
+  char         *path;
+  CRStyleSheet *stylesheet;   /* NULL once committed */
+  GPtrArray    *imports;      /* of ImportedStylesheet */
+} StylesheetLoad;
+
+static GFile *resolve_url_relative_to (const char *base_filename,
+                                       const char *url);
+
+static void
+imported_stylesheet_free (gpointer data)
 {
-  CRStyleSheet *stylesheet;
+  ImportedStylesheet *imported = data;
 
-  stylesheet = parse_stylesheet_nofail (path);
-  if (!stylesheet)
+  /* refcount of stylesheets starts off at zero, so this frees it */
+  if (imported->stylesheet)
+    cr_stylesheet_unref (imported->stylesheet);
+
+  g_free (imported->filename);
+  g_slice_free (ImportedStylesheet, imported);
+}
+
+static StylesheetLoad *
+stylesheet_load_new (const char *path)
+{
+  StylesheetLoad *load = g_slice_new0 (StylesheetLoad);
+
+  load->path = g_strdup (path);
+  load->imports = g_ptr_array_new_with_free_func (imported_stylesheet_free);
+
+  return load;
+}
+
+static void
+stylesheet_load_free (gpointer data)
+{
+  StylesheetLoad *load = data;
+
+  /* The imported stylesheets are only pointed to by the import rules
+   * of the others, so they can go in any order */
+  g_ptr_array_unref (load->imports);
+  if (load->stylesheet)
+    cr_stylesheet_unref (load->stylesheet);
+
+  g_free (load->path);
+  g_slice_free (StylesheetLoad, load);
+}
+
+/* Parses the stylesheets @stylesheet (loaded from @filename) imports,
+ * instead of leaving that to the first match against it. Stylesheets
+ * that can't be loaded get the same marker add_imported_properties()
+ * would have set.
+ */
+static gboolean
+stylesheet_load_parse_imports (StylesheetLoad  *load,
+                               const char      *filename,
+                               CRStyleSheet    *stylesheet,
+                               guint            depth,
+                               GCancellable    *cancellable,
+                               GError         **error)
+{
+  CRStatement *cur_stmt;
+
+  for (cur_stmt = stylesheet->statements; cur_stmt; cur_stmt = cur_stmt->next)
+    {
+      CRAtImportRule *import_rule;
+      ImportedStylesheet *imported;
+      GFile *file = NULL;
+      char *imported_filename = NULL;
+      CRStyleSheet *imported_stylesheet = NULL;
+
+      if (cur_stmt->type != AT_IMPORT_RULE_STMT || cur_stmt->kind.import_rule == NULL)
+        continue;
+
+      import_rule = cur_stmt->kind.import_rule;
+      if (import_rule->sheet != NULL)
+        continue;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      if (depth < MAX_IMPORT_DEPTH &&
+          import_rule->url->stryng && import_rule->url->stryng->str)
+        file = resolve_url_relative_to (filename, import_rule->url->stryng->str);
+
+      if (file)
+        {
+          imported_filename = g_file_get_path (file);
+          g_object_unref (file);
+        }
+
+      if (imported_filename)
+        imported_stylesheet = parse_stylesheet (imported_filename, NULL);
+
+      if (imported_stylesheet == NULL)
+        {
+          import_rule->sheet = (CRStyleSheet *) - 1;
+          g_free (imported_filename);
+          continue;
+        }
+
+      import_rule->sheet = imported_stylesheet;
+
+      imported = g_slice_new (ImportedStylesheet);
+      imported->filename = imported_filename;
+      imported->stylesheet = imported_stylesheet;
+      imported->import_rule = import_rule;
+      g_ptr_array_add (load->imports, imported);
+
+      if (!stylesheet_load_parse_imports (load, imported_filename, imported_stylesheet,
+                                          depth + 1, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Safe to call from any thread */
+static gboolean
+stylesheet_load_parse (StylesheetLoad  *load,
+                       GCancellable    *cancellable,
+                       GError         **error)
+{
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
 
-  insert_stylesheet (theme, path, stylesheet);
+  load->stylesheet = parse_stylesheet (load->path, error);
+  if (load->stylesheet == NULL)
+    return FALSE;
+
+  return stylesheet_load_parse_imports (load, load->path, load->stylesheet,
+                                        0, cancellable, error);
+}
+
+static void
+stylesheet_load_commit (StTheme        *theme,
+                        StylesheetLoad *load)
+{
+  CRStyleSheet *stylesheet;
+  guint i;
+
+  /* Files that are already loaded, by the theme or as imports of other
+   * stylesheets, are shared rather than replaced; the copies parsed
+   * here are freed along with the load. Imports are in the order they
+   * were found, so an import rule is always repointed before the copy
+   * of the stylesheet containing it is dropped.
+   */
+  for (i = 0; i < load->imports->len; i++)
+    {
+      ImportedStylesheet *imported = load->imports->pdata[i];
+      CRStyleSheet *registered;
+
+      registered = insert_stylesheet (theme, imported->filename, imported->stylesheet);
+      if (registered == imported->stylesheet)
+        imported->stylesheet = NULL;
+      else
+        imported->import_rule->sheet = registered;
+    }
+
+  stylesheet = insert_stylesheet (theme, load->path, load->stylesheet);
+  if (stylesheet == load->stylesheet)
+    load->stylesheet = NULL;
+
+  if (g_slist_find (theme->custom_stylesheets, stylesheet))
+    return;
+
   cr_stylesheet_ref (stylesheet);
   theme->custom_stylesheets = g_slist_prepend (theme->custom_stylesheets, stylesheet);
+  g_signal_emit (theme, signals[STYLESHEET_CHANGED], 0, stylesheet);
   g_signal_emit (theme, signals[STYLESHEETS_CHANGED], 0);
+}
 
-  return TRUE;
+gboolean
+st_theme_load_stylesheet (StTheme    *theme,
+                          const char *path,
+                          GError    **error)
+{
+  StylesheetLoad *load;
+  GError *parse_error = NULL;
+  gboolean loaded;
+
+  load = stylesheet_load_new (path);
+  loaded = stylesheet_load_parse (load, NULL, &parse_error);
+
+  /* Just g_warning for now, like parse_stylesheet_nofail() */
+  if (loaded)
+    stylesheet_load_commit (theme, load);
+  else if (parse_error)
+    {
+      g_warning ("%s", parse_error->message);
+      g_clear_error (&parse_error);
+    }
+
+  stylesheet_load_free (load);
+
+  return loaded;
+}
+
+static void
+load_stylesheet_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  StylesheetLoad *load = task_data;
+  GError *error = NULL;
+
+  if (stylesheet_load_parse (load, cancellable, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+on_stylesheet_parsed (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  StTheme *theme = ST_THEME (source_object);
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    g_task_return_error (task, error);
+  else if (!g_task_return_error_if_cancelled (task))
+    {
+      stylesheet_load_commit (theme, g_task_get_task_data (G_TASK (result)));
+      g_task_return_boolean (task, TRUE);
+    }
+
+  g_object_unref (task);
+}
+
+/**
+ * st_theme_load_stylesheet_async:
+ * @theme: a #StTheme
+ * @path: the path of the stylesheet
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (scope async): called once the stylesheet is loaded
+ * @user_data: data for @callback
+ *
+ * Like st_theme_load_stylesheet(), but the stylesheet and the ones it
+ * imports are read and parsed in a worker thread. The stylesheet is
+ * added to @theme, from the main thread, just before @callback is
+ * called; loads that run at the same time are added in the order
+ * they finish. If @cancellable is cancelled before then, @theme is
+ * left untouched.
+ */
+void
+st_theme_load_stylesheet_async (StTheme             *theme,
+                                const char          *path,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GTask *task, *parse_task;
+
+  g_return_if_fail (ST_IS_THEME (theme));
+  g_return_if_fail (path != NULL);
+
+  task = g_task_new (theme, cancellable, callback, user_data);
+  g_task_set_source_tag (task, st_theme_load_stylesheet_async);
+
+  parse_task = g_task_new (theme, cancellable, on_stylesheet_parsed, task);
+  g_task_set_task_data (parse_task, stylesheet_load_new (path), stylesheet_load_free);
+  g_task_run_in_thread (parse_task, load_stylesheet_thread);
+  g_object_unref (parse_task);
+}
+
+/**
+ * st_theme_load_stylesheet_finish:
+ * @theme: a #StTheme
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Finishes a load started with st_theme_load_stylesheet_async().
+ *
+ * Returns: %TRUE if the stylesheet was added to @theme
+ */
+gboolean
+st_theme_load_stylesheet_finish (StTheme       *theme,
+                                 GAsyncResult  *result,
+                                 GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, theme), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Whether an import rule of another registered stylesheet points to
+ * @stylesheet, which then has to stay registered */
+static gboolean
+stylesheet_is_imported (StTheme      *theme,
+                        CRStyleSheet *stylesheet)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, theme->stylesheets_by_filename);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      CRStyleSheet *importer = value;
+      CRStatement *cur_stmt;
+
+      for (cur_stmt = importer->statements; cur_stmt; cur_stmt = cur_stmt->next)
+        {
+          if (cur_stmt->type == AT_IMPORT_RULE_STMT &&
+              cur_stmt->kind.import_rule != NULL &&
+              cur_stmt->kind.import_rule->sheet == stylesheet)
+            return TRUE;
+        }
+    }
+
+  return FALSE;
 }
 
 void
@@ -285,8 +719,16 @@ st_theme_unload_stylesheet (StTheme    *theme,
     return;
 
   theme->custom_stylesheets = g_slist_remove (theme->custom_stylesheets, stylesheet);
-  g_hash_table_remove (theme->stylesheets_by_filename, path);
-  g_hash_table_remove (theme->filenames_by_stylesheet, stylesheet);
+
+  /* The rule index is still needed to find what the stylesheet matched */
+  g_signal_emit (theme, signals[STYLESHEET_CHANGED], 0, stylesheet);
+
+  if (!stylesheet_is_imported (theme, stylesheet))
+    {
+      g_hash_table_remove (theme->rule_indexes, stylesheet);
+      g_hash_table_remove (theme->filenames_by_stylesheet, stylesheet);
+      g_hash_table_remove (theme->stylesheets_by_filename, path);
+    }
   cr_stylesheet_unref (stylesheet);
   g_signal_emit (theme, signals[STYLESHEETS_CHANGED], 0);
 }
@@ -360,6 +802,10 @@ st_theme_finalize (GObject * object)
   g_slist_free (theme->custom_stylesheets);
   theme->custom_stylesheets = NULL;
 
+  /* Indexes point into the stylesheets, so drop them first */
+  g_hash_table_destroy (theme->rule_indexes);
+  g_hash_table_destroy (theme->type_names);
+
   g_hash_table_destroy (theme->stylesheets_by_filename);
   g_hash_table_destroy (theme->filenames_by_stylesheet);
 
@@ -494,450 +940,593 @@ st_theme_new (const char       *application_stylesheet,
   return theme;
 }
 
-static gboolean
-string_in_list (GString    *stryng,
-                GStrv       list)
-{
-  gchar **it;
-
-  if (list == NULL)
-    return FALSE;
-
-  for (it = list; *it != NULL; it++)
-    {
-      if (!strqcmp (*it, stryng->str, stryng->len))
-        return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-pseudo_class_add_sel_matches_style (StTheme         *a_this,
-                                    CRAdditionalSel *a_add_sel,
-                                    StThemeNode     *a_node)
-{
-  GStrv node_pseudo_classes;
-
-  g_return_val_if_fail (a_this
-                        && a_add_sel
-                        && a_add_sel->content.pseudo
-                        && a_add_sel->content.pseudo->name
-                        && a_add_sel->content.pseudo->name->stryng
-                        && a_add_sel->content.pseudo->name->stryng->str
-                        && a_node, FALSE);
-
-  node_pseudo_classes = st_theme_node_get_pseudo_classes (a_node);
-
-  return string_in_list (a_add_sel->content.pseudo->name->stryng,
-                         node_pseudo_classes);
-}
-
 /*
- *@param a_add_sel the class additional selector to consider.
- *@param a_node the style node to consider.
- *@return TRUE if the class additional selector matches
- *the style node given in argument, FALSE otherwise.
+ * Selectors are compiled when a stylesheet is indexed into an array of
+ * CompiledSel, one for each simple selector of the combinator separated
+ * list. Element names, ids, classes and pseudo-classes are interned as
+ * quarks, so matching a node only compares them against the quarks the
+ * node keeps for its own id, classes and pseudo-classes.
  */
-static gboolean
-class_add_sel_matches_style (CRAdditionalSel *a_add_sel,
-                             StThemeNode     *a_node)
+typedef struct {
+  GQuark           element_name;   /* 0 if any element matches */
+  GType            element_type;   /* resolved from element_name when first needed */
+  GQuark           id;             /* 0 if none */
+  GQuark          *classes;        /* 0-terminated, or NULL */
+  GQuark          *pseudo_classes; /* 0-terminated, or NULL */
+  enum Combinator  combinator;     /* separates this from the previous one */
+  guint            never_matches : 1;
+} CompiledSel;
+
+static GQuark *
+quark_array_free (GArray *array)
 {
-  GStrv element_classes;
-
-  g_return_val_if_fail (a_add_sel
-                        && a_add_sel->type == CLASS_ADD_SELECTOR
-                        && a_add_sel->content.class_name
-                        && a_add_sel->content.class_name->stryng
-                        && a_add_sel->content.class_name->stryng->str
-                        && a_node, FALSE);
-
-  element_classes = st_theme_node_get_element_classes (a_node);
+  if (array == NULL)
+    return NULL;
 
-  return string_in_list (a_add_sel->content.class_name->stryng,
-                         element_classes);
+  return (GQuark *) g_array_free (array, FALSE);
 }
 
-/*
- *@return TRUE if the additional attribute selector matches
- *the current style node given in argument, FALSE otherwise.
- *@param a_add_sel the additional attribute selector to consider.
- *@param a_node the style node to consider.
- */
-static gboolean
-id_add_sel_matches_style (CRAdditionalSel *a_add_sel,
-                          StThemeNode     *a_node)
+static void
+compile_simple_sel (CRSimpleSel *simple_sel,
+                    CompiledSel *compiled)
 {
-  gboolean result = FALSE;
-  const char *id;
+  CRAdditionalSel *cur_add_sel;
+  GArray *classes = NULL;
+  GArray *pseudo_classes = NULL;
 
-  g_return_val_if_fail (a_add_sel
-                        && a_add_sel->type == ID_ADD_SELECTOR
-                        && a_add_sel->content.id_name
-                        && a_add_sel->content.id_name->stryng
-                        && a_add_sel->content.id_name->stryng->str
-                        && a_node, FALSE);
-  g_return_val_if_fail (a_add_sel
-                        && a_add_sel->type == ID_ADD_SELECTOR
-                        && a_node, FALSE);
+  compiled->combinator = simple_sel->combinator;
 
-  id = st_theme_node_get_element_id (a_node);
-
-  if (id != NULL)
+  if (simple_sel->combinator == COMB_PLUS)
     {
-      if (!strqcmp (id, a_add_sel->content.id_name->stryng->str,
-                    a_add_sel->content.id_name->stryng->len))
-        {
-          result = TRUE;
-        }
+      g_warning ("+ combinators are not supported");
+      compiled->never_matches = TRUE;
     }
 
-  return result;
-}
-
-/**
- *additional_selector_matches_style:
- *Evaluates if a given additional selector matches an style node.
- *@param a_add_sel the additional selector to consider.
- *@param a_node the style node to consider.
- *@return TRUE is a_add_sel matches a_node, FALSE otherwise.
- */
-static gboolean
-additional_selector_matches_style (StTheme         *a_this,
-                                   CRAdditionalSel *a_add_sel,
-                                   StThemeNode     *a_node)
-{
-  CRAdditionalSel *cur_add_sel = NULL;
-
-  g_return_val_if_fail (a_add_sel, FALSE);
+  if (simple_sel->type_mask & UNIVERSAL_SELECTOR)
+    {
+      /* matches any element */
+    }
+  else if (simple_sel->type_mask & TYPE_SELECTOR)
+    {
+      if (simple_sel->name && simple_sel->name->stryng && simple_sel->name->stryng->str)
+        compiled->element_name = g_quark_from_string (simple_sel->name->stryng->str);
+      else
+        compiled->never_matches = TRUE;
+    }
+  else if (!simple_sel->add_sel)
+    {
+      compiled->never_matches = TRUE;
+    }
 
-  for (cur_add_sel = a_add_sel; cur_add_sel; cur_add_sel = cur_add_sel->next)
+  for (cur_add_sel = simple_sel->add_sel; cur_add_sel; cur_add_sel = cur_add_sel->next)
     {
+      GQuark quark;
+
       switch (cur_add_sel->type)
         {
-        case NO_ADD_SELECTOR:
-          return FALSE;
         case CLASS_ADD_SELECTOR:
-          if (!class_add_sel_matches_style (cur_add_sel, a_node))
-            return FALSE;
+          if (!(cur_add_sel->content.class_name
+                && cur_add_sel->content.class_name->stryng
+                && cur_add_sel->content.class_name->stryng->str))
+            {
+              compiled->never_matches = TRUE;
+              break;
+            }
+
+          quark = g_quark_from_string (cur_add_sel->content.class_name->stryng->str);
+          if (classes == NULL)
+            classes = g_array_new (TRUE, FALSE, sizeof (GQuark));
+          g_array_append_val (classes, quark);
           break;
+
         case ID_ADD_SELECTOR:
-          if (!id_add_sel_matches_style (cur_add_sel, a_node))
-            return FALSE;
+          if (!(cur_add_sel->content.id_name
+                && cur_add_sel->content.id_name->stryng
+                && cur_add_sel->content.id_name->stryng->str))
+            {
+              compiled->never_matches = TRUE;
+              break;
+            }
+
+          quark = g_quark_from_string (cur_add_sel->content.id_name->stryng->str);
+          /* A node only has one id */
+          if (compiled->id != 0 && compiled->id != quark)
+            compiled->never_matches = TRUE;
+          compiled->id = quark;
+          break;
+
+        case PSEUDO_CLASS_ADD_SELECTOR:
+          if (!(cur_add_sel->content.pseudo
+                && cur_add_sel->content.pseudo->name
+                && cur_add_sel->content.pseudo->name->stryng
+                && cur_add_sel->content.pseudo->name->stryng->str))
+            {
+              compiled->never_matches = TRUE;
+              break;
+            }
+
+          quark = g_quark_from_string (cur_add_sel->content.pseudo->name->stryng->str);
+          if (pseudo_classes == NULL)
+            pseudo_classes = g_array_new (TRUE, FALSE, sizeof (GQuark));
+          g_array_append_val (pseudo_classes, quark);
           break;
+
+        case NO_ADD_SELECTOR:
+          compiled->never_matches = TRUE;
+          break;
+
         case ATTRIBUTE_ADD_SELECTOR:
           g_warning ("Attribute selectors not supported");
-          return FALSE;
-        case  PSEUDO_CLASS_ADD_SELECTOR:
-          if (!pseudo_class_add_sel_matches_style (a_this, cur_add_sel, a_node))
-            return FALSE;
+          compiled->never_matches = TRUE;
           break;
+
         default:
           g_warning ("Unhandled selector type %d", cur_add_sel->type);
-          return FALSE;
+          compiled->never_matches = TRUE;
+          break;
         }
     }
 
-  return TRUE;
+  compiled->classes = quark_array_free (classes);
+  compiled->pseudo_classes = quark_array_free (pseudo_classes);
 }
 
 static gboolean
-element_name_matches_type (const char *element_name,
-                           GType       element_type)
+quark_in_list (GQuark        quark,
+               const GQuark *list)
 {
-  if (element_type == G_TYPE_NONE)
+  if (list == NULL)
+    return FALSE;
+
+  for (; *list != 0; list++)
     {
-      return strcmp (element_name, "stage") == 0;
+      if (*list == quark)
+        return TRUE;
     }
-  else
+
+  return FALSE;
+}
+
+static gboolean
+element_name_matches_type (CompiledSel *sel,
+                           GType        element_type)
+{
+  if (element_type == G_TYPE_NONE)
+    return sel->element_name == stage_quark;
+
+  /* Types are registered on first use, so a name that doesn't resolve
+   * yet may well do later on.
+   */
+  if (sel->element_type == G_TYPE_INVALID)
     {
-      GType match_type = g_type_from_name (element_name);
-      if (match_type == G_TYPE_INVALID)
+      sel->element_type = g_type_from_name (g_quark_to_string (sel->element_name));
+      if (sel->element_type == G_TYPE_INVALID)
         return FALSE;
+    }
+
+  return g_type_is_a (element_type, sel->element_type);
+}
+
+static gboolean
+simple_sel_matches_node (CompiledSel *sel,
+                         StThemeNode *node)
+{
+  const GQuark *it;
+
+  if (sel->never_matches)
+    return FALSE;
 
-      return g_type_is_a (element_type, match_type);
+  if (sel->element_name != 0 &&
+      !element_name_matches_type (sel, node->element_type))
+    return FALSE;
+
+  if (sel->id != 0 && sel->id != node->element_id_quark)
+    return FALSE;
+
+  if (sel->classes != NULL)
+    {
+      for (it = sel->classes; *it != 0; it++)
+        {
+          if (!quark_in_list (*it, node->element_class_quarks))
+            return FALSE;
+        }
     }
+
+  if (sel->pseudo_classes != NULL)
+    {
+      for (it = sel->pseudo_classes; *it != 0; it++)
+        {
+          if (!quark_in_list (*it, node->pseudo_class_quarks))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
 }
 
+typedef struct {
+  CompiledSel *sels;
+  guint        n_sels;
+  guint8      *failed; /* a bit per (index, depth) that didn't match */
+} SelectorMatch;
+
+/* Enough for the selectors and trees we actually see */
+#define SELECTOR_MATCH_STACK_BYTES 64
+
 /*
- *Evaluate a selector (a simple selectors list) and says
- *if it matches the style node given in parameter.
- *The algorithm used here is the following:
- *Walk the combinator separated list of simple selectors backward, starting
- *from the end of the list. For each simple selector, looks if
- *if matches the current style.
- *
- *@param a_this the selection engine.
- *@param a_sel the simple selection list.
- *@param a_node the style node.
- *@param a_result out parameter. Set to true if the
- *selector matches the style node, FALSE otherwise.
- *@param a_recurse if set to TRUE, the function will walk to
- *the next simple selector (after the evaluation of the current one)
- *and recursively evaluate it. Must be usually set to TRUE unless you
- *know what you are doing.
+ * Evaluates the simple selectors of a compiled selector from @index back
+ * to the first one against @node, which is @depth levels above the node
+ * being styled, and depending on the combinators its ancestors. For
+ * descendant combinators every ancestor is tried, so a selector matches
+ * if there is any way to match it against the tree. Whether a selector
+ * matches from a given position only depends on that position, so the
+ * positions that failed are remembered and not tried again; otherwise
+ * selectors with many descendant combinators backtrack exponentially on
+ * deep trees.
  */
-static enum CRStatus
-sel_matches_style_real (StTheme     *a_this,
-                        CRSimpleSel *a_sel,
-                        StThemeNode *a_node,
-                        gboolean    *a_result,
-                        gboolean     a_eval_sel_list_from_end,
-                        gboolean     a_recurse)
+static gboolean
+selector_matches_node_at (SelectorMatch *match,
+                          guint          index,
+                          StThemeNode   *node,
+                          guint          depth)
 {
-  CRSimpleSel *cur_sel = NULL;
-  StThemeNode *cur_node = NULL;
-  GType cur_type;
+  CompiledSel *sels = match->sels;
+  StThemeNode *ancestor;
+  guint bit = depth * match->n_sels + index;
+  gboolean matches;
 
-  *a_result = FALSE;
+  if (match->failed[bit / 8] & (1 << (bit % 8)))
+    return FALSE;
 
-  if (a_eval_sel_list_from_end)
+  if (!simple_sel_matches_node (&sels[index], node))
+    matches = FALSE;
+  else if (index == 0)
+    matches = TRUE;
+  else
     {
-      /*go and get the last simple selector of the list */
-      for (cur_sel = a_sel; cur_sel && cur_sel->next; cur_sel = cur_sel->next)
-        ;
+      switch (sels[index].combinator)
+        {
+        case NO_COMBINATOR:
+          matches = selector_matches_node_at (match, index - 1, node, depth);
+          break;
+
+        case COMB_WS:
+          matches = FALSE;
+          for (ancestor = node->parent_node; ancestor && !matches; ancestor = ancestor->parent_node)
+            matches = selector_matches_node_at (match, index - 1, ancestor, ++depth);
+          break;
+
+        case COMB_GT:
+          matches = node->parent_node != NULL &&
+                    selector_matches_node_at (match, index - 1, node->parent_node, depth + 1);
+          break;
+
+        case COMB_PLUS:
+        default:
+          matches = FALSE;
+          break;
+        }
+    }
+
+  if (!matches)
+    match->failed[bit / 8] |= 1 << (bit % 8);
+
+  return matches;
+}
+
+static gboolean
+selector_matches_node (CompiledSel *sels,
+                       guint        n_sels,
+                       StThemeNode *node)
+{
+  guint8 stack_bits[SELECTOR_MATCH_STACK_BYTES];
+  SelectorMatch match;
+  StThemeNode *ancestor;
+  guint n_levels = 0;
+  gsize n_bytes;
+  gboolean matches;
+
+  for (ancestor = node; ancestor; ancestor = ancestor->parent_node)
+    n_levels++;
+
+  n_bytes = (n_levels * n_sels + 7) / 8;
+
+  match.sels = sels;
+  match.n_sels = n_sels;
+  if (n_bytes <= sizeof (stack_bits))
+    {
+      match.failed = stack_bits;
+      memset (stack_bits, 0, n_bytes);
     }
   else
+    match.failed = g_malloc0 (n_bytes);
+
+  matches = selector_matches_node_at (&match, n_sels - 1, node, 0);
+
+  if (match.failed != stack_bits)
+    g_free (match.failed);
+
+  return matches;
+}
+
+/*
+ * To avoid running every selector of every stylesheet against each node,
+ * the rules of a stylesheet are indexed once by the rightmost simple
+ * selector of each selector: by its id if it has one, else by one of its
+ * classes, else by its element name. Matching a node then only has to
+ * look at the buckets for the node's id, classes and element type (and
+ * the ancestor types of that, since element names match subtypes), plus
+ * the rules that can't be keyed. @import rules are kept with the unkeyed
+ * rules so that imported declarations are still added at the position
+ * of the rule.
+ *
+ * Each entry also keeps the ancestor filter hashes of the ids, classes
+ * and element names the other simple selectors require, so that a node
+ * whose ancestors can't have all of them is rejected without walking up
+ * the tree.
+ */
+typedef struct {
+  CRStatement *stmt;        /* the ruleset or the @import rule */
+  CompiledSel *sels;        /* NULL for an @import rule */
+  guint        n_sels;
+  gulong       specificity;
+  guint        position;    /* source order within the stylesheet */
+  guint       *ancestor_hashes;
+  guint        n_ancestor_hashes;
+} RuleEntry;
+
+struct _RuleIndex {
+  GPtrArray  *entries;      /* all RuleEntry, owned, in source order */
+  GHashTable *by_id;        /* id quark => GPtrArray of RuleEntry */
+  GHashTable *by_class;     /* class quark => GPtrArray of RuleEntry */
+  GHashTable *by_type;      /* element name quark => GPtrArray of RuleEntry */
+  GPtrArray  *unkeyed;
+
+  /* Sets of the id, class and pseudo-class quarks that some selector
+   * requires of an ancestor, see _st_theme_has_ancestor_key() */
+  GHashTable *ancestor_ids;
+  GHashTable *ancestor_classes;
+  GHashTable *ancestor_pseudo_classes;
+  guint       has_imports : 1;
+};
+
+static void
+rule_entry_free (gpointer data)
+{
+  RuleEntry *entry = data;
+  guint i;
+
+  for (i = 0; i < entry->n_sels; i++)
     {
-      cur_sel = a_sel;
+      g_free (entry->sels[i].classes);
+      g_free (entry->sels[i].pseudo_classes);
     }
 
-  cur_node = a_node;
-  cur_type = st_theme_node_get_element_type (cur_node);
+  g_free (entry->sels);
+  g_free (entry->ancestor_hashes);
+  g_slice_free (RuleEntry, entry);
+}
+
+static void
+add_ancestor_hash (GArray            *hashes,
+                   StAncestorKeyKind  kind,
+                   GQuark             quark)
+{
+  guint hash = _st_ancestor_filter_hash (kind, g_quark_to_string (quark));
 
-  while (cur_sel)
+  g_array_append_val (hashes, hash);
+}
+
+static void
+add_ancestor_keys (GHashTable   *set,
+                   const GQuark *quarks)
+{
+  if (quarks == NULL)
+    return;
+
+  for (; *quarks != 0; quarks++)
+    g_hash_table_add (set, GUINT_TO_POINTER (*quarks));
+}
+
+static void
+rule_entry_set_ancestor_hashes (RuleIndex *index,
+                                RuleEntry *entry)
+{
+  GArray *hashes = g_array_new (FALSE, FALSE, sizeof (guint));
+  gboolean on_ancestor = FALSE;
+  guint i;
+
+  for (i = entry->n_sels - 1; i > 0; i--)
     {
-      if (((cur_sel->type_mask & TYPE_SELECTOR)
-           && (cur_sel->name
-               && cur_sel->name->stryng
-               && cur_sel->name->stryng->str)
-           &&
-           (element_name_matches_type (cur_sel->name->stryng->str, cur_type)))
-          || (cur_sel->type_mask & UNIVERSAL_SELECTOR))
-        {
-          /*
-           *this simple selector
-           *matches the current style node
-           *Let's see if the preceding
-           *simple selectors also match
-           *their style node counterpart.
-           */
-          if (cur_sel->add_sel)
-            {
-              if (additional_selector_matches_style (a_this, cur_sel->add_sel, cur_node))
-                goto walk_a_step_in_expr;
-              else
-                goto done;
-            }
-          else
-            goto walk_a_step_in_expr;
-        }
-      if (!(cur_sel->type_mask & TYPE_SELECTOR)
-          && !(cur_sel->type_mask & UNIVERSAL_SELECTOR))
-        {
-          if (!cur_sel->add_sel)
-            goto done;
-          if (additional_selector_matches_style (a_this, cur_sel->add_sel, cur_node))
-            goto walk_a_step_in_expr;
-          else
-            goto done;
-        }
-      else
+      CompiledSel *prev_sel = &entry->sels[i - 1];
+      const GQuark *it;
+
+      /* The combinator of a simple selector separates it from the
+       * previous one; anything left of a descendant or child combinator
+       * has to match an ancestor of the node. */
+      if (entry->sels[i].combinator == COMB_WS || entry->sels[i].combinator == COMB_GT)
+        on_ancestor = TRUE;
+
+      if (!on_ancestor)
+        continue;
+
+      if (prev_sel->element_name != 0)
+        add_ancestor_hash (hashes, ST_ANCESTOR_KEY_TYPE, prev_sel->element_name);
+
+      if (prev_sel->id != 0)
         {
-          goto done;
+          add_ancestor_hash (hashes, ST_ANCESTOR_KEY_ID, prev_sel->id);
+          g_hash_table_add (index->ancestor_ids, GUINT_TO_POINTER (prev_sel->id));
         }
 
-    walk_a_step_in_expr:
-      if (a_recurse == FALSE)
+      if (prev_sel->classes != NULL)
         {
-          *a_result = TRUE;
-          goto done;
+          for (it = prev_sel->classes; *it != 0; it++)
+            add_ancestor_hash (hashes, ST_ANCESTOR_KEY_CLASS, *it);
+          add_ancestor_keys (index->ancestor_classes, prev_sel->classes);
         }
 
-      /*
-       *here, depending on the combinator of cur_sel
-       *choose the axis of the element tree traversal
-       *and walk one step in the element tree.
-       */
-      if (!cur_sel->prev)
-        break;
+      add_ancestor_keys (index->ancestor_pseudo_classes, prev_sel->pseudo_classes);
+    }
 
-      switch (cur_sel->combinator)
-        {
-        case NO_COMBINATOR:
-          break;
+  entry->n_ancestor_hashes = hashes->len;
+  entry->ancestor_hashes = (guint *) g_array_free (hashes, hashes->len == 0);
+}
 
-        case COMB_WS:           /*descendant selector */
-          {
-            StThemeNode *n = NULL;
-
-            /*
-             *walk the element tree upward looking for a parent
-             *style that matches the preceding selector.
-             */
-            for (n = st_theme_node_get_parent (a_node); n; n = st_theme_node_get_parent (n))
-              {
-                enum CRStatus status;
-                gboolean matches = FALSE;
-
-                status = sel_matches_style_real (a_this, cur_sel->prev, n, &matches, FALSE, TRUE);
-
-                if (status != CR_OK)
-                  goto done;
-
-                if (matches)
-                  {
-                    cur_node = n;
-                    cur_type = st_theme_node_get_element_type (cur_node);
-                    break;
-                  }
-              }
-
-            if (!n)
-              {
-                /*
-                 *didn't find any ancestor that matches
-                 *the previous simple selector.
-                 */
-                goto done;
-              }
-            /*
-             *in this case, the preceding simple sel
-             *will have been interpreted twice, which
-             *is a cpu and mem waste ... I need to find
-             *another way to do this. Anyway, this is
-             *my first attempt to write this function and
-             *I am a bit clueless.
-             */
-            break;
-          }
+static gboolean
+rule_entry_ancestors_may_match (RuleEntry   *entry,
+                                StThemeNode *node)
+{
+  guint i;
 
-        case COMB_PLUS:
-          g_warning ("+ combinators are not supported");
-          goto done;
+  for (i = 0; i < entry->n_ancestor_hashes; i++)
+    {
+      if (!_st_theme_node_ancestors_may_have (node, entry->ancestor_hashes[i]))
+        return FALSE;
+    }
 
-        case COMB_GT:
-          cur_node = st_theme_node_get_parent (cur_node);
-          if (!cur_node)
-            goto done;
-          cur_type = st_theme_node_get_element_type (cur_node);
-          break;
+  return TRUE;
+}
 
-        default:
-          goto done;
-        }
+static void
+rule_index_free (RuleIndex *index)
+{
+  g_hash_table_destroy (index->by_id);
+  g_hash_table_destroy (index->by_class);
+  g_hash_table_destroy (index->by_type);
+  g_ptr_array_free (index->unkeyed, TRUE);
+  g_ptr_array_free (index->entries, TRUE);
+  g_hash_table_destroy (index->ancestor_ids);
+  g_hash_table_destroy (index->ancestor_classes);
+  g_hash_table_destroy (index->ancestor_pseudo_classes);
+  g_slice_free (RuleIndex, index);
+}
 
-      cur_sel = cur_sel->prev;
-    }
+static RuleEntry *
+rule_index_add_entry (RuleIndex   *index,
+                      CRStatement *stmt)
+{
+  RuleEntry *entry = g_slice_new0 (RuleEntry);
 
-  /*
-   *if we reached this point, it means the selector matches
-   *the style node.
-   */
-  *a_result = TRUE;
+  entry->stmt = stmt;
+  entry->position = index->entries->len;
+  g_ptr_array_add (index->entries, entry);
 
-done:
-  return CR_OK;
+  return entry;
 }
 
 static void
-add_matched_properties (StTheme      *a_this,
-                        CRStyleSheet *a_nodesheet,
-                        StThemeNode  *a_node,
-                        GPtrArray    *props)
+rule_index_add_to_bucket (GHashTable *table,
+                          GQuark      key,
+                          RuleEntry  *entry)
 {
-  CRStatement *cur_stmt = NULL;
-  CRSelector *sel_list = NULL;
-  CRSelector *cur_sel = NULL;
-  gboolean matches = FALSE;
-  enum CRStatus status = CR_OK;
+  GPtrArray *bucket = g_hash_table_lookup (table, GUINT_TO_POINTER (key));
 
-  /*
-   *walk through the list of statements and,
-   *get the selectors list inside the statements that
-   *contain some, and try to match our style node in these
-   *selectors lists.
-   */
-  for (cur_stmt = a_nodesheet->statements; cur_stmt; cur_stmt = cur_stmt->next)
+  if (bucket == NULL)
+    {
+      bucket = g_ptr_array_new ();
+      g_hash_table_insert (table, GUINT_TO_POINTER (key), bucket);
+    }
+
+  g_ptr_array_add (bucket, entry);
+}
+
+static void
+rule_index_add_ruleset (RuleIndex   *index,
+                        CRStatement *stmt)
+{
+  CRSelector *cur_sel;
+
+  if (stmt->kind.ruleset == NULL)
+    return;
+
+  for (cur_sel = stmt->kind.ruleset->sel_list; cur_sel; cur_sel = cur_sel->next)
+    {
+      CRSimpleSel *simple_sel;
+      CompiledSel *rightmost;
+      RuleEntry *entry;
+      guint i;
+
+      if (!cur_sel->simple_sel)
+        continue;
+
+      entry = rule_index_add_entry (index, stmt);
+
+      for (simple_sel = cur_sel->simple_sel; simple_sel; simple_sel = simple_sel->next)
+        entry->n_sels++;
+
+      entry->sels = g_new0 (CompiledSel, entry->n_sels);
+      for (simple_sel = cur_sel->simple_sel, i = 0; simple_sel; simple_sel = simple_sel->next, i++)
+        compile_simple_sel (simple_sel, &entry->sels[i]);
+
+      cr_simple_sel_compute_specificity (cur_sel->simple_sel);
+      entry->specificity = cur_sel->simple_sel->specificity;
+      rule_entry_set_ancestor_hashes (index, entry);
+
+      rightmost = &entry->sels[entry->n_sels - 1];
+
+      if (rightmost->never_matches)
+        continue;
+      else if (rightmost->id != 0)
+        rule_index_add_to_bucket (index->by_id, rightmost->id, entry);
+      else if (rightmost->classes != NULL)
+        rule_index_add_to_bucket (index->by_class, rightmost->classes[0], entry);
+      else if (rightmost->element_name != 0)
+        rule_index_add_to_bucket (index->by_type, rightmost->element_name, entry);
+      else
+        g_ptr_array_add (index->unkeyed, entry);
+    }
+}
+
+static RuleIndex *
+rule_index_new (CRStyleSheet *sheet)
+{
+  RuleIndex *index = g_slice_new0 (RuleIndex);
+  CRStatement *cur_stmt;
+
+  index->entries = g_ptr_array_new_with_free_func (rule_entry_free);
+  index->by_id = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL, (GDestroyNotify)g_ptr_array_unref);
+  index->by_class = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                           NULL, (GDestroyNotify)g_ptr_array_unref);
+  index->by_type = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                          NULL, (GDestroyNotify)g_ptr_array_unref);
+  index->unkeyed = g_ptr_array_new ();
+  index->ancestor_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+  index->ancestor_classes = g_hash_table_new (g_direct_hash, g_direct_equal);
+  index->ancestor_pseudo_classes = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  for (cur_stmt = sheet->statements; cur_stmt; cur_stmt = cur_stmt->next)
     {
-      /*
-       *initialyze the selector list in which we will
-       *really perform the search.
-       */
-      sel_list = NULL;
-
-      /*
-       *get the the damn selector list in
-       *which we have to look
-       */
       switch (cur_stmt->type)
         {
         case RULESET_STMT:
-          if (cur_stmt->kind.ruleset && cur_stmt->kind.ruleset->sel_list)
-            {
-              sel_list = cur_stmt->kind.ruleset->sel_list;
-            }
+          rule_index_add_ruleset (index, cur_stmt);
           break;
 
         case AT_MEDIA_RULE_STMT:
-          if (cur_stmt->kind.media_rule
-              && cur_stmt->kind.media_rule->rulesets
-              && cur_stmt->kind.media_rule->rulesets->kind.ruleset
-              && cur_stmt->kind.media_rule->rulesets->kind.ruleset->sel_list)
+          /* Media queries are ignored; the rulesets always apply */
+          if (cur_stmt->kind.media_rule)
             {
-              sel_list = cur_stmt->kind.media_rule->rulesets->kind.ruleset->sel_list;
+              CRStatement *ruleset;
+
+              for (ruleset = cur_stmt->kind.media_rule->rulesets; ruleset; ruleset = ruleset->next)
+                {
+                  if (ruleset->type == RULESET_STMT)
+                    rule_index_add_ruleset (index, ruleset);
+                }
             }
           break;
 
         case AT_IMPORT_RULE_STMT:
-          {
-            CRAtImportRule *import_rule = cur_stmt->kind.import_rule;
-
-            if (import_rule->sheet == NULL)
-              {
-                char *filename = NULL;
-
-                if (import_rule->url->stryng && import_rule->url->stryng->str)
-                  {
-                    GFile *file;
-
-                    file = _st_theme_resolve_url (a_this,
-                                                  a_nodesheet,
-                                                  import_rule->url->stryng->str);
-                    if (file)
-                      {
-                        filename = g_file_get_path (file);
-                        g_object_unref (file);
-                      }
-                  }
-
-                if (filename)
-                  import_rule->sheet = parse_stylesheet (filename, NULL);
-
-                if (import_rule->sheet)
-                  {
-                    insert_stylesheet (a_this, filename, import_rule->sheet);
-                    /* refcount of stylesheets starts off at zero, so we don't need to unref! */
-                  }
-                else
-                  {
-                    /* Set a marker to avoid repeatedly trying to parse a non-existent or
-                     * broken stylesheet
-                     */
-                    import_rule->sheet = (CRStyleSheet *) - 1;
-                  }
-
-                if (filename)
-                  g_free (filename);
-              }
-
-            if (import_rule->sheet != (CRStyleSheet *) - 1)
-              {
-                add_matched_properties (a_this, import_rule->sheet,
-                                        a_node, props);
-              }
-          }
+          if (cur_stmt->kind.import_rule)
+            {
+              g_ptr_array_add (index->unkeyed,
+                               rule_index_add_entry (index, cur_stmt));
+              index->has_imports = TRUE;
+            }
           break;
+
         case AT_RULE_STMT:
         case AT_PAGE_RULE_STMT:
         case AT_CHARSET_RULE_STMT:
@@ -945,45 +1534,392 @@ add_matched_properties (StTheme      *a_this,
         default:
           break;
         }
+    }
 
-      if (!sel_list)
-        continue;
+  return index;
+}
+
+static RuleIndex *
+get_rule_index (StTheme      *theme,
+                CRStyleSheet *sheet)
+{
+  RuleIndex *index = g_hash_table_lookup (theme->rule_indexes, sheet);
 
-      /*
-       *now, we have a comma separated selector list to look in.
-       *let's walk it and try to match the style node
-       *on each item of the list.
-       */
-      for (cur_sel = sel_list; cur_sel; cur_sel = cur_sel->next)
+  if (index == NULL)
+    {
+      index = rule_index_new (sheet);
+      g_hash_table_insert (theme->rule_indexes, sheet, index);
+    }
+
+  return index;
+}
+
+/* Returns the element names that element_name_matches_type() accepts
+ * for @type, as quarks: the names of the type, its ancestors and its
+ * interfaces.
+ */
+static GArray *
+get_type_names (StTheme *theme,
+                GType    type)
+{
+  GArray *names;
+
+  names = g_hash_table_lookup (theme->type_names, GSIZE_TO_POINTER (type));
+  if (names != NULL)
+    return names;
+
+  names = g_array_new (FALSE, FALSE, sizeof (GQuark));
+
+  if (type == G_TYPE_NONE)
+    {
+      g_array_append_val (names, stage_quark);
+    }
+  else if (type != G_TYPE_INVALID)
+    {
+      GType *interfaces;
+      guint n_interfaces, i;
+      GQuark name;
+      GType t;
+
+      for (t = type; t != G_TYPE_INVALID; t = g_type_parent (t))
+        {
+          name = g_type_qname (t);
+          g_array_append_val (names, name);
+        }
+
+      interfaces = g_type_interfaces (type, &n_interfaces);
+      for (i = 0; i < n_interfaces; i++)
         {
-          if (!cur_sel->simple_sel)
-            continue;
+          name = g_type_qname (interfaces[i]);
+          g_array_append_val (names, name);
+        }
+      g_free (interfaces);
+    }
+
+  g_hash_table_insert (theme->type_names, GSIZE_TO_POINTER (type), names);
+
+  return names;
+}
+
+/**
+ * _st_theme_stylesheet_may_match:
+ * @theme: a #StTheme
+ * @stylesheet: a stylesheet of @theme
+ * @node: a #StThemeNode
+ *
+ * Checks whether any rule of @stylesheet could apply to @node, by
+ * looking up the id, classes and element names of @node in the keys
+ * of the stylesheet's rule index. Ancestors in a selector are not
+ * considered, so this may return %TRUE for rules that do not
+ * actually match; stylesheets with unkeyed rules or imports match
+ * every node.
+ *
+ * Return value: %FALSE if @stylesheet cannot affect the properties
+ *   of @node
+ */
+gboolean
+_st_theme_stylesheet_may_match (StTheme      *theme,
+                                CRStyleSheet *stylesheet,
+                                StThemeNode  *node)
+{
+  RuleIndex *index = get_rule_index (theme, stylesheet);
+  GArray *type_names;
+  guint i;
 
-          status = sel_matches_style_real (a_this, cur_sel->simple_sel, a_node, &matches, TRUE, TRUE);
+  if (index->unkeyed->len > 0)
+    return TRUE;
 
-          if (status == CR_OK && matches)
+  if (node->element_id_quark != 0 &&
+      g_hash_table_contains (index->by_id, GUINT_TO_POINTER (node->element_id_quark)))
+    return TRUE;
+
+  for (i = 0; node->element_class_quarks && node->element_class_quarks[i]; i++)
+    {
+      if (g_hash_table_contains (index->by_class, GUINT_TO_POINTER (node->element_class_quarks[i])))
+        return TRUE;
+    }
+
+  type_names = get_type_names (theme, node->element_type);
+  for (i = 0; i < type_names->len; i++)
+    {
+      if (g_hash_table_contains (index->by_type,
+                                 GUINT_TO_POINTER (g_array_index (type_names, GQuark, i))))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+stylesheet_has_ancestor_key (StTheme           *theme,
+                             CRStyleSheet      *stylesheet,
+                             StAncestorKeyKind  kind,
+                             GQuark             quark)
+{
+  RuleIndex *index = get_rule_index (theme, stylesheet);
+  GHashTable *set;
+  guint i;
+
+  switch (kind)
+    {
+    case ST_ANCESTOR_KEY_ID:
+      set = index->ancestor_ids;
+      break;
+    case ST_ANCESTOR_KEY_CLASS:
+      set = index->ancestor_classes;
+      break;
+    case ST_ANCESTOR_KEY_PSEUDO_CLASS:
+      set = index->ancestor_pseudo_classes;
+      break;
+    case ST_ANCESTOR_KEY_TYPE:
+    default:
+      /* Element types of a node never change */
+      return TRUE;
+    }
+
+  if (g_hash_table_contains (set, GUINT_TO_POINTER (quark)))
+    return TRUE;
+
+  if (!index->has_imports)
+    return FALSE;
+
+  for (i = 0; i < index->unkeyed->len; i++)
+    {
+      RuleEntry *entry = index->unkeyed->pdata[i];
+      CRStyleSheet *imported;
+
+      if (entry->stmt->type != AT_IMPORT_RULE_STMT)
+        continue;
+
+      imported = entry->stmt->kind.import_rule->sheet;
+
+      /* Not loaded yet, so we can't tell what it needs */
+      if (imported == NULL)
+        return TRUE;
+
+      if (imported != (CRStyleSheet *) -1 &&
+          stylesheet_has_ancestor_key (theme, imported, kind, quark))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/**
+ * _st_theme_has_ancestor_key:
+ * @theme: a #StTheme
+ * @kind: whether @quark names an id, a class or a pseudo-class
+ * @quark: the id, class or pseudo-class
+ *
+ * Checks whether any selector of the stylesheets of @theme requires
+ * @quark of an ancestor of the node it matches, that is, whether it
+ * appears in any but the rightmost simple selector. If it doesn't,
+ * adding or removing @quark on a node can't change which rules match
+ * the node's descendants.
+ *
+ * Return value: %TRUE if the descendants of a node may match differently
+ *   when @quark changes on it
+ */
+gboolean
+_st_theme_has_ancestor_key (StTheme           *theme,
+                            StAncestorKeyKind  kind,
+                            GQuark             quark)
+{
+  enum CRStyleOrigin origin;
+  CRStyleSheet *sheet;
+  GSList *iter;
+
+  for (origin = ORIGIN_UA; origin < NB_ORIGINS; origin++)
+    {
+      sheet = cr_cascade_get_sheet (theme->cascade, origin);
+      if (sheet && stylesheet_has_ancestor_key (theme, sheet, kind, quark))
+        return TRUE;
+    }
+
+  for (iter = theme->custom_stylesheets; iter; iter = iter->next)
+    {
+      if (stylesheet_has_ancestor_key (theme, iter->data, kind, quark))
+        return TRUE;
+    }
+
+  if (theme->fallback_cr_stylesheet &&
+      stylesheet_has_ancestor_key (theme, theme->fallback_cr_stylesheet, kind, quark))
+    return TRUE;
+
+  return FALSE;
+}
+
+static void
+add_bucket (GPtrArray *candidates,
+            GPtrArray *bucket)
+{
+  guint i;
+
+  if (bucket == NULL)
+    return;
+
+  for (i = 0; i < bucket->len; i++)
+    g_ptr_array_add (candidates, bucket->pdata[i]);
+}
+
+static int
+compare_rule_entries (gconstpointer a,
+                      gconstpointer b)
+{
+  RuleEntry *entry_a = *(RuleEntry **) a;
+  RuleEntry *entry_b = *(RuleEntry **) b;
+
+  if (entry_a->position < entry_b->position)
+    return -1;
+  else if (entry_a->position > entry_b->position)
+    return 1;
+
+  return 0;
+}
+
+static void add_matched_properties (StTheme      *a_this,
+                                    CRStyleSheet *a_nodesheet,
+                                    StThemeNode  *a_node,
+                                    GPtrArray    *props);
+
+static void
+add_imported_properties (StTheme      *a_this,
+                         CRStyleSheet *a_nodesheet,
+                         CRStatement  *a_import_stmt,
+                         StThemeNode  *a_node,
+                         GPtrArray    *props)
+{
+  CRAtImportRule *import_rule = a_import_stmt->kind.import_rule;
+
+  /* Custom stylesheets come with their imports already parsed; the
+   * ones the theme was created with are loaded on first use */
+  if (import_rule->sheet == NULL)
+    {
+      char *filename = NULL;
+
+      if (import_rule->url->stryng && import_rule->url->stryng->str)
+        {
+          GFile *file;
+
+          file = _st_theme_resolve_url (a_this,
+                                        a_nodesheet,
+                                        import_rule->url->stryng->str);
+          if (file)
             {
-              CRDeclaration *cur_decl = NULL;
-
-              /* In order to sort the matching properties, we need to compute the
-               * specificity of the selector that actually matched this
-               * element. In a non-thread-safe fashion, we store it in the
-               * ruleset. (Fixing this would mean cut-and-pasting
-               * cr_simple_sel_compute_specificity(), and have no need for
-               * thread-safety anyways.)
-               *
-               * Once we've sorted the properties, the specificity no longer
-               * matters and it can be safely overridden.
-               */
-              cr_simple_sel_compute_specificity (cur_sel->simple_sel);
-
-              cur_stmt->specificity = cur_sel->simple_sel->specificity;
-
-              for (cur_decl = cur_stmt->kind.ruleset->decl_list; cur_decl; cur_decl = cur_decl->next)
-                g_ptr_array_add (props, cur_decl);
+              filename = g_file_get_path (file);
+              g_object_unref (file);
             }
         }
+
+      /* Share the stylesheet if the file is already loaded */
+      if (filename)
+        import_rule->sheet = g_hash_table_lookup (a_this->stylesheets_by_filename, filename);
+
+      if (filename && import_rule->sheet == NULL)
+        {
+          import_rule->sheet = parse_stylesheet (filename, NULL);
+          insert_stylesheet (a_this, filename, import_rule->sheet);
+          /* refcount of stylesheets starts off at zero, so we don't need to unref! */
+        }
+
+      if (import_rule->sheet == NULL)
+        {
+          /* Set a marker to avoid repeatedly trying to parse a non-existent or
+           * broken stylesheet
+           */
+          import_rule->sheet = (CRStyleSheet *) - 1;
+        }
+
+      if (filename)
+        g_free (filename);
+    }
+
+  if (import_rule->sheet != (CRStyleSheet *) - 1)
+    add_matched_properties (a_this, import_rule->sheet, a_node, props);
+}
+
+static void
+add_matched_properties (StTheme      *a_this,
+                        CRStyleSheet *a_nodesheet,
+                        StThemeNode  *a_node,
+                        GPtrArray    *props)
+{
+  RuleIndex *index;
+  RuleEntry *prev_entry = NULL;
+  GPtrArray *candidates;
+  GArray *type_names;
+  guint i;
+
+  index = get_rule_index (a_this, a_nodesheet);
+
+  /*
+   *gather the rules that could match our style node, then put
+   *them back in source order so that the declarations get added
+   *in the same order as walking the whole stylesheet would.
+   */
+  candidates = g_ptr_array_new ();
+
+  if (a_node->element_id_quark != 0)
+    add_bucket (candidates, g_hash_table_lookup (index->by_id,
+                                                 GUINT_TO_POINTER (a_node->element_id_quark)));
+
+  if (a_node->element_class_quarks != NULL)
+    {
+      GQuark *it;
+
+      for (it = a_node->element_class_quarks; *it != 0; it++)
+        add_bucket (candidates, g_hash_table_lookup (index->by_class, GUINT_TO_POINTER (*it)));
+    }
+
+  type_names = get_type_names (a_this, a_node->element_type);
+  for (i = 0; i < type_names->len; i++)
+    add_bucket (candidates, g_hash_table_lookup (index->by_type,
+                                                 GUINT_TO_POINTER (g_array_index (type_names, GQuark, i))));
+
+  add_bucket (candidates, index->unkeyed);
+
+  g_ptr_array_sort (candidates, compare_rule_entries);
+
+  for (i = 0; i < candidates->len; i++)
+    {
+      RuleEntry *entry = candidates->pdata[i];
+
+      /* A node listing the same class twice finds its rules twice */
+      if (entry == prev_entry)
+        continue;
+      prev_entry = entry;
+
+      if (entry->sels == NULL)
+        {
+          add_imported_properties (a_this, a_nodesheet, entry->stmt, a_node, props);
+          continue;
+        }
+
+      if (!rule_entry_ancestors_may_match (entry, a_node))
+        continue;
+
+      if (selector_matches_node (entry->sels, entry->n_sels, a_node))
+        {
+          CRDeclaration *cur_decl = NULL;
+
+          /* In order to sort the matching properties, we need the
+           * specificity of the selector that actually matched this
+           * element. In a non-thread-safe fashion, we store it in the
+           * ruleset. (Fixing this would mean keeping the specificity
+           * alongside each declaration, and we have no need for
+           * thread-safety anyways.)
+           *
+           * Once we've sorted the properties, the specificity no longer
+           * matters and it can be safely overridden.
+           */
+          entry->stmt->specificity = entry->specificity;
+
+          for (cur_decl = entry->stmt->kind.ruleset->decl_list; cur_decl; cur_decl = cur_decl->next)
+            g_ptr_array_add (props, cur_decl);
+        }
     }
+
+  g_ptr_array_free (candidates, TRUE);
 }
 
 #define ORIGIN_AUTHOR_IMPORTANT (ORIGIN_AUTHOR + 1)
@@ -1090,6 +2026,28 @@ GFile *
 _st_theme_resolve_url (StTheme      *theme,
                        CRStyleSheet *base_stylesheet,
                        const char   *url)
+{
+  const char *base_filename = NULL;
+
+  if (base_stylesheet != NULL)
+    {
+      base_filename = g_hash_table_lookup (theme->filenames_by_stylesheet, base_stylesheet);
+
+      if (base_filename == NULL)
+      {
+        g_warning ("Can't get base to resolve url '%s'", url);
+        return NULL;
+      }
+    }
+
+  return resolve_url_relative_to (base_filename, url);
+}
+
+/* The part of _st_theme_resolve_url() that doesn't need the theme, so
+ * that it can also be used while loading stylesheets in a thread */
+static GFile *
+resolve_url_relative_to (const char *base_filename,
+                         const char *url)
 {
   char *scheme;
   GFile *stylesheet, *resource;
@@ -1099,19 +2057,10 @@ _st_theme_resolve_url (StTheme      *theme,
       g_free (scheme);
       resource = g_file_new_for_uri (url);
     }
-  else if (base_stylesheet != NULL)
+  else if (base_filename != NULL)
     {
-      const char *base_filename = NULL;
       char *dirname;
 
-      base_filename = g_hash_table_lookup (theme->filenames_by_stylesheet, base_stylesheet);
-
-      if (base_filename == NULL)
-      {
-        g_warning ("Can't get base to resolve url '%s'", url);
-        return NULL;
-      }
-
       dirname = g_path_get_dirname (base_filename); /* returns . if empty */
       stylesheet = g_file_new_for_path (dirname);   /* always returns something */
       resource = g_file_resolve_relative_path (stylesheet, url);
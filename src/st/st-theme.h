@@ -20,7 +20,7 @@
 #ifndef __ST_THEME_H__
 #define __ST_THEME_H__
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 #include "st-theme-node.h"
 
@@ -52,6 +52,14 @@ StTheme *st_theme_new (const char *application_stylesheet,
                        const char *default_stylesheet);
 
 gboolean  st_theme_load_stylesheet        (StTheme *theme, const char *path, GError **error);
+void      st_theme_load_stylesheet_async  (StTheme             *theme,
+                                           const char          *path,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+gboolean  st_theme_load_stylesheet_finish (StTheme       *theme,
+                                           GAsyncResult  *result,
+                                           GError       **error);
 void      st_theme_unload_stylesheet      (StTheme *theme, const char *path);
 GSList   *st_theme_get_custom_stylesheets (StTheme *theme);
 
@@ -384,6 +384,8 @@ st_widget_paint_background (StWidget *widget)
   else
     st_theme_node_paint (theme_node, cogl_get_draw_framebuffer (), &allocation, opacity);
 
+  _st_theme_node_queue_redraw_on_image_loads (theme_node, CLUTTER_ACTOR (widget));
+
   // ClutterEffect *effect = clutter_actor_get_effect (actor, "background-effect");
 
   // if (effect == NULL)
@@ -493,11 +495,40 @@ st_widget_style_changed (StWidget *widget)
     g_object_unref (old_theme_node);
 }
 
+/* Restyles the widgets below @actor whose theme node is no longer
+ * current in @context. A restyled widget notifies its own children
+ * when its node changes, so only unaffected widgets are descended into.
+ */
+static void
+restyle_stale_widgets (ClutterActor   *self,
+                       StThemeContext *context)
+{
+  ClutterActorIter iter;
+  ClutterActor *actor;
+
+  clutter_actor_iter_init (&iter, self);
+  while (clutter_actor_iter_next (&iter, &actor))
+    {
+      if (ST_IS_WIDGET (actor))
+        {
+          StThemeNode *theme_node = ST_WIDGET (actor)->priv->theme_node;
+
+          if (theme_node == NULL ||
+              !_st_theme_context_node_is_current (context, theme_node))
+            st_widget_style_changed (ST_WIDGET (actor));
+          else
+            restyle_stale_widgets (actor, context);
+        }
+      else
+        restyle_stale_widgets (actor, context);
+    }
+}
+
 static void
 on_theme_context_changed (StThemeContext *context,
                           ClutterStage      *stage)
 {
-  notify_children_of_style_change (CLUTTER_ACTOR (stage));
+  restyle_stale_widgets (CLUTTER_ACTOR (stage), context);
 }
 
 static StThemeNode *
@@ -1554,6 +1585,11 @@ st_widget_recompute_style (StWidget    *widget,
       return;
     }
 
+  /* Avoid matching the stylesheets again when only the inline style
+   * changed, or the state of an ancestor that no selector depends on */
+  if (old_theme_node)
+    _st_theme_node_reuse_matched_properties (new_theme_node, old_theme_node);
+
   _st_theme_node_apply_margins (new_theme_node, CLUTTER_ACTOR (widget));
 
   if (!old_theme_node ||
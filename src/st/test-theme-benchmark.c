@@ -0,0 +1,676 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * test-theme-benchmark.c: benchmark for the CSS styling code
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Generates a synthetic stylesheet and a tree of theme nodes (and of
+ * widgets) of the requested size, times the stages of styling them and
+ * prints the results as JSON, so that they can be compared between
+ * commits:
+ *
+ *  parse:   loading the stylesheet into a new theme
+ *  match:   matching the selectors against a fresh node tree
+ *  cascade: computing the geometry, background and font of each node
+ *  lookups: the getters on nodes that are already computed
+ *  restyle: switching the theme of a stage full of widgets
+ */
+
+#include <clutter/clutter.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+
+#include "st-bin.h"
+#include "st-box-layout.h"
+#include "st-label.h"
+#include "st-theme.h"
+#include "st-theme-context.h"
+#include "st-widget.h"
+
+/* The number of selectors a deep descendant rule has at most */
+#define MAX_SELECTOR_DEPTH 6
+
+/* How many times the getters are called on each node per iteration */
+#define LOOKUP_ROUNDS 10
+
+static int n_rules = 2000;
+static int n_classes = 200;
+static int tree_depth = 5;
+static int tree_width = 4;
+static int iterations = 10;
+static int seed = 1;
+static char *output_path = NULL;
+
+static GOptionEntry entries[] = {
+  { "rules", 'r', 0, G_OPTION_ARG_INT, &n_rules, "Number of rules in the stylesheet", "N" },
+  { "classes", 'c', 0, G_OPTION_ARG_INT, &n_classes, "Number of distinct style classes", "N" },
+  { "depth", 'd', 0, G_OPTION_ARG_INT, &tree_depth, "Depth of the node tree", "N" },
+  { "width", 'w', 0, G_OPTION_ARG_INT, &tree_width, "Number of children of each node", "N" },
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of times each stage is timed", "N" },
+  { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed of the generated stylesheet and tree", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "Write the JSON results to FILE instead of stdout", "FILE" },
+  { NULL }
+};
+
+typedef struct {
+  const char *name;
+  GArray     *samples; /* of gdouble, in milliseconds */
+} Stage;
+
+static Stage stages[] = {
+  { "parse", NULL },
+  { "match", NULL },
+  { "cascade", NULL },
+  { "lookups", NULL },
+  { "restyle", NULL },
+};
+
+enum {
+  STAGE_PARSE,
+  STAGE_MATCH,
+  STAGE_CASCADE,
+  STAGE_LOOKUPS,
+  STAGE_RESTYLE
+};
+
+static void
+add_sample (int    stage,
+            gint64 start)
+{
+  gdouble ms = (g_get_monotonic_time () - start) / 1000.;
+
+  g_array_append_val (stages[stage].samples, ms);
+}
+
+static int
+n_tree_nodes (void)
+{
+  int n = 0, level = 1, i;
+
+  for (i = 0; i < tree_depth; i++)
+    {
+      n += level;
+      level *= tree_width;
+    }
+
+  return n;
+}
+
+static void
+append_color (GString *css,
+              GRand   *rand)
+{
+  g_string_append_printf (css, "#%06x", g_rand_int_range (rand, 0, 0x1000000));
+}
+
+static void
+append_class_selector (GString *css,
+                       GRand   *rand)
+{
+  switch (g_rand_int_range (rand, 0, 4))
+    {
+    case 0:
+      g_string_append (css, "StBoxLayout");
+      break;
+    case 1:
+      g_string_append (css, "StBin");
+      break;
+    default:
+      break;
+    }
+
+  g_string_append_printf (css, ".c%d", g_rand_int_range (rand, 0, n_classes));
+}
+
+/* The same seed generates the same selectors; @variant changes the
+ * values, so that switching between the variants restyles everything.
+ */
+static char *
+generate_stylesheet (int variant)
+{
+  GString *css = g_string_new (NULL);
+  GRand *rand = g_rand_new_with_seed (seed);
+  GRand *values = g_rand_new_with_seed (seed + variant);
+  int n_nodes = n_tree_nodes ();
+  int i, j, depth;
+
+  g_string_append (css, "stage {\n  font: 12px sans-serif;\n  color: #ffffff;\n}\n\n");
+
+  for (i = 0; i < n_rules; i++)
+    {
+      switch (i % 8)
+        {
+        case 0:
+          append_class_selector (css, rand);
+          g_string_append_printf (css, " {\n  padding: %dpx %dpx;\n}\n\n",
+                                  g_rand_int_range (values, 0, 16),
+                                  g_rand_int_range (values, 0, 16));
+          break;
+        case 1:
+          append_class_selector (css, rand);
+          g_string_append_c (css, ' ');
+          append_class_selector (css, rand);
+          g_string_append (css, " {\n  color: ");
+          append_color (css, values);
+          g_string_append (css, ";\n}\n\n");
+          break;
+        case 2:
+          depth = g_rand_int_range (rand, 3, MAX_SELECTOR_DEPTH + 1);
+          for (j = 0; j < depth; j++)
+            {
+              if (j > 0)
+                g_string_append (css, g_rand_boolean (rand) ? " " : " > ");
+              append_class_selector (css, rand);
+            }
+          g_string_append_printf (css, " {\n  border: %dpx solid ",
+                                  g_rand_int_range (values, 0, 4));
+          append_color (css, values);
+          g_string_append (css, ";\n  border-radius: ");
+          g_string_append_printf (css, "%dpx;\n}\n\n", g_rand_int_range (values, 0, 8));
+          break;
+        case 3:
+          g_string_append_printf (css, "StBoxLayout.c%d {\n  spacing: %dpx;\n}\n\n",
+                                  g_rand_int_range (rand, 0, n_classes),
+                                  g_rand_int_range (values, 0, 12));
+          break;
+        case 4:
+          g_string_append_printf (css, "#w%d {\n  margin: %dpx;\n  min-width: %dpx;\n}\n\n",
+                                  g_rand_int_range (rand, 0, MAX (n_nodes, 1)),
+                                  g_rand_int_range (values, 0, 8),
+                                  g_rand_int_range (values, 0, 200));
+          break;
+        case 5:
+          append_class_selector (css, rand);
+          g_string_append (css, ":hover {\n  background-color: ");
+          append_color (css, values);
+          g_string_append (css, ";\n}\n\n");
+          break;
+        case 6:
+          append_class_selector (css, rand);
+          g_string_append (css, " StLabel {\n  font-size: ");
+          g_string_append_printf (css, "%dpt;\n  font-weight: %s;\n}\n\n",
+                                  g_rand_int_range (values, 8, 16),
+                                  g_rand_boolean (values) ? "bold" : "normal");
+          break;
+        default:
+          append_class_selector (css, rand);
+          g_string_append (css, " {\n  background-color: ");
+          append_color (css, values);
+          g_string_append_printf (css, ";\n  icon-size: %dpx;\n  -x-bench-%d: %d;\n}\n\n",
+                                  g_rand_int_range (values, 8, 48),
+                                  g_rand_int_range (rand, 0, 16),
+                                  g_rand_int_range (values, 0, 100));
+          break;
+        }
+    }
+
+  g_rand_free (rand);
+  g_rand_free (values);
+
+  return g_string_free (css, FALSE);
+}
+
+typedef struct {
+  GType  type;
+  char  *id;
+  char  *classes;
+  char  *pseudo_class;
+  int    parent;         /* index of the parent, -1 for the top level */
+} TreeItem;
+
+static void
+tree_item_clear (gpointer data)
+{
+  TreeItem *item = data;
+
+  g_free (item->id);
+  g_free (item->classes);
+}
+
+static void
+generate_tree_below (GArray *tree,
+                     GRand  *rand,
+                     int     parent,
+                     int     depth)
+{
+  int i;
+
+  if (depth >= tree_depth)
+    return;
+
+  for (i = 0; i < (parent < 0 ? 1 : tree_width); i++)
+    {
+      TreeItem item;
+      int index = tree->len;
+
+      if (depth == tree_depth - 1)
+        item.type = ST_TYPE_LABEL;
+      else
+        item.type = depth % 2 ? ST_TYPE_BIN : ST_TYPE_BOX_LAYOUT;
+      item.id = g_strdup_printf ("w%d", index);
+      item.classes = g_strdup_printf ("c%d c%d",
+                                      g_rand_int_range (rand, 0, n_classes),
+                                      g_rand_int_range (rand, 0, n_classes));
+      item.pseudo_class = g_rand_int_range (rand, 0, 8) == 0 ? "hover" : NULL;
+      item.parent = parent;
+      g_array_append_val (tree, item);
+
+      generate_tree_below (tree, rand, index, depth + 1);
+    }
+}
+
+/* Parents always come before their children */
+static GArray *
+generate_tree (void)
+{
+  GArray *tree = g_array_new (FALSE, FALSE, sizeof (TreeItem));
+  GRand *rand = g_rand_new_with_seed (seed);
+
+  g_array_set_clear_func (tree, tree_item_clear);
+  generate_tree_below (tree, rand, -1, 0);
+  g_rand_free (rand);
+
+  return tree;
+}
+
+static GPtrArray *
+create_nodes (StThemeContext *context,
+              GArray         *tree)
+{
+  GPtrArray *nodes = g_ptr_array_new_full (tree->len, g_object_unref);
+  StThemeNode *root = st_theme_context_get_root_node (context);
+  guint i;
+
+  for (i = 0; i < tree->len; i++)
+    {
+      TreeItem *item = &g_array_index (tree, TreeItem, i);
+      StThemeNode *parent = item->parent < 0 ? root : nodes->pdata[item->parent];
+
+      g_ptr_array_add (nodes, st_theme_node_new (context, parent, NULL, item->type,
+                                                 item->id, item->classes,
+                                                 item->pseudo_class, NULL, FALSE));
+    }
+
+  return nodes;
+}
+
+static GPtrArray *
+create_widgets (ClutterActor *stage,
+                GArray       *tree)
+{
+  GPtrArray *widgets = g_ptr_array_new_full (tree->len, NULL);
+  guint i;
+
+  for (i = 0; i < tree->len; i++)
+    {
+      TreeItem *item = &g_array_index (tree, TreeItem, i);
+      ClutterActor *parent = item->parent < 0 ? stage : widgets->pdata[item->parent];
+      ClutterActor *widget;
+
+      if (item->type == ST_TYPE_LABEL)
+        widget = CLUTTER_ACTOR (st_label_new ("Label"));
+      else
+        widget = g_object_new (item->type, NULL);
+
+      clutter_actor_set_name (widget, item->id);
+      st_widget_set_style_class_name (ST_WIDGET (widget), item->classes);
+      if (item->pseudo_class)
+        st_widget_set_style_pseudo_class (ST_WIDGET (widget), item->pseudo_class);
+
+      clutter_actor_add_child (parent, widget);
+      g_ptr_array_add (widgets, widget);
+    }
+
+  return widgets;
+}
+
+/* The stylesheet cache doesn't store files modified in the future, so
+ * dating the generated stylesheets a day ahead keeps it from writing
+ * anything, both out of the measurements and after we cleaned up. */
+static void
+write_stylesheet (const char *path,
+                  const char *css)
+{
+  struct utimbuf times;
+
+  g_file_set_contents (path, css, -1, NULL);
+
+  times.actime = times.modtime = time (NULL) + 24 * 60 * 60;
+  g_utime (path, &times);
+}
+
+static void
+remove_dir_recursive (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          char *child = g_build_filename (path, name, NULL);
+
+          if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+              !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+            remove_dir_recursive (child);
+          else
+            g_unlink (child);
+
+          g_free (child);
+        }
+      g_dir_close (dir);
+    }
+
+  g_rmdir (path);
+}
+
+static void
+time_parse (const char *dir,
+            const char *css)
+{
+  int i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      StTheme *theme;
+      char *filename, *path;
+      gint64 start;
+
+      /* A new file each time, so that the parse is never answered
+       * from the on-disk stylesheet cache */
+      filename = g_strdup_printf ("parse-%d.css", i);
+      path = g_build_filename (dir, filename, NULL);
+      write_stylesheet (path, css);
+
+      start = g_get_monotonic_time ();
+      theme = st_theme_new (NULL, path, NULL);
+      add_sample (STAGE_PARSE, start);
+
+      g_object_unref (theme);
+      g_unlink (path);
+      g_free (path);
+      g_free (filename);
+    }
+}
+
+static void
+time_nodes (StThemeContext *context,
+            GArray         *tree)
+{
+  int i, round;
+  guint j;
+
+  for (i = 0; i < iterations; i++)
+    {
+      GPtrArray *nodes;
+      gint64 start;
+      double value;
+      ClutterColor color;
+
+      nodes = create_nodes (context, tree);
+
+      /* A property nobody sets: the node matches the stylesheet
+       * and indexes its properties, but computes nothing */
+      start = g_get_monotonic_time ();
+      for (j = 0; j < nodes->len; j++)
+        st_theme_node_lookup_double (nodes->pdata[j], "-x-bench-unset", FALSE, &value);
+      add_sample (STAGE_MATCH, start);
+
+      start = g_get_monotonic_time ();
+      for (j = 0; j < nodes->len; j++)
+        {
+          StThemeNode *node = nodes->pdata[j];
+
+          st_theme_node_get_border_width (node, ST_SIDE_TOP);
+          st_theme_node_get_background_color (node, &color);
+          st_theme_node_get_foreground_color (node, &color);
+          st_theme_node_get_font (node);
+        }
+      add_sample (STAGE_CASCADE, start);
+
+      start = g_get_monotonic_time ();
+      for (round = 0; round < LOOKUP_ROUNDS; round++)
+        {
+          for (j = 0; j < nodes->len; j++)
+            {
+              StThemeNode *node = nodes->pdata[j];
+
+              st_theme_node_get_padding (node, ST_SIDE_LEFT);
+              st_theme_node_get_margin (node, ST_SIDE_TOP);
+              st_theme_node_get_border_radius (node, ST_CORNER_TOPLEFT);
+              st_theme_node_get_background_color (node, &color);
+              st_theme_node_get_foreground_color (node, &color);
+              st_theme_node_get_length (node, "spacing");
+              st_theme_node_lookup_double (node, "-x-bench-3", TRUE, &value);
+            }
+        }
+      add_sample (STAGE_LOOKUPS, start);
+
+      g_ptr_array_unref (nodes);
+    }
+}
+
+static void
+time_restyle (ClutterActor   *stage,
+              StThemeContext *context,
+              GArray         *tree,
+              StTheme        *theme_a,
+              StTheme        *theme_b)
+{
+  GPtrArray *widgets;
+  int i;
+  guint j;
+
+  st_theme_context_set_theme (context, theme_a);
+  widgets = create_widgets (stage, tree);
+  for (j = 0; j < widgets->len; j++)
+    st_widget_ensure_style (widgets->pdata[j]);
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      /* The stage is not shown, so the widgets are only restyled
+       * once asked for their style, like on the next allocation */
+      st_theme_context_set_theme (context, i % 2 ? theme_a : theme_b);
+      for (j = 0; j < widgets->len; j++)
+        st_widget_ensure_style (widgets->pdata[j]);
+
+      add_sample (STAGE_RESTYLE, start);
+    }
+
+  clutter_actor_destroy_all_children (stage);
+  g_ptr_array_unref (widgets);
+}
+
+static int
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static void
+append_double (GString    *json,
+               const char *name,
+               gdouble     value,
+               gboolean    last)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf (json, "\"%s\": %s%s", name,
+                          g_ascii_formatd (buf, sizeof (buf), "%.4f", value),
+                          last ? "" : ", ");
+}
+
+static char *
+results_to_json (guint n_nodes,
+                 gsize css_size)
+{
+  GString *json = g_string_new (NULL);
+  guint i, j;
+
+  g_string_append (json, "{\n");
+  g_string_append (json, "  \"benchmark\": \"st-theme\",\n");
+  g_string_append_printf (json,
+                          "  \"parameters\": { \"rules\": %d, \"classes\": %d, "
+                          "\"depth\": %d, \"width\": %d, \"iterations\": %d, "
+                          "\"seed\": %d },\n",
+                          n_rules, n_classes, tree_depth, tree_width, iterations, seed);
+  g_string_append_printf (json, "  \"nodes\": %u,\n", n_nodes);
+  g_string_append_printf (json, "  \"stylesheet_bytes\": %" G_GSIZE_FORMAT ",\n", css_size);
+  g_string_append (json, "  \"results_ms\": {\n");
+
+  for (i = 0; i < G_N_ELEMENTS (stages); i++)
+    {
+      GArray *samples = stages[i].samples;
+      gdouble total = 0;
+
+      g_array_sort (samples, compare_doubles);
+      for (j = 0; j < samples->len; j++)
+        total += g_array_index (samples, gdouble, j);
+
+      g_string_append_printf (json, "    \"%s\": { ", stages[i].name);
+      if (samples->len > 0)
+        {
+          append_double (json, "min", g_array_index (samples, gdouble, 0), FALSE);
+          append_double (json, "median", g_array_index (samples, gdouble, samples->len / 2), FALSE);
+          append_double (json, "mean", total / samples->len, FALSE);
+          append_double (json, "max", g_array_index (samples, gdouble, samples->len - 1), TRUE);
+        }
+      g_string_append_printf (json, " }%s\n", i + 1 < G_N_ELEMENTS (stages) ? "," : "");
+    }
+
+  g_string_append (json, "  }\n}\n");
+
+  return g_string_free (json, FALSE);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *option_context;
+  GError *error = NULL;
+  ClutterActor *stage;
+  StThemeContext *context;
+  StTheme *theme_a, *theme_b;
+  PangoFontDescription *font;
+  GArray *tree;
+  char *dir, *path_a, *path_b;
+  char *css_a, *css_b, *cache_dir, *json;
+  guint i;
+
+  option_context = g_option_context_new ("- benchmark the CSS styling code");
+  g_option_context_add_main_entries (option_context, entries, NULL);
+  /* Leave the rest to clutter_init() */
+  g_option_context_set_ignore_unknown_options (option_context, TRUE);
+  if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (option_context);
+
+  if (n_rules < 0 || n_classes < 1 || tree_depth < 1 || tree_width < 1 || iterations < 1)
+    {
+      g_printerr ("Invalid parameters\n");
+      return 1;
+    }
+
+  dir = g_dir_make_tmp ("st-theme-benchmark-XXXXXX", &error);
+  if (dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  /* Keep the stylesheet cache of the user out of the measurements */
+  cache_dir = g_build_filename (dir, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
+    {
+      remove_dir_recursive (dir);
+      return 1;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (stages); i++)
+    stages[i].samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  css_a = generate_stylesheet (0);
+  css_b = generate_stylesheet (1);
+  path_a = g_build_filename (dir, "a.css", NULL);
+  path_b = g_build_filename (dir, "b.css", NULL);
+  write_stylesheet (path_a, css_a);
+  write_stylesheet (path_b, css_b);
+  tree = generate_tree ();
+
+  time_parse (dir, css_a);
+
+  theme_a = st_theme_new (NULL, path_a, NULL);
+  theme_b = st_theme_new (NULL, path_b, NULL);
+
+  stage = clutter_stage_new ();
+  context = st_theme_context_get_for_stage (CLUTTER_STAGE (stage));
+  font = pango_font_description_from_string ("sans-serif 12");
+  st_theme_context_set_font (context, font);
+  pango_font_description_free (font);
+  st_theme_context_set_theme (context, theme_a);
+
+  time_nodes (context, tree);
+  time_restyle (stage, context, tree, theme_a, theme_b);
+
+  json = results_to_json (tree->len, strlen (css_a));
+  if (output_path != NULL)
+    {
+      if (!g_file_set_contents (output_path, json, -1, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          g_clear_error (&error);
+        }
+    }
+  else
+    g_print ("%s", json);
+
+  clutter_actor_destroy (stage);
+  g_object_unref (theme_a);
+  g_object_unref (theme_b);
+
+  g_unlink (path_a);
+  g_unlink (path_b);
+
+  g_free (json);
+  g_free (css_a);
+  g_free (css_b);
+  g_free (path_a);
+  g_free (path_b);
+  g_array_unref (tree);
+  for (i = 0; i < G_N_ELEMENTS (stages); i++)
+    g_array_unref (stages[i].samples);
+
+  remove_dir_recursive (dir);
+  g_free (cache_dir);
+  g_free (dir);
+
+  return 0;
+}